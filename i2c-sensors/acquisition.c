@@ -0,0 +1,250 @@
+/* Acquisition thread feeding a single-consumer ring */
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "acquisition.h"
+
+#include "common.h"
+#include "error-utilities.h"
+#include "i2c-sensors.h"
+#include "time-utilities.h"
+
+#define CACHE_LINE 64
+
+/* CPU_SETSIZE without _GNU_SOURCE, which would clash with our error_t. */
+#define MAX_CPUS 1024
+#define MASK_BITS (CHAR_BIT * sizeof (unsigned long))
+
+/* How long the thread sleeps at most before looking at the stop flag. */
+#define WAIT_TIMEOUT 100  /* ms */
+
+struct acquisition {
+  /* Written by the producer only. */
+  size_t head __attribute__ ((aligned (CACHE_LINE)));
+  unsigned long overflows;
+
+  /* Written by the consumer only. */
+  size_t tail __attribute__ ((aligned (CACHE_LINE)));
+
+  /* Set up front, read by both. */
+  acquisition_record_t *records __attribute__ ((aligned (CACHE_LINE)));
+  size_t mask;
+  i2c_sensors_t *sensors;
+  pthread_t thread;
+  int cpu;
+  bool stop;
+  bool running;
+  error_t error;  /* Why the thread stopped; valid once running is false */
+};
+
+static void *run (void *const arg);
+static bool pin (const int cpu, error_t *const err);
+static inline bool any_result (const i2c_sensors_result_t *const res);
+
+acquisition_t *
+acquisition_new ( i2c_sensors_t *const sensors
+                , const acquisition_config_t *const config
+                , error_t *const err )
+{
+  acquisition_t *acq;
+  int errnum;
+
+  if ((errnum = posix_memalign ((void **)&acq, CACHE_LINE, sizeof (*acq)))) {
+    error_strerror (err, errnum);
+    error_prefix (err, "posix_memalign failed");
+    goto malloc_failed;
+  }
+
+  size_t capacity = 1;
+  while (capacity < config->capacity)
+    capacity <<= 1;
+
+  if (! (acq->records = calloc (capacity, sizeof (acquisition_record_t)))) {
+    error_errno (err);
+    error_prefix (err, "calloc failed");
+    goto calloc_failed;
+  }
+
+  acq->head = acq->tail = 0;
+  acq->overflows = 0;
+  acq->mask = capacity - 1;
+  acq->sensors = sensors;
+  acq->cpu = config->cpu;
+  acq->stop = false;
+  acq->running = true;
+  error_init (&acq->error, true);
+
+  if (config->lock_memory && mlockall (MCL_CURRENT | MCL_FUTURE) < 0) {
+    error_errno (err);
+    error_prefix (err, "mlockall failed");
+    goto lock_failed;
+  }
+
+  pthread_attr_t attr;
+  if ((errnum = pthread_attr_init (&attr))) {
+    error_strerror (err, errnum);
+    error_prefix (err, "pthread_attr_init failed");
+    goto attr_failed;
+  }
+
+  if (config->priority > 0) {
+    struct sched_param param = { .sched_priority = config->priority };
+    if ((errnum = pthread_attr_setinheritsched (&attr,
+                                                PTHREAD_EXPLICIT_SCHED)) ||
+        (errnum = pthread_attr_setschedpolicy (&attr, SCHED_FIFO)) ||
+        (errnum = pthread_attr_setschedparam (&attr, &param))) {
+      error_strerror (err, errnum);
+      error_prefix (err, "setting SCHED_FIFO failed");
+      goto attr_set_failed;
+    }
+  }
+
+  if (config->cpu >= MAX_CPUS) {
+    error_printf (err, "CPU %d out of range", config->cpu);
+    goto attr_set_failed;
+  }
+
+  if ((errnum = pthread_create (&acq->thread, &attr, run, acq))) {
+    error_strerror (err, errnum);
+    error_prefix (err, "pthread_create failed");
+    goto attr_set_failed;
+  }
+
+  pthread_attr_destroy (&attr);
+
+  return acq;
+
+attr_set_failed:
+  pthread_attr_destroy (&attr);
+
+attr_failed:
+  /* For a retry without it */
+  if (config->lock_memory)
+    munlockall ();
+
+lock_failed:
+  free (acq->records);
+
+calloc_failed:
+  free (acq);
+
+malloc_failed:
+  error_prefix (err, "acquisition_new");
+  return NULL;
+}
+
+void
+acquisition_free (acquisition_t *const acq)
+{
+  __atomic_store_n (&acq->stop, true, __ATOMIC_RELAXED);
+  pthread_join (acq->thread, NULL);
+
+  free (acq->records);
+  acq->records = (acquisition_record_t *)POISON;
+  acq->sensors = (i2c_sensors_t *)POISON;
+
+  free (acq);
+}
+
+size_t
+acquisition_read ( acquisition_t *const acq, acquisition_record_t *const records
+                 , const size_t max )
+{
+  size_t tail = acq->tail
+       , head = __atomic_load_n (&acq->head, __ATOMIC_ACQUIRE)
+       , n = head - tail;
+
+  if (n > max)
+    n = max;
+
+  for (size_t i = 0; i < n; ++i)
+    records[i] = acq->records[(tail + i) & acq->mask];
+
+  __atomic_store_n (&acq->tail, tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+unsigned long
+acquisition_overflows (const acquisition_t *const acq)
+{
+  return __atomic_load_n (&acq->overflows, __ATOMIC_RELAXED);
+}
+
+bool
+acquisition_running (acquisition_t *const acq, error_t *const err)
+{
+  if (__atomic_load_n (&acq->running, __ATOMIC_ACQUIRE))
+    return true;
+
+  error_insert (err, error_message (&acq->error));
+  return false;
+}
+
+static void *
+run (void *const arg)
+{
+  acquisition_t *acq = arg;
+  acquisition_record_t rec;
+
+  if (acq->cpu >= 0 && ! pin (acq->cpu, &acq->error))
+    goto error;
+
+  while (! __atomic_load_n (&acq->stop, __ATOMIC_RELAXED)) {
+    if (! i2c_sensors_wait (acq->sensors, &rec.res, WAIT_TIMEOUT, &acq->error))
+      goto error;
+
+    if (! any_result (&rec.res))
+      continue;
+
+    rec.time = time_monotonic ();
+
+    size_t head = acq->head
+         , tail = __atomic_load_n (&acq->tail, __ATOMIC_ACQUIRE);
+
+    /* Full: drop the new record rather than make the bus wait. */
+    if (head - tail > acq->mask) {
+      __atomic_store_n (&acq->overflows, acq->overflows + 1, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    acq->records[head & acq->mask] = rec;
+    __atomic_store_n (&acq->head, head + 1, __ATOMIC_RELEASE);
+  }
+
+  return NULL;
+
+error:
+  error_prefix (&acq->error, "acquisition");
+  __atomic_store_n (&acq->running, false, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* The calling thread only. */
+static bool
+pin (const int cpu, error_t *const err)
+{
+  unsigned long mask[MAX_CPUS / MASK_BITS] = { 0 };
+  mask[cpu / MASK_BITS] = 1UL << (cpu % MASK_BITS);
+
+  if (syscall (SYS_sched_setaffinity, 0, sizeof (mask), mask) < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "pinning to CPU %d failed", cpu);
+    return false;
+  }
+
+  return true;
+}
+
+static inline bool
+any_result (const i2c_sensors_result_t *const res)
+{
+  return res->baro.have_result || res->gyro.have_result ||
+         res->acc.have_result  || res->mag.have_result;
+}
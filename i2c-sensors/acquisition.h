@@ -0,0 +1,60 @@
+/* Acquisition thread feeding a single-consumer ring */
+
+#ifndef INCLUDE_ACQUISITION_H
+#define INCLUDE_ACQUISITION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error-utilities.h"
+#include "i2c-sensors.h"
+
+typedef struct acquisition acquisition_t;
+
+typedef struct {
+  int64_t time;  /* CLOCK_MONOTONIC ns when the results came in */
+  i2c_sensors_result_t res;
+} acquisition_record_t;
+
+typedef struct {
+  int priority;      /* SCHED_FIFO priority; 0 keeps the default policy */
+  int cpu;           /* CPU to pin the thread to; -1 for any */
+  bool lock_memory;  /* mlockall the process before starting */
+  size_t capacity;   /* Records in the ring, rounded up to a power of two */
+} acquisition_config_t;
+
+/* Start a thread that loops on i2c_sensors_wait and pushes every wait that
+ * produced a result into the ring. Event-driven acquisition must have been
+ * started on sensors, and nobody else may use sensors until
+ * acquisition_free. Without the privileges for a priority or lock_memory it
+ * fails with errno EPERM, EAGAIN or ENOMEM, and leaves the memory unlocked
+ * for a try without them.
+ */
+acquisition_t *
+acquisition_new ( i2c_sensors_t *const sensors
+                , const acquisition_config_t *const config
+                , error_t *const err );
+
+/* Stops and joins the thread. */
+void
+acquisition_free (acquisition_t *const acq);
+
+/* Take up to max records, oldest first, without blocking. Only one thread
+ * may consume.
+ */
+size_t
+acquisition_read ( acquisition_t *const acq, acquisition_record_t *const records
+                 , const size_t max );
+
+/* Records dropped because the ring was full. */
+unsigned long
+acquisition_overflows (const acquisition_t *const acq);
+
+/* Whether the thread is still acquiring. Once it has stopped on an error,
+ * pinning to the CPU included, the message goes to err.
+ */
+bool
+acquisition_running (acquisition_t *const acq, error_t *const err);
+
+#endif /* INCLUDE_ACQUISITION_H */
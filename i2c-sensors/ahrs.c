@@ -0,0 +1,226 @@
+/* Mahony AHRS
+ *
+ * After R. Mahony, T. Hamel and J.-M. Pflimlin, "Nonlinear Complementary
+ * Filters on the Special Orthogonal Group", and S. Madgwick's implementation
+ * of it. The magnetometer only corrects the heading: its reference is the
+ * measured field rotated to the earth frame and laid into the x-z plane.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ahrs.h"
+
+#include "l3gd20.h"
+#include "lsm303dlhc-acc.h"
+#include "lsm303dlhc-mag.h"
+#include "time-utilities.h"
+
+static bool align (ahrs_t *const ahrs);
+static inline bool normalize (float *const v);
+static inline void cross ( const float *const a, const float *const b
+                         , float *const r );
+
+void
+ahrs_init (ahrs_t *const ahrs, const float kp, const float ki)
+{
+  ahrs->q[0] = 1.0f;
+  ahrs->q[1] = ahrs->q[2] = ahrs->q[3] = 0.0f;
+  ahrs->bias[0] = ahrs->bias[1] = ahrs->bias[2] = 0.0f;
+  ahrs->kp = kp;
+  ahrs->ki = ki;
+  ahrs->time = 0;
+  ahrs->aligned = false;
+  ahrs->have_acc = ahrs->have_mag = false;
+}
+
+void
+ahrs_acc (ahrs_t *const ahrs, const lsm303dlhc_acc_result_t *const res)
+{
+  ahrs->acc[0] = res->x;
+  ahrs->acc[1] = res->y;
+  ahrs->acc[2] = res->z;
+  ahrs->have_acc = true;
+}
+
+void
+ahrs_mag (ahrs_t *const ahrs, const lsm303dlhc_mag_result_t *const res)
+{
+  ahrs->mag[0] = res->x;
+  ahrs->mag[1] = res->y;
+  ahrs->mag[2] = res->z;
+  ahrs->have_mag = true;
+}
+
+void
+ahrs_gyro (ahrs_t *const ahrs, const l3gd20_result_t *const res)
+{
+  int64_t step = res->time - ahrs->time;
+  bool first = ahrs->time == 0;
+
+  ahrs->time = res->time;
+  if (first || step <= 0)
+    return;
+
+  if (step > AHRS_MAX_STEP)
+    step = AHRS_MAX_STEP;
+
+  const float gyro[3] = { res->x, res->y, res->z };
+  ahrs_update (ahrs, (float)step / NS_PER_S, gyro);
+}
+
+void
+ahrs_update (ahrs_t *const ahrs, const float dt, const float *const gyro)
+{
+  if (! ahrs->aligned && ahrs->have_acc && ahrs->have_mag && align (ahrs))
+    return;
+
+  float *q = ahrs->q;
+  float w = q[0], x = q[1], y = q[2], z = q[3];
+  float gx = gyro[0], gy = gyro[1], gz = gyro[2];
+
+  float a[3] = { ahrs->acc[0], ahrs->acc[1], ahrs->acc[2] };
+  if (ahrs->have_acc && normalize (a)) {
+    float ww = w*w, wx = w*x, wy = w*y, wz = w*z
+        , xx = x*x, xy = x*y, xz = x*z, yy = y*y, yz = y*z, zz = z*z;
+
+    /* Half of gravity and of north, as the estimate has them in the body
+     * frame
+     */
+    float vx = xz - wy, vy = wx + yz, vz = ww - 0.5f + zz;
+    float ex = a[1]*vz - a[2]*vy
+        , ey = a[2]*vx - a[0]*vz
+        , ez = a[0]*vy - a[1]*vx;
+
+    float m[3] = { ahrs->mag[0], ahrs->mag[1], ahrs->mag[2] };
+    if (ahrs->have_mag && normalize (m)) {
+      float hx = 2.0f * ( m[0]*(0.5f - yy - zz) + m[1]*(xy - wz)
+                        + m[2]*(xz + wy) )
+          , hy = 2.0f * ( m[0]*(xy + wz) + m[1]*(0.5f - xx - zz)
+                        + m[2]*(yz - wx) )
+          , bx = sqrtf (hx*hx + hy*hy)
+          , bz = 2.0f * ( m[0]*(xz - wy) + m[1]*(yz + wx)
+                        + m[2]*(0.5f - xx - yy) );
+
+      float nx = bx*(0.5f - yy - zz) + bz*(xz - wy)
+          , ny = bx*(xy - wz)        + bz*(wx + yz)
+          , nz = bx*(wy + xz)        + bz*(0.5f - xx - yy);
+
+      ex += m[1]*nz - m[2]*ny;
+      ey += m[2]*nx - m[0]*nz;
+      ez += m[0]*ny - m[1]*nx;
+    }
+
+    /* The errors are half size; the gains make up for it. */
+    if (ahrs->ki > 0.0f) {
+      ahrs->bias[0] -= 2.0f * ahrs->ki * ex * dt;
+      ahrs->bias[1] -= 2.0f * ahrs->ki * ey * dt;
+      ahrs->bias[2] -= 2.0f * ahrs->ki * ez * dt;
+    }
+
+    gx += 2.0f * ahrs->kp * ex;
+    gy += 2.0f * ahrs->kp * ey;
+    gz += 2.0f * ahrs->kp * ez;
+  }
+
+  gx = (gx - ahrs->bias[0]) * 0.5f * dt;
+  gy = (gy - ahrs->bias[1]) * 0.5f * dt;
+  gz = (gz - ahrs->bias[2]) * 0.5f * dt;
+
+  q[0] = w + (-x*gx - y*gy - z*gz);
+  q[1] = x + ( w*gx + y*gz - z*gy);
+  q[2] = y + ( w*gy - x*gz + z*gx);
+  q[3] = z + ( w*gz + x*gy - y*gx);
+
+  float n = 1.0f / sqrtf (q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  q[0] *= n;
+  q[1] *= n;
+  q[2] *= n;
+  q[3] *= n;
+}
+
+void
+ahrs_euler ( const ahrs_t *const ahrs, float *const roll, float *const pitch
+           , float *const yaw )
+{
+  const float *q = ahrs->q;
+  float s = 2.0f * (q[0]*q[2] - q[3]*q[1]);
+
+  *roll  = atan2f ( 2.0f * (q[0]*q[1] + q[2]*q[3])
+                  , 1.0f - 2.0f * (q[1]*q[1] + q[2]*q[2]) );
+  *pitch = s >=  1.0f ?  (float)M_PI_2
+         : s <= -1.0f ? -(float)M_PI_2
+         : asinf (s);
+  *yaw   = atan2f ( 2.0f * (q[0]*q[3] + q[1]*q[2])
+                  , 1.0f - 2.0f * (q[2]*q[2] + q[3]*q[3]) );
+}
+
+/* Set q to the attitude the last acc and mag samples point at: up is
+ * against gravity, west across up and the field, north across west and up.
+ * Those are the rows of the rotation from the body to the earth frame.
+ */
+static bool
+align (ahrs_t *const ahrs)
+{
+  float u[3] = { ahrs->acc[0], ahrs->acc[1], ahrs->acc[2] }, w[3], n[3];
+
+  cross (u, ahrs->mag, w);
+  if (! (normalize (u) && normalize (w)))
+    return false;
+  cross (w, u, n);
+
+  /* Rotation matrix to quaternion, by its largest component */
+  float *q = ahrs->q, t = n[0] + w[1] + u[2];
+  if (t > 0.0f) {
+    float s = 0.5f / sqrtf (t + 1.0f);
+    q[0] = 0.25f / s;
+    q[1] = (u[1] - w[2]) * s;
+    q[2] = (n[2] - u[0]) * s;
+    q[3] = (w[0] - n[1]) * s;
+  } else if (n[0] > w[1] && n[0] > u[2]) {
+    float s = 2.0f * sqrtf (1.0f + n[0] - w[1] - u[2]);
+    q[0] = (u[1] - w[2]) / s;
+    q[1] = 0.25f * s;
+    q[2] = (n[1] + w[0]) / s;
+    q[3] = (n[2] + u[0]) / s;
+  } else if (w[1] > u[2]) {
+    float s = 2.0f * sqrtf (1.0f + w[1] - n[0] - u[2]);
+    q[0] = (n[2] - u[0]) / s;
+    q[1] = (n[1] + w[0]) / s;
+    q[2] = 0.25f * s;
+    q[3] = (w[2] + u[1]) / s;
+  } else {
+    float s = 2.0f * sqrtf (1.0f + u[2] - n[0] - w[1]);
+    q[0] = (w[0] - n[1]) / s;
+    q[1] = (n[2] + u[0]) / s;
+    q[2] = (w[2] + u[1]) / s;
+    q[3] = 0.25f * s;
+  }
+
+  ahrs->aligned = true;
+  return true;
+}
+
+/* Scale v to unit length; false if it has none. */
+static inline bool
+normalize (float *const v)
+{
+  float n2 = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+  if (! (n2 > 0.0f))
+    return false;
+
+  float n = 1.0f / sqrtf (n2);
+  v[0] *= n;
+  v[1] *= n;
+  v[2] *= n;
+  return true;
+}
+
+static inline void
+cross (const float *const a, const float *const b, float *const r)
+{
+  r[0] = a[1]*b[2] - a[2]*b[1];
+  r[1] = a[2]*b[0] - a[0]*b[2];
+  r[2] = a[0]*b[1] - a[1]*b[0];
+}
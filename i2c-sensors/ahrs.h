@@ -0,0 +1,76 @@
+/* Attitude and heading from the gyro, accelerometer and magnetometer
+ *
+ * Mahony's nonlinear complementary filter, in float: the gyro rates are
+ * integrated into a quaternion, and the directions of gravity and of the
+ * magnetic field pull it back, proportionally and through an integral that
+ * ends up as the gyro bias. One step per gyro sample, with whichever
+ * accelerometer and magnetometer samples came last.
+ *
+ * The earth frame has x to magnetic north, y to the west and z up. All three
+ * sensors are taken to share their axes; rotate them into one body frame
+ * first if they do not.
+ */
+
+#ifndef INCLUDE_AHRS_H
+#define INCLUDE_AHRS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "l3gd20.h"
+#include "lsm303dlhc-acc.h"
+#include "lsm303dlhc-mag.h"
+
+/* Gains for a gyro that drifts by a few °/s and sensors that settle in
+ * seconds.
+ */
+#define AHRS_KP 1.0f  /* 1/s */
+#define AHRS_KI 0.1f  /* 1/s² */
+
+/* Longest step taken between gyro samples; a longer gap is taken as this. */
+#define AHRS_MAX_STEP 20000000  /* ns */
+
+typedef struct {
+  float q[4];      /* w, x, y, z: body to earth */
+  float bias[3];   /* Estimated gyro bias, radian/s */
+  float kp, ki;
+  int64_t time;    /* CLOCK_MONOTONIC ns of the last gyro sample, or 0 */
+  bool aligned;    /* q has been set from the accelerometer and magnetometer */
+  bool have_acc, have_mag;
+  float acc[3];    /* The last samples, in any unit */
+  float mag[3];
+} ahrs_t;
+
+/* No bias yet. The first step with both an accelerometer and a magnetometer
+ * sample sets the attitude from them outright, since the magnetometer alone
+ * would take most of a minute to bring the heading round.
+ */
+void
+ahrs_init (ahrs_t *const ahrs, const float kp, const float ki);
+
+/* Take note of an accelerometer or magnetometer sample for the next step. */
+void
+ahrs_acc (ahrs_t *const ahrs, const lsm303dlhc_acc_result_t *const res);
+
+void
+ahrs_mag (ahrs_t *const ahrs, const lsm303dlhc_mag_result_t *const res);
+
+/* Step to the time of res. The first sample only sets the time. */
+void
+ahrs_gyro (ahrs_t *const ahrs, const l3gd20_result_t *const res);
+
+/* One step of dt s at the rates in gyro (radian/s), with the accelerometer
+ * and magnetometer samples as they are.
+ */
+void
+ahrs_update (ahrs_t *const ahrs, const float dt, const float *const gyro);
+
+/* The attitude as angles in radians: yaw about z, then pitch about y, then
+ * roll about x. With z up, yaw turns counterclockwise from magnetic north
+ * seen from above.
+ */
+void
+ahrs_euler ( const ahrs_t *const ahrs, float *const roll, float *const pitch
+           , float *const yaw );
+
+#endif /* INCLUDE_AHRS_H */
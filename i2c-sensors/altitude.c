@@ -0,0 +1,277 @@
+/* Barometric altitude */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "altitude.h"
+
+#include "simd.h"
+
+#define SCALE ((float)ALTITUDE_SCALE)
+
+/* x^k = m^k (2^e)^k for x = m 2^e, m in [1, 2), with m^k from a polynomial
+ * in t = 2m - 3 and (2^e)^k from a table, for e from EXP_MIN to EXP_MAX.
+ */
+#define EXP_MIN (-8)
+#define EXP_MAX 7
+#define POWERS  (EXP_MAX - EXP_MIN + 1)
+
+/* k = 1/5.255. A Chebyshev fit, 3.5e-8 at most off relative */
+static const float root_poly[8] = {
+  1.080212712e+00f, 6.851966679e-02f, -9.247478098e-03f, 1.859529293e-03f,
+  -4.319470027e-04f, 1.095817643e-04f, -3.478847066e-05f, 9.695600966e-06f
+};
+
+static const float root_powers[POWERS] = {
+  3.481160700e-01f, 3.971993923e-01f, 4.532032907e-01f, 5.171036124e-01f,
+  5.900136232e-01f, 6.732037663e-01f, 7.681234479e-01f, 8.764265180e-01f,
+  1.000000000e+00f, 1.140996933e+00f, 1.301874042e+00f, 1.485434413e+00f,
+  1.694876075e+00f, 1.933848500e+00f, 2.206515312e+00f, 2.517627239e+00f
+};
+
+/* k = 0.255, what 5.255 leaves after the whole power. 5.9e-8 at most off */
+#define FRACTION ((float)(ALTITUDE_EXPONENT - 5))
+
+static const float fraction_poly[8] = {
+  1.108927846e+00f, 9.425885230e-02f, -1.170458831e-02f, 2.269463148e-03f,
+  -5.152471131e-04f, 1.284920727e-04f, -4.009099212e-05f, 1.105260253e-05f
+};
+
+static const float fraction_powers[POWERS] = {
+  2.431637347e-01f, 2.901759744e-01f, 3.462773561e-01f, 4.132251740e-01f,
+  4.931163490e-01f, 5.884533525e-01f, 7.022224665e-01f, 8.379871249e-01f,
+  1.000000000e+00f, 1.193335772e+00f, 1.424050212e+00f, 1.699370027e+00f,
+  2.027919054e+00f, 2.419988155e+00f, 2.887858391e+00f, 3.446184635e+00f
+};
+
+static inline float power ( const float x, const float k
+                          , const float *const poly
+                          , const float *const powers );
+
+#ifdef SIMD_NEON
+static size_t altitude_neon ( const float *const p, const size_t n
+                            , const float p0, float *const h );
+#endif
+
+#ifdef SIMD_SSE2
+static size_t altitude_sse2 ( const float *const p, const size_t n
+                            , const float p0, float *const h );
+static size_t altitude_avx2 ( const float *const p, const size_t n
+                            , const float p0, float *const h );
+#endif
+
+float
+altitude_from_pressure (const float p, const float p0)
+{
+  const float x = p * (1.0f / p0);
+  return SCALE * (1.0f - power ( x, (float)(1.0 / ALTITUDE_EXPONENT)
+                               , root_poly, root_powers ));
+}
+
+float
+pressure_from_altitude (const float h, const float p0)
+{
+  const float u = 1.0f - h * (1.0f / SCALE), u2 = u * u;
+  return p0 * (u2 * u2 * u) * power ( u, FRACTION
+                                    , fraction_poly, fraction_powers );
+}
+
+void
+altitude_from_pressure_batch ( const float *const p, const size_t n
+                             , const float p0, float *const h )
+{
+  size_t done = 0;
+
+#if defined SIMD_NEON
+  done = altitude_neon (p, n, p0, h);
+#elif defined SIMD_SSE2
+  done = simd_have_avx2 () ? altitude_avx2 (p, n, p0, h)
+                           : altitude_sse2 (p, n, p0, h);
+#endif
+
+  /* What did not fill a whole vector */
+  for (size_t i = done; i < n; ++i)
+    h[i] = altitude_from_pressure (p[i], p0);
+}
+
+const char *
+altitude_impl (void)
+{
+  return simd_impl ();
+}
+
+/* x^k, or powf for an x out of the table (which takes in zero, negative
+ * and NaN). The vector paths below take the same steps, in the same order.
+ */
+static inline float
+power ( const float x, const float k, const float *const poly
+      , const float *const powers )
+{
+  uint32_t bits;
+  memcpy (&bits, &x, sizeof bits);
+
+  /* Without the sign, so that negative x is out of range */
+  int e = (int)(bits >> 23) - 127;
+  if (e < EXP_MIN || e > EXP_MAX)
+    return powf (x, k);
+
+  bits = (bits & 0x7fffff) | 0x3f800000;
+  float m;
+  memcpy (&m, &bits, sizeof m);
+
+  float t = 2.0f * m - 3.0f, y = poly[7];
+  for (int i = 6; i >= 0; --i)
+    y = y * t + poly[i];
+
+  return y * powers[e - EXP_MIN];
+}
+
+#ifdef SIMD_NEON
+/* Four at a time, the table read a lane at a time */
+static size_t
+altitude_neon ( const float *const p, const size_t n
+              , const float p0, float *const h )
+{
+  const float32x4_t r = vdupq_n_f32 (1.0f / p0), scale = vdupq_n_f32 (SCALE)
+                  , one = vdupq_n_f32 (1.0f), two = vdupq_n_f32 (2.0f)
+                  , three = vdupq_n_f32 (3.0f);
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    uint32x4_t bits = vreinterpretq_u32_f32 (vmulq_f32 (vld1q_f32 (&p[i])
+                                                       , r));
+    int32x4_t index = vsubq_s32 ( vreinterpretq_s32_u32
+                                    (vshrq_n_u32 (bits, 23))
+                                , vdupq_n_s32 (127 + EXP_MIN) );
+
+    /* Any x out of the table: the lot as single calls */
+    uint32x4_t out = vtstq_s32 (index, vdupq_n_s32 (~(POWERS - 1)));
+    uint32x2_t any = vorr_u32 (vget_low_u32 (out), vget_high_u32 (out));
+    if (vget_lane_u32 (any, 0) | vget_lane_u32 (any, 1)) {
+      for (size_t j = i; j < i + 4; ++j)
+        h[j] = altitude_from_pressure (p[j], p0);
+      continue;
+    }
+
+    float32x4_t m = vreinterpretq_f32_u32
+                      (vorrq_u32 (vandq_u32 (bits, vdupq_n_u32 (0x7fffff))
+                                 , vdupq_n_u32 (0x3f800000)));
+    float32x4_t t = vsubq_f32 (vmulq_f32 (two, m), three)
+              , y = vdupq_n_f32 (root_poly[7]);
+    for (int j = 6; j >= 0; --j)
+      y = vaddq_f32 (vmulq_f32 (y, t), vdupq_n_f32 (root_poly[j]));
+
+    float32x4_t powers = vdupq_n_f32 (0);
+    powers = vld1q_lane_f32 (&root_powers[vgetq_lane_s32 (index, 0)]
+                            , powers, 0);
+    powers = vld1q_lane_f32 (&root_powers[vgetq_lane_s32 (index, 1)]
+                            , powers, 1);
+    powers = vld1q_lane_f32 (&root_powers[vgetq_lane_s32 (index, 2)]
+                            , powers, 2);
+    powers = vld1q_lane_f32 (&root_powers[vgetq_lane_s32 (index, 3)]
+                            , powers, 3);
+
+    vst1q_f32 (&h[i], vmulq_f32 (scale, vsubq_f32 ( one
+                                                 , vmulq_f32 (y, powers) )));
+  }
+
+  return i;
+}
+#endif /* SIMD_NEON */
+
+#ifdef SIMD_SSE2
+/* Four at a time, the table read a lane at a time */
+static size_t
+altitude_sse2 ( const float *const p, const size_t n
+              , const float p0, float *const h )
+{
+  const __m128 r = _mm_set1_ps (1.0f / p0), scale = _mm_set1_ps (SCALE)
+             , one = _mm_set1_ps (1.0f), two = _mm_set1_ps (2.0f)
+             , three = _mm_set1_ps (3.0f);
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128i bits = _mm_castps_si128 (_mm_mul_ps (_mm_loadu_ps (&p[i]), r))
+          , index = _mm_sub_epi32 (_mm_srli_epi32 (bits, 23)
+                                  , _mm_set1_epi32 (127 + EXP_MIN));
+
+    /* Any x out of the table: the lot as single calls */
+    __m128i in = _mm_cmpeq_epi32 (_mm_and_si128 ( index
+                                                , _mm_set1_epi32
+                                                    (~(POWERS - 1)) )
+                                 , _mm_setzero_si128 ());
+    if (_mm_movemask_epi8 (in) != 0xffff) {
+      for (size_t j = i; j < i + 4; ++j)
+        h[j] = altitude_from_pressure (p[j], p0);
+      continue;
+    }
+
+    __m128 m = _mm_castsi128_ps
+                 (_mm_or_si128 (_mm_and_si128 (bits, _mm_set1_epi32 (0x7fffff))
+                               , _mm_set1_epi32 (0x3f800000)));
+    __m128 t = _mm_sub_ps (_mm_mul_ps (two, m), three)
+         , y = _mm_set1_ps (root_poly[7]);
+    for (int j = 6; j >= 0; --j)
+      y = _mm_add_ps (_mm_mul_ps (y, t), _mm_set1_ps (root_poly[j]));
+
+    int32_t lanes[4];
+    _mm_storeu_si128 ((__m128i *)lanes, index);
+    __m128 powers = _mm_setr_ps ( root_powers[lanes[0]]
+                                , root_powers[lanes[1]]
+                                , root_powers[lanes[2]]
+                                , root_powers[lanes[3]] );
+
+    _mm_storeu_ps (&h[i], _mm_mul_ps (scale, _mm_sub_ps (one, _mm_mul_ps
+                                                              (y, powers))));
+  }
+
+  return i;
+}
+
+/* Eight at a time, the table gathered */
+__attribute__ ((target ("avx2")))
+static size_t
+altitude_avx2 ( const float *const p, const size_t n
+              , const float p0, float *const h )
+{
+  const __m256 r = _mm256_set1_ps (1.0f / p0), scale = _mm256_set1_ps (SCALE)
+             , one = _mm256_set1_ps (1.0f), two = _mm256_set1_ps (2.0f)
+             , three = _mm256_set1_ps (3.0f);
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256i bits = _mm256_castps_si256 (_mm256_mul_ps (_mm256_loadu_ps (&p[i])
+                                                      , r))
+          , index = _mm256_sub_epi32 (_mm256_srli_epi32 (bits, 23)
+                                     , _mm256_set1_epi32 (127 + EXP_MIN));
+
+    /* Any x out of the table: the lot as single calls */
+    if (! _mm256_testz_si256 (index, _mm256_set1_epi32 (~(POWERS - 1)))) {
+      for (size_t j = i; j < i + 8; ++j)
+        h[j] = altitude_from_pressure (p[j], p0);
+      continue;
+    }
+
+    __m256 m = _mm256_castsi256_ps
+                 (_mm256_or_si256 (_mm256_and_si256
+                                     (bits, _mm256_set1_epi32 (0x7fffff))
+                                  , _mm256_set1_epi32 (0x3f800000)));
+    __m256 t = _mm256_sub_ps (_mm256_mul_ps (two, m), three)
+         , y = _mm256_set1_ps (root_poly[7]);
+    for (int j = 6; j >= 0; --j)
+      y = _mm256_add_ps (_mm256_mul_ps (y, t), _mm256_set1_ps (root_poly[j]));
+
+    __m256 powers = _mm256_i32gather_ps (root_powers, index, 4);
+
+    _mm256_storeu_ps (&h[i], _mm256_mul_ps (scale, _mm256_sub_ps
+                                                     (one, _mm256_mul_ps
+                                                             (y, powers))));
+  }
+
+  simd_avx2_leave ();
+  return i;
+}
+#endif /* SIMD_SSE2 */
@@ -0,0 +1,46 @@
+/* Barometric altitude
+ *
+ * The standard atmosphere below 11 km, as the BMP085 datasheet has it:
+ * h = 44330 m * (1 - (p/p0)^(1/5.255)) and its inverse
+ * p = p0 * (1 - h/44330 m)^5.255, without the pow.
+ *
+ * The power comes from a polynomial on the mantissa and a table for the
+ * exponent, or from powf when the ratio is beyond 2^-8 to 2^8 (or not
+ * positive). The batch uses NEON on ARM, AVX2 (when the CPU has it) or SSE2
+ * on x86 and plain C elsewhere, and gives exactly what the single calls do.
+ */
+
+#ifndef INCLUDE_ALTITUDE_H
+#define INCLUDE_ALTITUDE_H
+
+#include <stddef.h>
+
+#define ALTITUDE_SCALE    44330.0  /* m */
+#define ALTITUDE_EXPONENT 5.255
+
+/* Metres above where the pressure is p0, from the pressure p (in the same
+ * unit). Within 1 cm of the formula in double from 30 to 110 kPa with p0
+ * from 90 to 110 kPa.
+ */
+float
+altitude_from_pressure (const float p, const float p0);
+
+/* The pressure at h m above where it is p0, in the unit of p0. With p0
+ * from 90 to 110 kPa, within 0.1 Pa of the formula in double for the
+ * altitudes of 30 to 110 kPa. Above 44330 m, as by the formula, it is NaN.
+ */
+float
+pressure_from_altitude (const float h, const float p0);
+
+/* altitude_from_pressure for n pressures at once */
+void
+altitude_from_pressure_batch ( const float *const p, const size_t n
+                             , const float p0, float *const h );
+
+/* Which implementation altitude_from_pressure_batch uses: "neon", "avx2",
+ * "sse2" or "scalar".
+ */
+const char *
+altitude_impl (void);
+
+#endif /* INCLUDE_ALTITUDE_H */
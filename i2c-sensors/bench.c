@@ -0,0 +1,823 @@
+/* Benchmark the driver hot paths against the simulated bus
+ *
+ * Every driver entry point is called for a while at the interval it would be
+ * polled at, and the bus counters say what it cost in transactions: ioctls
+ * (system calls on the Linux transport) and bytes per sample, and the wire
+ * time they would take. The simulated transfers take no time, so ns per call
+ * is the CPU time of the driver and the simulation. Then the pure
+ * computations are timed on their own, on the inputs check holds them to
+ * the truth with. Writes one JSON object to stdout.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ahrs.h"
+#include "altitude.h"
+#include "bmp085.h"
+#include "convert.h"
+#include "decimate.h"
+#include "error-utilities.h"
+#include "gyro-bias.h"
+#include "i2c-bus.h"
+#include "i2c-sensors.h"
+#include "i2c-sim.h"
+#include "l3gd20.h"
+#include "lsm303dlhc-acc.h"
+#include "lsm303dlhc-mag.h"
+#include "mag-calibration.h"
+#include "scenario.h"
+#include "time-utilities.h"
+#include "vertical.h"
+
+#define BUS_HZ 400000
+
+#define DEFAULT_DURATION   1.0      /* s per driver benchmark */
+#define DEFAULT_ITERATIONS 1000000  /* per microbenchmark */
+
+/* The BMP085 has no output data rate; look for the end of a conversion this
+ * often.
+ */
+#define BMP085_INTERVAL 1000000  /* ns */
+
+#define FIFO_WATERMARK 16
+
+/* A temperature every this many pressures, and at least once a second */
+#define BMP085_TEMP_EVERY 8
+
+/* Keep the compiler from optimizing the measured work away. */
+#define USE(x) __asm__ volatile ("" : : "g" (x) : "memory")
+
+typedef struct {
+  bmp085_t *bmp085;
+  l3gd20_t *l3gd20;
+  lsm303dlhc_acc_t *acc;
+  lsm303dlhc_mag_t *mag;
+  i2c_sensors_t *sensors;
+} drivers_t;
+
+/* One call of the benchmarked function; adds the samples it produced. */
+typedef bool (*step_t) ( drivers_t *const drivers, unsigned long *const samples
+                       , error_t *const err );
+
+static bool bench_driver ( const char *const name, step_t step
+                         , const int64_t interval, drivers_t *const drivers
+                         , i2c_bus_t *const bus, const double duration
+                         , const bool last, error_t *const err );
+static void bench_micro ( const char *const name, const double ns
+                        , const unsigned long iterations, const bool last );
+
+static bool step_bmp085 ( drivers_t *const drivers
+                        , unsigned long *const samples, error_t *const err );
+static bool step_l3gd20 ( drivers_t *const drivers
+                        , unsigned long *const samples, error_t *const err );
+static bool step_l3gd20_fifo ( drivers_t *const drivers
+                             , unsigned long *const samples
+                             , error_t *const err );
+static bool step_l3gd20_block ( drivers_t *const drivers
+                              , unsigned long *const samples
+                              , error_t *const err );
+static bool step_acc ( drivers_t *const drivers, unsigned long *const samples
+                     , error_t *const err );
+static bool step_acc_fifo ( drivers_t *const drivers
+                          , unsigned long *const samples, error_t *const err );
+static bool step_acc_block ( drivers_t *const drivers
+                           , unsigned long *const samples
+                           , error_t *const err );
+static bool step_mag ( drivers_t *const drivers, unsigned long *const samples
+                     , error_t *const err );
+static bool step_sensors ( drivers_t *const drivers
+                         , unsigned long *const samples, error_t *const err );
+static bool step_sensors_raw ( drivers_t *const drivers
+                             , unsigned long *const samples
+                             , error_t *const err );
+static bool step_sensors_batch ( drivers_t *const drivers
+                               , unsigned long *const samples
+                               , error_t *const err );
+
+static double time_calculate (const unsigned long iterations);
+static double time_scale (const unsigned long iterations);
+static double time_ahrs (const unsigned long iterations);
+static double time_vertical (const unsigned long iterations);
+static double time_altitude (const unsigned long iterations);
+static double time_altitude_batch (const unsigned long iterations);
+static double time_altitude_pow (const unsigned long iterations);
+static double time_mag_calibration (const unsigned long iterations);
+static double time_gyro_bias (const unsigned long iterations);
+static double time_decimate ( void (*decimate) ( decimate_t *const
+                                               , const sample_block_t *const
+                                               , sample_block_t *const )
+                            , const unsigned long iterations );
+static double time_error_path (const unsigned long iterations);
+static double time_error_path_compact (const unsigned long iterations);
+static double time_convert ( void (*convert) ( const uint8_t *const
+                                             , const size_t
+                                             , const sample_scale_t *const
+                                             , float *const, float *const
+                                             , float *const )
+                           , const unsigned long iterations );
+static double time_compensate (const unsigned long iterations);
+static double time_compensate_batch (const unsigned long iterations);
+
+int
+main (int argc, char **argv)
+{
+  ERROR_DECLARE (err);
+
+  double duration = DEFAULT_DURATION;
+  unsigned long iterations = DEFAULT_ITERATIONS;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "t:n:")) != -1) {
+    switch (opt) {
+    case 't':
+      duration = atof (optarg);
+      break;
+    case 'n':
+      iterations = strtoul (optarg, NULL, 10);
+      break;
+    default:
+      fprintf (stderr, "Usage: %s [-t SECONDS] [-n ITERATIONS]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (duration <= 0.0 || iterations == 0) {
+    fprintf (stderr, "%s: -t and -n must be positive\n", argv[0]);
+    return 2;
+  }
+
+  const i2c_sim_config_t config = { .hz = BUS_HZ, .overhead = 0
+                                  , .delay = false };
+  i2c_sim_t *sim = i2c_sim_new (&config, &err);
+  if (! sim)
+    goto error;
+
+  /* The drivers one by one first, then i2c_sensors once they are gone, so
+   * that they do not reconfigure the chips under each other.
+   */
+  drivers_t drivers;
+  i2c_bus_t *bus = i2c_sim_bus_new (sim, &err);
+  if (! bus)
+    goto error;
+
+  if (! ((drivers.bmp085 = bmp085_new (bus, -1, 3, &err)) &&
+         (drivers.l3gd20 = l3gd20_new (bus, &err)) &&
+         (drivers.acc = lsm303dlhc_acc_new (bus, &err)) &&
+         (drivers.mag = lsm303dlhc_mag_new (bus, &err))))
+    goto error;
+
+  printf ( "{\n  \"bus_hz\": %d,\n  \"duration\": %g,\n"
+           "  \"iterations\": %lu,\n  \"convert_xyz\": \"%s\",\n"
+           "  \"altitude\": \"%s\",\n  \"decimate\": \"%s\",\n"
+           "  \"drivers\": [\n"
+         , BUS_HZ, duration, iterations, convert_xyz_impl ()
+         , altitude_impl (), decimate_impl () );
+
+  if (! (bench_driver ( "bmp085_run", step_bmp085, BMP085_INTERVAL, &drivers
+                      , bus, duration, false, &err ) &&
+         bmp085_temp_cadence ( drivers.bmp085, BMP085_TEMP_EVERY, NS_PER_S
+                             , &err ) &&
+         bench_driver ( "bmp085_run_temp_every_8", step_bmp085
+                      , BMP085_INTERVAL, &drivers, bus, duration, false
+                      , &err ) &&
+         bench_driver ( "l3gd20_run", step_l3gd20, NS_PER_S / L3GD20_RATE
+                      , &drivers, bus, duration, false, &err ) &&
+         bench_driver ( "lsm303dlhc_acc_run", step_acc
+                      , NS_PER_S / LSM303DLHC_ACC_RATE, &drivers, bus
+                      , duration, false, &err ) &&
+         bench_driver ( "lsm303dlhc_mag_run", step_mag
+                      , NS_PER_S / LSM303DLHC_MAG_RATE, &drivers, bus
+                      , duration, false, &err ) &&
+         l3gd20_fifo_start (drivers.l3gd20, FIFO_WATERMARK, &err) &&
+         bench_driver ( "l3gd20_fifo_drain", step_l3gd20_fifo
+                      , FIFO_WATERMARK * (int64_t)NS_PER_S / L3GD20_RATE
+                      , &drivers, bus, duration, false, &err ) &&
+         bench_driver ( "l3gd20_fifo_drain_block", step_l3gd20_block
+                      , FIFO_WATERMARK * (int64_t)NS_PER_S / L3GD20_RATE
+                      , &drivers, bus, duration, false, &err ) &&
+         l3gd20_fifo_stop (drivers.l3gd20, &err) &&
+         lsm303dlhc_acc_fifo_start (drivers.acc, FIFO_WATERMARK, &err) &&
+         bench_driver ( "lsm303dlhc_acc_fifo_drain", step_acc_fifo
+                      , FIFO_WATERMARK * (int64_t)NS_PER_S / LSM303DLHC_ACC_RATE
+                      , &drivers, bus, duration, false, &err ) &&
+         bench_driver ( "lsm303dlhc_acc_fifo_drain_block", step_acc_block
+                      , FIFO_WATERMARK * (int64_t)NS_PER_S / LSM303DLHC_ACC_RATE
+                      , &drivers, bus, duration, false, &err ) &&
+         lsm303dlhc_acc_fifo_stop (drivers.acc, &err)))
+    goto error;
+
+  lsm303dlhc_mag_free (drivers.mag);
+  lsm303dlhc_acc_free (drivers.acc);
+  l3gd20_free (drivers.l3gd20);
+  bmp085_free (drivers.bmp085);
+
+  /* All four through i2c_sensors, which takes over the bus; its counters
+   * stay ours to read.
+   */
+  if (! (drivers.sensors = i2c_sensors_new_bus (bus, -1, &err)))
+    goto error;
+
+  if (! (bench_driver ( "i2c_sensors_run", step_sensors
+                      , NS_PER_S / LSM303DLHC_ACC_RATE, &drivers, bus
+                      , duration, false, &err ) &&
+         bench_driver ( "i2c_sensors_run_raw", step_sensors_raw
+                      , NS_PER_S / LSM303DLHC_ACC_RATE, &drivers, bus
+                      , duration, false, &err ) &&
+         bench_driver ( "i2c_sensors_run_batch", step_sensors_batch
+                      , NS_PER_S / LSM303DLHC_ACC_RATE, &drivers, bus
+                      , duration, true, &err )))
+    goto error;
+
+  i2c_sensors_free (drivers.sensors);
+  i2c_sim_free (sim);
+
+  printf ("  ],\n  \"micro\": [\n");
+  bench_micro ( "bmp085_calculate", time_calculate (iterations), iterations
+              , false );
+  bench_micro ( "bmp085_compensate", time_compensate (iterations)
+              , iterations, false );
+  bench_micro ( "bmp085_compensate_batch", time_compensate_batch (iterations)
+              , iterations, false );
+  bench_micro ("scale_xyz", time_scale (iterations), iterations, false);
+  bench_micro ("ahrs_update", time_ahrs (iterations), iterations, false);
+  bench_micro ( "vertical_step", time_vertical (iterations), iterations
+              , false );
+  bench_micro ( "altitude_from_pressure", time_altitude (iterations)
+              , iterations, false );
+  bench_micro ( "altitude_from_pressure_batch"
+              , time_altitude_batch (iterations), iterations, false );
+  bench_micro ( "altitude_pow", time_altitude_pow (iterations), iterations
+              , false );
+  bench_micro ( "mag_calibration_update", time_mag_calibration (iterations)
+              , iterations, false );
+  bench_micro ( "gyro_bias_gyro", time_gyro_bias (iterations), iterations
+              , false );
+  bench_micro ( "decimate_block", time_decimate (decimate_block, iterations)
+              , iterations, false );
+  bench_micro ( "decimate_block_scalar"
+              , time_decimate (decimate_block_scalar, iterations), iterations
+              , false );
+  bench_micro ( "convert_xyz", time_convert (convert_xyz, iterations)
+              , iterations, false );
+  bench_micro ( "convert_xyz_scalar"
+              , time_convert (convert_xyz_scalar, iterations), iterations
+              , false );
+  bench_micro ("error_path", time_error_path (iterations), iterations, false);
+  bench_micro ( "error_path_compact", time_error_path_compact (iterations)
+              , iterations, true );
+  printf ("  ]\n}\n");
+
+  return 0;
+
+error:
+  fflush (stdout);
+  fprintf (stderr, "%s: %s\n", argv[0], error_message (&err));
+  return 1;
+}
+
+static bool
+bench_driver ( const char *const name, step_t step, const int64_t interval
+             , drivers_t *const drivers, i2c_bus_t *const bus
+             , const double duration, const bool last, error_t *const err )
+{
+  unsigned long calls = 0, samples = 0;
+  int64_t busy = 0;
+
+  i2c_bus_stats_reset (bus);
+
+  int64_t start = time_monotonic ()
+        , end = start + (int64_t)(duration * NS_PER_S)
+        , next = start;
+  while (next < end) {
+    int64_t before = time_monotonic ();
+    if (! step (drivers, &samples, err)) {
+      error_prefix (err, name);
+      return false;
+    }
+    busy += time_monotonic () - before;
+    ++calls;
+
+    next += interval;
+    time_sleep_until (next);
+  }
+
+  unsigned long transactions = 0, bytes = 0, selects = 0;
+  for (uint16_t addr = 0; addr < 128; ++addr) {
+    const i2c_bus_stats_t *stats = i2c_bus_stats (bus, addr);
+    transactions += stats->transactions;
+    bytes += stats->bytes;
+    selects += stats->selects;
+  }
+
+  double per_sample = samples ? 1.0 / samples : 0.0;
+  printf ( "    { \"name\": \"%s\", \"interval_ns\": %lld"
+           ", \"calls\": %lu, \"samples\": %lu"
+           ", \"ns_per_call\": %.1f, \"ns_per_sample\": %.1f"
+           ", \"syscalls_per_sample\": %.3f"
+           ", \"transactions_per_sample\": %.3f"
+           ", \"selects_per_sample\": %.3f"
+           ", \"bytes_per_sample\": %.2f"
+           ", \"wire_ns_per_sample\": %.0f }%s\n"
+         , name, (long long)interval, calls, samples, (double)busy / calls
+         , busy * per_sample, i2c_bus_ioctls (bus) * per_sample
+         , transactions * per_sample, selects * per_sample
+         , bytes * per_sample, i2c_bus_wire_time (bus, BUS_HZ) * per_sample
+         , last ? "" : "," );
+  return true;
+}
+
+static void
+bench_micro ( const char *const name, const double ns
+            , const unsigned long iterations, const bool last )
+{
+  printf ( "    { \"name\": \"%s\", \"iterations\": %lu"
+           ", \"ns_per_op\": %.2f }%s\n"
+         , name, iterations, ns, last ? "" : "," );
+}
+
+static bool
+step_bmp085 ( drivers_t *const drivers, unsigned long *const samples
+            , error_t *const err )
+{
+  bmp085_result_t res;
+  if (! bmp085_run (drivers->bmp085, &res, err))
+    return false;
+
+  *samples += res.have_result;
+  return true;
+}
+
+static bool
+step_l3gd20 ( drivers_t *const drivers, unsigned long *const samples
+            , error_t *const err )
+{
+  l3gd20_result_t res;
+  if (! l3gd20_run (drivers->l3gd20, &res, err))
+    return false;
+
+  *samples += res.have_result;
+  return true;
+}
+
+static bool
+step_l3gd20_fifo ( drivers_t *const drivers, unsigned long *const samples
+                 , error_t *const err )
+{
+  l3gd20_result_t res[L3GD20_FIFO_SIZE];
+  size_t count;
+  bool overrun;
+  if (! l3gd20_fifo_drain ( drivers->l3gd20, res, L3GD20_FIFO_SIZE, &count
+                          , &overrun, err ))
+    return false;
+
+  *samples += count;
+  return true;
+}
+
+static bool
+step_l3gd20_block ( drivers_t *const drivers, unsigned long *const samples
+                  , error_t *const err )
+{
+  sample_block_t block;
+  if (! l3gd20_fifo_drain_block (drivers->l3gd20, &block, err))
+    return false;
+
+  *samples += block.count;
+  return true;
+}
+
+static bool
+step_acc ( drivers_t *const drivers, unsigned long *const samples
+         , error_t *const err )
+{
+  lsm303dlhc_acc_result_t res;
+  if (! lsm303dlhc_acc_run (drivers->acc, &res, err))
+    return false;
+
+  *samples += res.have_result;
+  return true;
+}
+
+static bool
+step_acc_fifo ( drivers_t *const drivers, unsigned long *const samples
+              , error_t *const err )
+{
+  lsm303dlhc_acc_batch_t batch;
+  if (! lsm303dlhc_acc_fifo_drain (drivers->acc, &batch, err))
+    return false;
+
+  *samples += batch.count;
+  return true;
+}
+
+static bool
+step_acc_block ( drivers_t *const drivers, unsigned long *const samples
+               , error_t *const err )
+{
+  sample_block_t block;
+  if (! lsm303dlhc_acc_fifo_drain_block (drivers->acc, &block, err))
+    return false;
+
+  *samples += block.count;
+  return true;
+}
+
+static bool
+step_mag ( drivers_t *const drivers, unsigned long *const samples
+         , error_t *const err )
+{
+  lsm303dlhc_mag_result_t res;
+  if (! lsm303dlhc_mag_run (drivers->mag, &res, err))
+    return false;
+
+  *samples += res.have_result;
+  return true;
+}
+
+static bool
+step_sensors ( drivers_t *const drivers, unsigned long *const samples
+             , error_t *const err )
+{
+  i2c_sensors_result_t res;
+  if (! i2c_sensors_run (drivers->sensors, &res, err))
+    return false;
+
+  *samples += res.baro.have_result + res.gyro.have_result +
+              res.acc.have_result + res.mag.have_result;
+  return true;
+}
+
+static bool
+step_sensors_raw ( drivers_t *const drivers, unsigned long *const samples
+                 , error_t *const err )
+{
+  i2c_sensors_raw_t raw;
+  if (! i2c_sensors_run_raw (drivers->sensors, &raw, err))
+    return false;
+
+  *samples += __builtin_popcount (raw.fresh);
+  return true;
+}
+
+static bool
+step_sensors_batch ( drivers_t *const drivers, unsigned long *const samples
+                   , error_t *const err )
+{
+  i2c_sensors_result_t res;
+  if (! i2c_sensors_run_batch (drivers->sensors, &res, err))
+    return false;
+
+  *samples += res.baro.have_result + res.gyro.have_result +
+              res.acc.have_result + res.mag.have_result;
+  return true;
+}
+
+/* ns per bmp085_calculate, over a spread of readings. */
+static double
+time_calculate (const unsigned long iterations)
+{
+  const bmp085_calib_t calib = BMP085_CALIB_EXAMPLE;
+  bmp085_result_t res;
+
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    int32_t ut = BMP085_UT_EXAMPLE + (i & 0xff)
+          , up = BMP085_UP_EXAMPLE + (i & 0x3ff);
+    bmp085_calculate (&calib, 0, ut, up, &res);
+    USE (res.pressure);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per bmp085_compensate, over the readings time_calculate uses: every
+ * one has a new UT.
+ */
+static double
+time_compensate (const unsigned long iterations)
+{
+  const bmp085_calib_t calib = BMP085_CALIB_EXAMPLE;
+  bmp085_comp_t comp;
+  bmp085_result_t res;
+
+  bmp085_comp_init (&comp, &calib, 0);
+
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    int32_t ut = BMP085_UT_EXAMPLE + (i & 0xff)
+          , up = BMP085_UP_EXAMPLE + (i & 0x3ff);
+    bmp085_compensate (&comp, ut, up, &res);
+    USE (res.pressure);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per reading of bmp085_compensate_batch over a replayed log's worth,
+ * where UT changes every 8 readings.
+ */
+static double
+time_compensate_batch (const unsigned long iterations)
+{
+  enum { N = 256 };
+  const bmp085_calib_t calib = BMP085_CALIB_EXAMPLE;
+  bmp085_comp_t comp;
+  bmp085_raw_t raw[N];
+  bmp085_result_t res[N];
+
+  bmp085_comp_init (&comp, &calib, 0);
+  for (int i = 0; i < N; ++i)
+    raw[i] = (bmp085_raw_t){ .ut = BMP085_UT_EXAMPLE + i / 8
+                           , .up = BMP085_UP_EXAMPLE + i };
+
+  unsigned long batches = (iterations + N - 1) / N;
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < batches; ++i) {
+    bmp085_compensate_batch (&comp, raw, N, res);
+    USE (res);
+  }
+
+  return (double)(time_monotonic () - start) / (batches * N);
+}
+
+/* ns per raw x, y, z sample turned into units, as the drivers do it. */
+static double
+time_scale (const unsigned long iterations)
+{
+  enum { N = 256 };
+  int16_t raw[N][3];
+  double out[3];
+
+  for (int i = 0; i < N; ++i)
+    for (int axis = 0; axis < 3; ++axis)
+      raw[i][axis] = (i * 37 + axis * 1001) & 0xfff;
+
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    const int16_t *r = raw[i % N];
+    out[0] = r[0] * LSM303DLHC_MAG_SCALE_XY;
+    out[1] = r[1] * LSM303DLHC_MAG_SCALE_XY;
+    out[2] = r[2] * LSM303DLHC_MAG_SCALE_Z;
+    USE (out);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per AHRS step with both the accelerometer and the magnetometer */
+static double
+time_ahrs (const unsigned long iterations)
+{
+  enum { N = 256 };
+  float gyro[N][3];
+  ahrs_t ahrs;
+
+  ahrs_init (&ahrs, AHRS_KP, AHRS_KI);
+  ahrs.acc[0] = 0.3f;
+  ahrs.acc[1] = -0.2f;
+  ahrs.acc[2] = 9.8f;
+  ahrs.mag[0] = 20e-6f;
+  ahrs.mag[1] = 1e-6f;
+  ahrs.mag[2] = -45e-6f;
+  ahrs.have_acc = ahrs.have_mag = true;
+
+  for (int i = 0; i < N; ++i)
+    for (int axis = 0; axis < 3; ++axis)
+      gyro[i][axis] = 0.01f * ((i * 37 + axis * 11) % 64 - 32);
+
+  const float dt = 1.0f / L3GD20_RATE;
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    ahrs_update (&ahrs, dt, gyro[i % N]);
+    USE (ahrs.q);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per vertical filter step at the accelerometer rate, with a barometer
+ * correction every 27th as at 50 Hz
+ */
+static double
+time_vertical (const unsigned long iterations)
+{
+  vertical_t vertical;
+  vertical_init (&vertical, 101325.0f);
+  vertical_altitude (&vertical, 100.0f);
+
+  const float dt = 1.0f / LSM303DLHC_ACC_RATE;
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    vertical_predict (&vertical, dt, 0.01f * (int)(i % 64) - 0.32f);
+    if (i % 27 == 0)
+      vertical_altitude (&vertical, 100.0f + 0.01f * (int)(i % 50));
+    USE (vertical.h);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per pressure turned into altitude, one call each */
+static double
+time_altitude (const unsigned long iterations)
+{
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    float h = altitude_from_pressure ( 30000.0f + 78.125f * (int)(i % 1024)
+                                     , 101325.0f );
+    USE (h);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per pressure, ALTITUDE_BATCH at a time as from a log */
+#define ALTITUDE_BATCH 1024
+
+static double
+time_altitude_batch (const unsigned long iterations)
+{
+  float p[ALTITUDE_BATCH], h[ALTITUDE_BATCH];
+  for (int i = 0; i < ALTITUDE_BATCH; ++i)
+    p[i] = 30000.0f + 78.125f * i;
+
+  unsigned long calls = iterations / ALTITUDE_BATCH + 1;
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < calls; ++i) {
+    altitude_from_pressure_batch (p, ALTITUDE_BATCH, 101325.0f, h);
+    USE (h);
+  }
+
+  return (double)(time_monotonic () - start) / calls / ALTITUDE_BATCH;
+}
+
+/* ns per pressure by the formula as main.c had it, with libm's pow */
+static double
+time_altitude_pow (const unsigned long iterations)
+{
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    double p = 30000.0 + 78.125 * (int)(i % 1024)
+         , h = ALTITUDE_SCALE * (1.0 - pow ( p / 101325.0
+                                           , 1.0 / ALTITUDE_EXPONENT ));
+    USE (h);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per sample taken into the fit, a solution every
+ * MAG_CALIBRATION_SOLVE_EVERY included
+ */
+static double
+time_mag_calibration (const unsigned long iterations)
+{
+  enum { N = 256 };
+  double raw[N][3];
+  mag_calibration_t cal;
+
+  /* Seconds apart, so that every sample is taken */
+  for (int i = 0; i < N; ++i) {
+    double u[3];
+    scenario_mag_tumble (3.7 * i, u);
+    scenario_mag_distort (u, raw[i]);
+  }
+  mag_calibration_init (&cal);
+
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    mag_calibration_update (&cal, raw[i % N]);
+    USE (cal.offset);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per gyro sample while the craft is still, which is when a sample costs
+ * the most
+ */
+static double
+time_gyro_bias (const unsigned long iterations)
+{
+  enum { N = 256 };
+  double w[N][3], bias[3];
+  gyro_bias_t gb;
+
+  gyro_bias_init (&gb, L3GD20_RATE, LSM303DLHC_ACC_RATE);
+  scenario_gyro_bias (20, bias);
+  for (int i = 0; i < N; ++i)
+    for (int axis = 0; axis < 3; ++axis)
+      w[i][axis] = bias[axis] + 0.002 * ((i * 37 + axis * 11) % 9 - 4);
+
+  for (int i = 0; i < 2 * L3GD20_RATE; ++i)
+    gyro_bias_gyro (&gb, 20, w[i % N]);
+
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    gyro_bias_gyro (&gb, 20, w[i % N]);
+    USE (gb.cells);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per failure as the drivers report one: strerror and three prefixes. */
+static double
+time_error_path (const unsigned long iterations)
+{
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    ERROR_DECLARE (err);
+    error_strerror (&err, EIO);
+    error_prefix_printf (&err, "i2c_bus_read_block: addr=0x%02x", 0x6b);
+    error_prefix (&err, "l3gd20_run");
+    error_prefix (&err, "i2c_sensors_run");
+    USE (err.message);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* The same failure noted in a compact error, as a loop that retries would:
+ * one error cleared for every attempt, the message never asked for.
+ */
+static double
+time_error_path_compact (const unsigned long iterations)
+{
+  ERROR_DECLARE_COMPACT (err);
+
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    error_clear (&err);
+    error_strerror (&err, EIO);
+    error_prefix_printf (&err, "i2c_bus_read_block: addr=0x%02x", 0x6b);
+    error_prefix (&err, "l3gd20_run");
+    error_prefix (&err, "i2c_sensors_run");
+    USE (err.trace_len);
+  }
+
+  return (double)(time_monotonic () - start) / iterations;
+}
+
+/* ns per accelerometer sample, FIFO_WATERMARK at a time */
+static double
+time_decimate ( void (*decimate) ( decimate_t *const
+                                 , const sample_block_t *const
+                                 , sample_block_t *const )
+              , const unsigned long iterations )
+{
+  ERROR_DECLARE (err);
+  decimate_t *dec = decimate_new (&scenario_decimate_acc, &err);
+  if (! dec)
+    return NAN;
+
+  sample_block_t in = { .count = FIFO_WATERMARK, .overrun = false, .time = 0
+                      , .period = NS_PER_S / LSM303DLHC_ACC_RATE }
+               , out;
+  for (int i = 0; i < FIFO_WATERMARK; ++i) {
+    in.x[i] = 0.01f * (i * 37 % 19);
+    in.y[i] = -0.01f * (i * 11 % 23);
+    in.z[i] = 9.81f + 0.01f * (i * 5 % 7);
+  }
+
+  unsigned long calls = iterations / FIFO_WATERMARK + 1;
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < calls; ++i) {
+    decimate (dec, &in, &out);
+    USE (out.x);
+  }
+  double ns = (double)(time_monotonic () - start) / calls / FIFO_WATERMARK;
+
+  decimate_free (dec);
+  return ns;
+}
+
+/* ns per sample of a FIFO block converted to float arrays */
+static double
+time_convert ( void (*convert) ( const uint8_t *const, const size_t
+                               , const sample_scale_t *const
+                               , float *const, float *const, float *const )
+             , const unsigned long iterations )
+{
+  const sample_scale_t scale = { { L3GD20_SCALE, L3GD20_SCALE, L3GD20_SCALE }
+                               , { 0.5f, -0.25f, 0.125f } };
+  uint8_t data[SAMPLE_BLOCK_SIZE * 6] __attribute__ ((aligned (16)));
+  sample_block_t block;
+
+  for (size_t i = 0; i < sizeof data; ++i)
+    data[i] = i * 37;
+
+  int64_t start = time_monotonic ();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    convert ( data, SAMPLE_BLOCK_SIZE, &scale
+            , block.x, block.y, block.z );
+    USE (block.x);
+  }
+
+  return (double)(time_monotonic () - start) / iterations / SAMPLE_BLOCK_SIZE;
+}
@@ -1,18 +1,17 @@
 /* BMP085 barometer */
 
-#include <fcntl.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <unistd.h>
 
 #include "bmp085.h"
 
 #include "common.h"
 #include "error-utilities.h"
+#include "gpio.h"
+#include "i2c-bus.h"
 #include "i2c-utilities.h"
+#include "time-utilities.h"
 
 #define ADDR 0x77
 
@@ -24,44 +23,46 @@
 
 #define DATA 0xf6
 
-typedef struct {
-  int16_t  ac1, ac2, ac3;
-  uint16_t ac4, ac5, ac6;
-  int16_t  b1, b2, mb, mc, md;
-} bmp085_calib_t;
-
-#define CALIB_EXAMPLE \
-  ((bmp085_calib_t){ 408, -72, -14383, 32741, 32757, 23153 \
-                   , 6190, 4, -32768, -8711, 2868 \
-                   })
-#define UT_EXAMPLE  ((int32_t)27898)
-#define OSS_EXAMPLE ((int16_t)0)
-#define UP_EXAMPLE  ((int32_t)23843)
+/* Datasheet maximum conversion times, for going without the EOC line */
+#define TEMP_TIME 4500000  /* ns */
+static const int64_t pres_times[4] =  /* ns, by oss */
+  { 4500000, 7500000, 13500000, 25500000 };
 
 typedef enum { STATE_INITIAL, STATE_TEMP_WAITING, STATE_PRES_WAITING }
   bmp085_state_t;
 
 struct bmp085 {
-  int i2c_fd;
-  int eoc_fd;
+  i2c_bus_t *bus;
+  gpio_t *eoc;            /* NULL: go by conversion_end instead */
+  bool eoc_seen;          /* bmp085_wait caught the EOC edge */
+  int64_t conversion_end; /* CLOCK_MONOTONIC ns */
   int16_t oss;
   int32_t ut, up;
   bmp085_state_t state;
   bmp085_calib_t calib;
+  bmp085_comp_t comp;
+  unsigned temp_every;         /* See bmp085_temp_cadence */
+  int64_t temp_interval;
+  unsigned pres_count;         /* Pressures read since the temperature */
+  int64_t temp_time;           /* CLOCK_MONOTONIC ns it was read at */
+  bmp085_state_t batch_state;  /* State to enter when the batch completes */
+  uint8_t *batch_data;         /* UT or UP in a pending batch, or NULL */
+  bool batch_ut;               /* batch_data is UT */
 };
 
-static bool slave (bmp085_t *const bmp085, error_t *const err);
 static bool measure_temp_start (bmp085_t *const bmp085, error_t *const err);
 static bool measure_pres_start (bmp085_t *const bmp085, error_t *const err);
 static bool measure_temp_finish (bmp085_t *const bmp085, error_t *const err);
 static bool measure_pres_finish (bmp085_t *const bmp085, error_t *const err);
 static bool ready ( bmp085_t *const bmp085, bool *const is_ready
                   , error_t *const err );
-static void calculate ( const bmp085_t *const bmp085
-                      , bmp085_result_t *const res );
+static void conversion_started (bmp085_t *const bmp085);
+static bool temp_due (const bmp085_t *const bmp085, const unsigned pres_count);
+static void compensate_ut (bmp085_comp_t *const comp, const int32_t ut);
+static uint32_t divide_b4 (bmp085_comp_t *const comp, const uint32_t n);
 
 bmp085_t *
-bmp085_new ( const int i2c_fd, const int eoc_gpio, const int16_t oss
+bmp085_new ( i2c_bus_t *const bus, const int eoc_gpio, const int16_t oss
            , error_t *const err )
 {
   if (oss < 0 || oss > 3) {
@@ -76,53 +77,48 @@ bmp085_new ( const int i2c_fd, const int eoc_gpio, const int16_t oss
     goto malloc_failed;
   }
 
-  bmp085->i2c_fd = i2c_fd;
+  bmp085->bus = bus;
   bmp085->state = STATE_INITIAL;
   bmp085->oss = oss;
   bmp085->ut = bmp085->up = 0;
-
-  char eoc_gpio_path[100];
-  if (snprintf (eoc_gpio_path, 100, GPIO_PATH, eoc_gpio) < 0) {
-    error_insert (err, "snprintf failed");
-    goto sprintf_failed;
-  }
-
-  if ((bmp085->eoc_fd = open (eoc_gpio_path, O_RDONLY)) < 0) {
-    error_errno (err);
-    error_prefix_printf (err, "open %s failed", eoc_gpio_path);
-    goto open_gpio_failed;
+  bmp085->eoc_seen = false;
+  bmp085->conversion_end = 0;
+  bmp085->temp_every = 1;
+  bmp085->temp_interval = 0;
+  bmp085->pres_count = 0;
+  bmp085->temp_time = 0;
+
+  bmp085->eoc = NULL;
+  if (eoc_gpio >= 0 &&
+      ! (bmp085->eoc = gpio_new (eoc_gpio, GPIO_EDGE_RISING, err)))
+    goto gpio_failed;
+
+  uint8_t calib_data[22];
+  if (! i2c_bus_read_block (bus, ADDR, CALIB_REG, calib_data, 22, err)) {
+    error_prefix (err, "calibration");
+    goto calib_failed;
   }
-
-  if (! slave (bmp085, err))
-    goto slave_failed;
-
-  uint16_t calib_data[11];
-  for (int i = 0; i < 11; ++i) {
-    if (! i2c_read_u16 (i2c_fd, CALIB_REG+2*i, &calib_data[i], err)) {
-      error_prefix (err, "calibration");
-      goto calib_failed;
-    }
-  }
-  bmp085->calib.ac1 = calib_data[0];
-  bmp085->calib.ac2 = calib_data[1];
-  bmp085->calib.ac3 = calib_data[2];
-  bmp085->calib.ac4 = calib_data[3];
-  bmp085->calib.ac5 = calib_data[4];
-  bmp085->calib.ac6 = calib_data[5];
-  bmp085->calib.b1  = calib_data[6];
-  bmp085->calib.b2  = calib_data[7];
-  bmp085->calib.mb  = calib_data[8];
-  bmp085->calib.mc  = calib_data[9];
-  bmp085->calib.md  = calib_data[10];
+  bmp085->calib.ac1 = i2c_be16 (&calib_data[0]);
+  bmp085->calib.ac2 = i2c_be16 (&calib_data[2]);
+  bmp085->calib.ac3 = i2c_be16 (&calib_data[4]);
+  bmp085->calib.ac4 = i2c_be16 (&calib_data[6]);
+  bmp085->calib.ac5 = i2c_be16 (&calib_data[8]);
+  bmp085->calib.ac6 = i2c_be16 (&calib_data[10]);
+  bmp085->calib.b1  = i2c_be16 (&calib_data[12]);
+  bmp085->calib.b2  = i2c_be16 (&calib_data[14]);
+  bmp085->calib.mb  = i2c_be16 (&calib_data[16]);
+  bmp085->calib.mc  = i2c_be16 (&calib_data[18]);
+  bmp085->calib.md  = i2c_be16 (&calib_data[20]);
+
+  bmp085_comp_init (&bmp085->comp, &bmp085->calib, oss);
 
   return bmp085;
 
 calib_failed:
-slave_failed:
-  close (bmp085->eoc_fd);
+  if (bmp085->eoc)
+    gpio_free (bmp085->eoc);
 
-open_gpio_failed:
-sprintf_failed:
+gpio_failed:
   free (bmp085);
 
 malloc_failed:
@@ -134,11 +130,11 @@ invalid_oss:
 void
 bmp085_free (bmp085_t *const bmp085)
 {
-  close (bmp085->i2c_fd);
-  bmp085->i2c_fd = POISON;
+  bmp085->bus = (i2c_bus_t *)POISON;
 
-  close (bmp085->eoc_fd);
-  bmp085->eoc_fd = POISON;
+  if (bmp085->eoc)
+    gpio_free (bmp085->eoc);
+  bmp085->eoc = (gpio_t *)POISON;
 
   bmp085->state = POISON;
   bmp085->calib.ac1 = bmp085->calib.ac2 = bmp085->calib.ac3 = (int16_t)POISON;
@@ -153,10 +149,10 @@ void
 bmp085_dump (const bmp085_t *const bmp085, FILE *const stream)
 {
   fprintf ( stream
-          , "bmp085: i2c_fd=%d eoc_fd=%d state=%d "
+          , "bmp085: eoc_fd=%d state=%d "
             "ac1=%d ac2=%d ac3=%d ac4=%u ac5=%u ac6=%u "
             "b1=%d b2=%d mb=%d mc=%d md=%d\n"
-          , bmp085->i2c_fd, bmp085->eoc_fd, bmp085->state
+          , bmp085_eoc_fd (bmp085), bmp085->state
           , bmp085->calib.ac1, bmp085->calib.ac2, bmp085->calib.ac3
           , bmp085->calib.ac4, bmp085->calib.ac5, bmp085->calib.ac6
           , bmp085->calib.b1,  bmp085->calib.b2
@@ -164,15 +160,63 @@ bmp085_dump (const bmp085_t *const bmp085, FILE *const stream)
           );
 }
 
+const bmp085_calib_t *
+bmp085_calib (const bmp085_t *const bmp085)
+{
+  return &bmp085->calib;
+}
+
+int16_t
+bmp085_oss (const bmp085_t *const bmp085)
+{
+  return bmp085->oss;
+}
+
+bool
+bmp085_temp_cadence ( bmp085_t *const bmp085, const unsigned temp_every
+                    , const int64_t temp_interval, error_t *const err )
+{
+  if (temp_every < 1 || temp_interval < 0) {
+    error_printf ( err, "bmp085_temp_cadence: invalid every=%u interval=%lld"
+                 , temp_every, (long long)temp_interval );
+    return false;
+  }
+
+  bmp085->temp_every = temp_every;
+  bmp085->temp_interval = temp_interval;
+  return true;
+}
+
 bool
 bmp085_run ( bmp085_t *const bmp085, bmp085_result_t *const res
            , error_t *const err )
 {
+  bmp085_raw_t raw;
+  bool fresh;
+
   res->have_result = false;
 
+  if (! bmp085_run_raw (bmp085, &raw, &fresh, err)) {
+    error_prefix (err, "bmp085_run");
+    return false;
+  }
+
+  if (fresh) {
+    bmp085_compensate (&bmp085->comp, raw.ut, raw.up, res);
+    res->time = raw.time;
+  }
+
+  return true;
+}
+
+bool
+bmp085_run_raw ( bmp085_t *const bmp085, bmp085_raw_t *const raw
+               , bool *const fresh, error_t *const err )
+{
+  *fresh = false;
+
   if (bmp085->state == STATE_INITIAL) {
-    if (! (slave (bmp085, err) &&
-           measure_temp_start (bmp085, err)))
+    if (! measure_temp_start (bmp085, err))
       goto error;
 
     bmp085->state = STATE_TEMP_WAITING;
@@ -183,8 +227,7 @@ bmp085_run ( bmp085_t *const bmp085, bmp085_result_t *const res
       goto error;
 
     if (is_ready) {
-      if (! (slave (bmp085, err) &&
-             measure_temp_finish (bmp085, err) &&
+      if (! (measure_temp_finish (bmp085, err) &&
              measure_pres_start (bmp085, err)))
         goto error;
 
@@ -197,39 +240,185 @@ bmp085_run ( bmp085_t *const bmp085, bmp085_result_t *const res
       goto error;
 
     if (is_ready) {
-      if (! (slave (bmp085, err) &&
-             measure_pres_finish (bmp085, err) &&
-             measure_temp_start (bmp085, err)))
+      if (! measure_pres_finish (bmp085, err))
+        goto error;
+
+      int64_t time = time_monotonic ();
+
+      if (temp_due (bmp085, ++bmp085->pres_count)) {
+        if (! measure_temp_start (bmp085, err))
+          goto error;
+
+        bmp085->state = STATE_TEMP_WAITING;
+      } else if (! measure_pres_start (bmp085, err)) {
+        goto error;
+      }
+
+      *raw = (bmp085_raw_t){ time, bmp085->ut, bmp085->up };
+      *fresh = true;
+    }
+  }
+
+  return true;
+
+error:
+  error_prefix (err, "bmp085_run_raw");
+  bmp085->state = STATE_INITIAL;
+  return false;
+}
+
+int
+bmp085_eoc_fd (const bmp085_t *const bmp085)
+{
+  return bmp085->eoc ? gpio_fd (bmp085->eoc) : -1;
+}
+
+bool
+bmp085_eoc_ack (bmp085_t *const bmp085, error_t *const err)
+{
+  if (! bmp085->eoc)
+    return true;
+
+  bool value;
+  if (! gpio_read (bmp085->eoc, &value, err)) {
+    error_prefix (err, "bmp085_eoc_ack");
+    return false;
+  }
+
+  bmp085->eoc_seen = value;
+  return true;
+}
+
+bool
+bmp085_wait ( bmp085_t *const bmp085, const int timeout_ms, bool *const is_ready
+            , error_t *const err )
+{
+  bool fired, value;
+
+  *is_ready = false;
+
+  if (bmp085->state == STATE_INITIAL)
+    return true;
+
+  if (! bmp085->eoc) {
+    int64_t now = time_monotonic ();
+    int64_t until = bmp085->conversion_end;
+    if (timeout_ms >= 0 && now + timeout_ms * 1000000LL < until)
+      until = now + timeout_ms * 1000000LL;
+
+    if (until > now)
+      time_sleep_until (until);
+
+    *is_ready = time_monotonic () >= bmp085->conversion_end;
+    return true;
+  }
+
+  if (! gpio_wait (bmp085->eoc, timeout_ms, &fired, &value, err)) {
+    error_prefix (err, "bmp085_wait");
+    bmp085->state = STATE_INITIAL;
+    return false;
+  }
+
+  /* The value has been read to re-arm the edge; remember it so that the
+   * next bmp085_run does not have to read it again.
+   */
+  *is_ready = bmp085->eoc_seen = fired && value;
+  return true;
+}
+
+bool
+bmp085_batch_prepare ( bmp085_t *const bmp085, i2c_batch_t *const batch
+                     , error_t *const err )
+{
+  bmp085->batch_data = NULL;
+  bmp085->batch_state = bmp085->state;
+  bmp085->batch_ut = bmp085->state == STATE_TEMP_WAITING;
+
+  if (bmp085->state == STATE_INITIAL) {
+    if (! i2c_batch_write_u8 (batch, ADDR, CTRL_REG, CTRL_TEMP, err))
+      goto error;
+
+    bmp085->batch_state = STATE_TEMP_WAITING;
+
+  } else {
+    bool is_ready;
+    if (! ready (bmp085, &is_ready, err))
+      goto error;
+
+    if (! is_ready)
+      return true;
+
+    if (bmp085->state == STATE_TEMP_WAITING) {
+      uint8_t pres = CTRL_PRES + (bmp085->oss << 6);
+      if (! (i2c_batch_read (batch, ADDR, DATA, 2, &bmp085->batch_data, err) &&
+             i2c_batch_write_u8 (batch, ADDR, CTRL_REG, pres, err)))
         goto error;
 
-      bmp085->state = STATE_TEMP_WAITING;
+      bmp085->batch_state = STATE_PRES_WAITING;
+
+    } else if (bmp085->state == STATE_PRES_WAITING) {
+      bool temp = temp_due (bmp085, bmp085->pres_count + 1);
+      uint8_t next = temp ? CTRL_TEMP : CTRL_PRES + (bmp085->oss << 6);
+      if (! (i2c_batch_read (batch, ADDR, DATA, 3, &bmp085->batch_data, err) &&
+             i2c_batch_write_u8 (batch, ADDR, CTRL_REG, next, err)))
+        goto error;
 
-      calculate (bmp085, res);
+      bmp085->batch_state = temp ? STATE_TEMP_WAITING : STATE_PRES_WAITING;
     }
   }
 
+  /* Start over unless bmp085_batch_finish gets called. */
+  bmp085->state = STATE_INITIAL;
   return true;
 
 error:
-  error_prefix (err, "bmp085_run");
+  error_prefix (err, "bmp085_batch_prepare");
   bmp085->state = STATE_INITIAL;
   return false;
 }
 
-static inline bool
-slave (bmp085_t *const bmp085, error_t *const err)
+void
+bmp085_batch_finish (bmp085_t *const bmp085, bmp085_result_t *const res)
 {
-  return i2c_slave (bmp085->i2c_fd, ADDR, err);
+  const uint8_t *data = bmp085->batch_data;
+
+  /* bmp085_batch_prepare leaves STATE_INITIAL behind when it queued a step,
+   * and every step ends by starting a conversion.
+   */
+  bool started = bmp085->state == STATE_INITIAL &&
+                 bmp085->batch_state != STATE_INITIAL;
+
+  res->have_result = false;
+  bmp085->state = bmp085->batch_state;
+
+  if (started)
+    conversion_started (bmp085);
+
+  if (! data)
+    return;
+
+  if (bmp085->batch_ut) {
+    bmp085->ut = i2c_be16 (data);
+    bmp085->pres_count = 0;
+    bmp085->temp_time = time_monotonic ();
+  } else {
+    uint32_t up = (data[0]<<16) | (data[1]<<8) | data[2];
+    bmp085->up = up >> (8 - bmp085->oss);
+    ++bmp085->pres_count;
+    bmp085_compensate (&bmp085->comp, bmp085->ut, bmp085->up, res);
+    res->time = time_monotonic ();
+  }
 }
 
 static bool
 measure_temp_start (bmp085_t *const bmp085, error_t *const err)
 {
-  if (! i2c_write_u8 (bmp085->i2c_fd, CTRL_REG, CTRL_TEMP, err)) {
+  if (! i2c_bus_write_u8 (bmp085->bus, ADDR, CTRL_REG, CTRL_TEMP, err)) {
     error_prefix (err, "measure_temp_start");
     return false;
   }
 
+  bmp085->conversion_end = time_monotonic () + TEMP_TIME;
   return true;
 }
 
@@ -237,75 +426,90 @@ static bool
 measure_pres_start (bmp085_t *const bmp085, error_t *const err)
 {
   uint8_t data = CTRL_PRES + (bmp085->oss << 6);
-  if (! i2c_write_u8 (bmp085->i2c_fd, CTRL_REG, data, err)) {
+  if (! i2c_bus_write_u8 (bmp085->bus, ADDR, CTRL_REG, data, err)) {
     error_prefix (err, "measure_pres_start");
     return false;
   }
 
+  bmp085->conversion_end = time_monotonic () + pres_times[bmp085->oss];
   return true;
 }
 
 static bool
 measure_temp_finish (bmp085_t *const bmp085, error_t *const err)
 {
-  uint16_t ut;
-  if (! i2c_read_u16 (bmp085->i2c_fd, DATA, &ut, err)) {
+  uint8_t ut[2];
+  if (! i2c_bus_read_block (bmp085->bus, ADDR, DATA, ut, 2, err)) {
     error_prefix (err, "measure_temp_finish");
     return false;
   }
 
-  bmp085->ut = ut;
+  bmp085->ut = i2c_be16 (ut);
+  bmp085->pres_count = 0;
+  bmp085->temp_time = time_monotonic ();
   return true;
 }
 
 static bool
 measure_pres_finish (bmp085_t *const bmp085, error_t *const err)
 {
-  uint32_t up;
-  if (! i2c_read_u24 (bmp085->i2c_fd, DATA, &up, err)) {
+  uint8_t up[3];
+  if (! i2c_bus_read_block (bmp085->bus, ADDR, DATA, up, 3, err)) {
     error_prefix (err, "measure_pres_finish");
     return false;
   }
 
-  bmp085->up = up >> (8 - bmp085->oss);
+  bmp085->up = ((up[0]<<16) | (up[1]<<8) | up[2]) >> (8 - bmp085->oss);
   return true;
 }
 
 static bool
 ready (bmp085_t *const bmp085, bool *const is_ready, error_t *const err)
 {
-  char buf[100];
-  ssize_t count;
+  if (bmp085->eoc_seen) {
+    bmp085->eoc_seen = false;
+    *is_ready = true;
+    return true;
+  }
 
-  if (lseek (bmp085->eoc_fd, 0, SEEK_SET) == -1) {
-    error_errno (err);
-    error_prefix (err, "seek failed");
-    goto error;
+  if (! bmp085->eoc) {
+    *is_ready = time_monotonic () >= bmp085->conversion_end;
+    return true;
   }
 
-  count = read (bmp085->eoc_fd, buf, 100);
-  if (count == -1) {
-    error_errno (err);
-    error_prefix (err, "read failed");
-    goto error;
+  if (! gpio_read (bmp085->eoc, is_ready, err)) {
+    error_prefix (err, "ready");
+    return false;
   }
 
-  *is_ready = count >= 2 && buf[0] == '1' && buf[1] == '\n';
   return true;
+}
 
-error:
-  error_prefix (err, "ready");
-  return false;
+/* The temperature is to be measured next, pres_count pressures after the
+ * last time.
+ */
+static bool
+temp_due (const bmp085_t *const bmp085, const unsigned pres_count)
+{
+  return pres_count >= bmp085->temp_every ||
+         (bmp085->temp_interval > 0 &&
+          time_monotonic () - bmp085->temp_time >= bmp085->temp_interval);
 }
 
+/* A conversion for bmp085->state has just been started. */
 static void
-calculate (const bmp085_t *const bmp085, bmp085_result_t *const res)
+conversion_started (bmp085_t *const bmp085)
 {
-  int16_t oss = bmp085->oss;
-  int32_t ut  = bmp085->ut
-        , up  = bmp085->up;
-  const bmp085_calib_t *calib = &bmp085->calib;
+  bmp085->conversion_end = time_monotonic () +
+    (bmp085->state == STATE_TEMP_WAITING ? TEMP_TIME
+                                         : pres_times[bmp085->oss]);
+}
 
+void
+bmp085_calculate ( const bmp085_calib_t *const calib, const int16_t oss
+                 , const int32_t ut, const int32_t up
+                 , bmp085_result_t *const res )
+{
   int32_t x1a = ((ut - calib->ac6) * calib->ac5) >> 15;
   int32_t x2a = (calib->mc << 11) / (x1a + calib->md);
   int32_t b5  = x1a + x2a;
@@ -330,4 +534,107 @@ calculate (const bmp085_t *const bmp085, bmp085_result_t *const res)
   res->have_result = true;
   res->temperature = t / 10.0;  /* deci°C to °C */
   res->pressure    = pb;
+  res->ut = ut;
+  res->up = up;
+}
+
+void
+bmp085_comp_init ( bmp085_comp_t *const comp
+                 , const bmp085_calib_t *const calib, const int16_t oss )
+{
+  comp->oss = oss;
+  comp->ac1_4 = calib->ac1 * 4;
+  comp->ac2 = calib->ac2;
+  comp->ac3 = calib->ac3;
+  comp->ac4 = calib->ac4;
+  comp->ac5 = calib->ac5;
+  comp->ac6 = calib->ac6;
+  comp->b1 = calib->b1;
+  comp->b2 = calib->b2;
+  comp->mc_11 = calib->mc << 11;
+  comp->md = calib->md;
+  comp->b7_factor = 50000 >> oss;
+  comp->have_ut = false;
+}
+
+void
+bmp085_compensate ( bmp085_comp_t *const comp, const int32_t ut
+                  , const int32_t up, bmp085_result_t *const res )
+{
+  if (! comp->have_ut || ut != comp->ut)
+    compensate_ut (comp, ut);
+
+  uint32_t b7 = ((uint32_t)up - (uint32_t)comp->b3) * comp->b7_factor;
+  int32_t pa  = (b7 < 0x80000000) ? divide_b4 (comp, b7 * 2)
+                                  : divide_b4 (comp, b7) * 2;
+  int32_t x1d = (pa >> 8) * (pa >> 8);
+  int32_t x1e = (x1d * 3038) >> 16;
+  int32_t x2e = (-7357 * pa) >> 16;
+  int32_t pb  = pa + ((x1e + x2e + 3791) >> 4);
+
+  res->have_result = true;
+  res->temperature = comp->t / 10.0;  /* deci°C to °C */
+  res->pressure    = pb;
+  res->ut = ut;
+  res->up = up;
+}
+
+void
+bmp085_compensate_batch ( bmp085_comp_t *const comp
+                        , const bmp085_raw_t *const raw, const size_t n
+                        , bmp085_result_t *const res )
+{
+  for (size_t i = 0; i < n; ++i) {
+    bmp085_compensate (comp, raw[i].ut, raw[i].up, &res[i]);
+    res[i].time = raw[i].time;
+  }
+}
+
+/* The first half of bmp085_calculate */
+static void
+compensate_ut (bmp085_comp_t *const comp, const int32_t ut)
+{
+  int32_t x1a = ((ut - comp->ac6) * comp->ac5) >> 15;
+  int32_t x2a = comp->mc_11 / (x1a + comp->md);
+  int32_t b5  = x1a + x2a;
+
+  int32_t b6  = b5 - 4000;
+  int32_t x1b = (comp->b2 * ((b6 * b6) >> 12)) >> 11;
+  int32_t x2b = (comp->ac2 * b6) >> 11;
+  int32_t x3b = x1b + x2b;
+  int32_t x1c = (comp->ac3 * b6) >> 13;
+  int32_t x2c = (comp->b1 * ((b6 * b6) >> 12)) >> 16;
+  int32_t x3c = (x1c + x2c + 2) >> 2;
+
+  comp->have_ut = true;
+  comp->ut = ut;
+  comp->b5 = b5;
+  comp->t  = (b5 + 8) >> 4;
+  comp->b3 = (((comp->ac1_4 + x3b) << comp->oss) + 2) >> 2;
+  comp->b4 = (comp->ac4 * (uint32_t)(x3c + 32768)) >> 15;
+  comp->b4_readings = 0;
+  comp->b4_magic = 0;
+}
+
+/* n / b4. With the same b4 again, that is worth a multiplier and shifts that
+ * divide any 32-bit number by it exactly (Granlund and Montgomery, "Division
+ * by invariant integers using multiplication"); they cost a division of
+ * their own to work out.
+ */
+static uint32_t
+divide_b4 (bmp085_comp_t *const comp, const uint32_t n)
+{
+  if (comp->b4_magic == 0) {
+    if (comp->b4_readings++ == 0)
+      return n / comp->b4;
+
+    uint32_t b4 = comp->b4;
+    int l = b4 > 1 ? 32 - __builtin_clz (b4 - 1) : 0;  /* 2^l >= b4 */
+    comp->b4_magic = ((((uint64_t)1 << l) - b4) << 32) / b4 + 1;
+    comp->b4_shift1 = l < 1 ? l : 1;
+    comp->b4_shift2 = l - comp->b4_shift1;
+  }
+
+  uint32_t q = ((uint64_t)comp->b4_magic * n) >> 32;
+  return (q + ((n - q) >> comp->b4_shift1)) >> comp->b4_shift2;
 }
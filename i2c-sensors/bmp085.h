@@ -4,21 +4,75 @@
 #define INCLUDE_BMP085_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
 #include "error-utilities.h"
+#include "i2c-bus.h"
+#include "i2c-utilities.h"
 
 typedef struct bmp085 bmp085_t;
 
+/* Longest conversion: pressure at oss=3 */
+#define BMP085_CONVERSION_TIME_MAX 25500000  /* ns */
+
+/* The factory calibration from the EEPROM */
+typedef struct {
+  int16_t  ac1, ac2, ac3;
+  uint16_t ac4, ac5, ac6;
+  int16_t  b1, b2, mb, mc, md;
+} bmp085_calib_t;
+
+/* The datasheet example: these readings at this oss come to 15.0 °C and
+ * 69964 Pa.
+ */
+#define BMP085_CALIB_EXAMPLE \
+  ((bmp085_calib_t){ 408, -72, -14383, 32741, 32757, 23153 \
+                   , 6190, 4, -32768, -8711, 2868 \
+                   })
+#define BMP085_UT_EXAMPLE  ((int32_t)27898)
+#define BMP085_OSS_EXAMPLE ((int16_t)0)
+#define BMP085_UP_EXAMPLE  ((int32_t)23843)
+
 typedef struct {
   bool have_result;
+  int64_t time;        /* CLOCK_MONOTONIC ns when UP was read out */
   double temperature;  /* °C */
   double pressure;     /* Pa */
+  int32_t ut, up;      /* The readings they were calculated from */
 } bmp085_result_t;
 
+/* What one pressure measurement reads out */
+typedef struct {
+  int64_t time;    /* CLOCK_MONOTONIC ns when UP was read out */
+  int32_t ut, up;
+} bmp085_raw_t;
+
+/* bmp085_calculate with the calibration terms worked out once, and the
+ * temperature terms again only when UT changes. Gives the same results bit
+ * for bit, with no division per pressure reading once a UT has been used
+ * twice.
+ */
+typedef struct {
+  int16_t oss;
+  int32_t ac1_4, ac2, ac3, ac5, ac6, b1, b2, mc_11, md;
+  uint32_t ac4, b7_factor;
+
+  /* From the last UT */
+  bool have_ut;
+  int32_t ut, b5, t, b3;
+  uint32_t b4;
+  uint32_t b4_readings;          /* Compensated with this b4 so far */
+  uint32_t b4_magic;             /* b4 as a multiply and two shifts, from */
+  uint8_t b4_shift1, b4_shift2;  /* the second reading on; 0: not yet */
+} bmp085_comp_t;
+
+/* eoc_gpio -1: no EOC line; conversions are taken to be done after their
+ * datasheet maximum time, and bmp085_eoc_fd returns -1.
+ */
 bmp085_t *
-bmp085_new ( const int i2c_fd, const int eoc_gpio, const int16_t oss
+bmp085_new ( i2c_bus_t *const bus, const int eoc_gpio, const int16_t oss
            , error_t *const err );
 
 void
@@ -27,8 +81,81 @@ bmp085_free (bmp085_t *const bmp085);
 void
 bmp085_dump (const bmp085_t *const bmp085, FILE *const stream);
 
+const bmp085_calib_t *
+bmp085_calib (const bmp085_t *const bmp085);
+
+int16_t
+bmp085_oss (const bmp085_t *const bmp085);
+
+/* Measure the temperature only after every temp_every pressure conversions,
+ * or once temp_interval ns (0: no limit) have passed since it last was,
+ * whichever comes first. The pressures in between are compensated with the
+ * last temperature. 1, 0 is the datasheet's alternation, and the default.
+ */
+bool
+bmp085_temp_cadence ( bmp085_t *const bmp085, const unsigned temp_every
+                    , const int64_t temp_interval, error_t *const err );
+
+/* Temperature and pressure from raw readings, as the datasheet has it. Sets
+ * everything in res but the time.
+ */
+void
+bmp085_calculate ( const bmp085_calib_t *const calib, const int16_t oss
+                 , const int32_t ut, const int32_t up
+                 , bmp085_result_t *const res );
+
+void
+bmp085_comp_init ( bmp085_comp_t *const comp
+                 , const bmp085_calib_t *const calib, const int16_t oss );
+
+/* bmp085_calculate, from comp */
+void
+bmp085_compensate ( bmp085_comp_t *const comp, const int32_t ut
+                  , const int32_t up, bmp085_result_t *const res );
+
+/* bmp085_compensate over n readings, with res[i].time = raw[i].time */
+void
+bmp085_compensate_batch ( bmp085_comp_t *const comp
+                        , const bmp085_raw_t *const raw, const size_t n
+                        , bmp085_result_t *const res );
+
 bool
 bmp085_run ( bmp085_t *const bmp085, bmp085_result_t *const res
            , error_t *const err );
 
+/* bmp085_run without bmp085_calculate. */
+bool
+bmp085_run_raw ( bmp085_t *const bmp085, bmp085_raw_t *const raw
+               , bool *const fresh, error_t *const err );
+
+/* Take note of the EOC edge that bmp085_eoc_fd signaled. Reading the value
+ * re-arms the edge; the next bmp085_run uses what was read here.
+ */
+bool
+bmp085_eoc_ack (bmp085_t *const bmp085, error_t *const err);
+
+/* The EOC GPIO is set up to signal POLLPRI on its rising edge, so instead of
+ * calling bmp085_run in a loop the caller can poll/epoll on this fd and run
+ * once it fires.
+ */
+int
+bmp085_eoc_fd (const bmp085_t *const bmp085);
+
+/* Block until the pending conversion ends or timeout_ms (-1: forever) passes.
+ * is_ready stays false on timeout, and when no conversion has been started.
+ */
+bool
+bmp085_wait ( bmp085_t *const bmp085, const int timeout_ms, bool *const is_ready
+            , error_t *const err );
+
+/* Queues the reads and writes for the next step of the temperature/pressure
+ * cycle, if the EOC line says there is one to take.
+ */
+bool
+bmp085_batch_prepare ( bmp085_t *const bmp085, i2c_batch_t *const batch
+                     , error_t *const err );
+
+void
+bmp085_batch_finish (bmp085_t *const bmp085, bmp085_result_t *const res);
+
 #endif /* INCLUDE_BMP085_H */
@@ -0,0 +1,815 @@
+/* Check the pure computations against the truth
+ *
+ * Every vector path has to match its scalar reference bit for bit, and the
+ * filters and fits have to find what a simulated scenario put into their
+ * inputs. With names as arguments only those checks run; CTest runs them one
+ * at a time. Exits with 1 if any failed.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ahrs.h"
+#include "altitude.h"
+#include "bmp085.h"
+#include "convert.h"
+#include "decimate.h"
+#include "error-utilities.h"
+#include "gyro-bias.h"
+#include "l3gd20.h"
+#include "lsm303dlhc-acc.h"
+#include "lsm303dlhc-mag.h"
+#include "mag-calibration.h"
+#include "sample.h"
+#include "scenario.h"
+#include "time-utilities.h"
+#include "vertical.h"
+
+static bool check_compensate (error_t *const err);
+static bool check_ahrs (error_t *const err);
+static bool check_vertical (error_t *const err);
+static bool check_altitude (error_t *const err);
+static bool check_mag_calibration (error_t *const err);
+static bool check_gyro_bias (error_t *const err);
+static bool same_error ( error_t *const full, error_t *const compact
+                       , const bool still_compact, error_t *const err );
+static bool check_error (error_t *const err);
+static bool check_decimate (error_t *const err);
+static bool check_convert (error_t *const err);
+
+static const struct {
+  const char *name;
+  bool (*check) (error_t *const err);
+} checks[] = { { "compensate", check_compensate }
+             , { "ahrs", check_ahrs }
+             , { "vertical", check_vertical }
+             , { "altitude", check_altitude }
+             , { "mag_calibration", check_mag_calibration }
+             , { "gyro_bias", check_gyro_bias }
+             , { "error", check_error }
+             , { "decimate", check_decimate }
+             , { "convert", check_convert } };
+
+#define N_CHECKS (sizeof checks / sizeof *checks)
+
+int
+main (int argc, char **argv)
+{
+  bool wanted[N_CHECKS];
+
+  for (size_t i = 0; i < N_CHECKS; ++i)
+    wanted[i] = argc == 1;
+
+  for (int arg = 1; arg < argc; ++arg) {
+    size_t i = 0;
+    while (i < N_CHECKS && strcmp (argv[arg], checks[i].name) != 0)
+      ++i;
+
+    if (i == N_CHECKS) {
+      fprintf (stderr, "Usage: %s [CHECK]...\nChecks:", argv[0]);
+      for (i = 0; i < N_CHECKS; ++i)
+        fprintf (stderr, " %s", checks[i].name);
+      fprintf (stderr, "\n");
+      return 2;
+    }
+    wanted[i] = true;
+  }
+
+  int status = 0;
+  for (size_t i = 0; i < N_CHECKS; ++i) {
+    if (! wanted[i])
+      continue;
+
+    ERROR_DECLARE (err);
+    if (checks[i].check (&err)) {
+      printf ("%s: ok\n", checks[i].name);
+    } else {
+      fprintf (stderr, "%s: %s\n", argv[0], error_message (&err));
+      status = 1;
+    }
+  }
+
+  return status;
+}
+
+/* bmp085_compensate has to give the datasheet example, and what
+ * bmp085_calculate gives for a spread of readings at every oss.
+ */
+static bool
+check_compensate (error_t *const err)
+{
+  const bmp085_calib_t calib = BMP085_CALIB_EXAMPLE;
+  bmp085_comp_t comp;
+  bmp085_result_t a, b;
+
+  bmp085_comp_init (&comp, &calib, BMP085_OSS_EXAMPLE);
+  bmp085_compensate (&comp, BMP085_UT_EXAMPLE, BMP085_UP_EXAMPLE, &a);
+  if (a.temperature != 15.0 || a.pressure != 69964) {
+    error_printf ( err, "check_compensate: %.1f °C, %.0f Pa for the example"
+                 , a.temperature, a.pressure );
+    return false;
+  }
+
+  srand (2);
+  for (int16_t oss = 0; oss <= 3; ++oss) {
+    bmp085_comp_init (&comp, &calib, oss);
+    for (int32_t ut = 20000; ut < 40000; ut += 97)
+      for (int i = 0; i < 64; ++i) {
+        /* 30 to 110 kPa, give or take */
+        int32_t up = (12000 + rand () % 40000) << oss;
+        bmp085_compensate (&comp, ut, up, &a);
+        bmp085_calculate (&calib, oss, ut, up, &b);
+        if (a.temperature != b.temperature || a.pressure != b.pressure) {
+          error_printf ( err, "check_compensate: %.0f Pa, not %.0f, at oss=%d"
+                         " ut=%d up=%d"
+                       , a.pressure, b.pressure, oss, ut, up );
+          return false;
+        }
+      }
+  }
+
+  return true;
+}
+
+/* Hamilton product r = a b */
+static void
+quat_mul (const double *const a, const double *const b, double *const r)
+{
+  r[0] = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+  r[1] = a[0]*b[1] + a[1]*b[0] + a[2]*b[3] - a[3]*b[2];
+  r[2] = a[0]*b[2] - a[1]*b[3] + a[2]*b[0] + a[3]*b[1];
+  r[3] = a[0]*b[3] + a[1]*b[2] - a[2]*b[1] + a[3]*b[0];
+}
+
+/* v, an earth-frame vector, in the body frame of q */
+static void
+quat_to_body (const double *const q, const double *const v, float *const r)
+{
+  const double c[4] = { q[0], -q[1], -q[2], -q[3] }
+             , p[4] = { 0, v[0], v[1], v[2] };
+  double t[4], u[4];
+  quat_mul (c, p, t);
+  quat_mul (t, q, u);
+  r[0] = u[1];
+  r[1] = u[2];
+  r[2] = u[3];
+}
+
+/* Two minutes of tumbling through large angles, as the sensors would see it
+ * with a 1 °/s gyro bias. After the first minute the attitude has to stay
+ * within AHRS_TOLERANCE of the truth.
+ */
+#define AHRS_TOLERANCE 1.0  /* ° */
+
+static bool
+check_ahrs (error_t *const err)
+{
+  const double g[3] = { 0, 0, 9.80665 }
+             , dip = 70.0 * M_PI / 180.0
+             , b[3] = { 50e-6 * cos (dip), 0, -50e-6 * sin (dip) }
+             , bias[3] = { 0.0175, -0.0175, 0.0175 };
+  const double dt = 1.0 / L3GD20_RATE;
+  double q[4] = { 0.8, 0.3, -0.2, 0.48 }, worst = 0;
+  ahrs_t ahrs;
+
+  double n = sqrt (q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  for (int i = 0; i < 4; ++i)
+    q[i] /= n;
+
+  ahrs_init (&ahrs, AHRS_KP, AHRS_KI);
+  ahrs.have_acc = ahrs.have_mag = true;
+
+  for (int step = 0; step < 120 * L3GD20_RATE; ++step) {
+    double t = step * dt
+         , w[3] = { 0.8 * sin (0.7 * t), 0.6 * sin (0.45 * t + 1.0)
+                  , 0.5 * cos (0.3 * t) };
+
+    /* The rate is taken as constant over the step. */
+    double r = sqrt (w[0]*w[0] + w[1]*w[1] + w[2]*w[2]) * dt / 2;
+    double k = r > 0 ? sin (r) / (r * 2 / dt) : dt / 2;
+    double d[4] = { cos (r), w[0] * k, w[1] * k, w[2] * k }, next[4];
+    quat_mul (q, d, next);
+    for (int i = 0; i < 4; ++i)
+      q[i] = next[i];
+
+    float gyro[3] = { w[0] + bias[0], w[1] + bias[1], w[2] + bias[2] };
+    quat_to_body (q, g, ahrs.acc);
+    quat_to_body (q, b, ahrs.mag);
+    ahrs_update (&ahrs, dt, gyro);
+
+    if (t < 60.0)
+      continue;
+
+    double dot = fabs ( q[0]*ahrs.q[0] + q[1]*ahrs.q[1] + q[2]*ahrs.q[2]
+                      + q[3]*ahrs.q[3] );
+    double angle = 2 * acos (dot < 1 ? dot : 1) * 180.0 / M_PI;
+    if (angle > worst)
+      worst = angle;
+  }
+
+  if (worst > AHRS_TOLERANCE) {
+    error_printf (err, "check_ahrs: %.2f° off the truth", worst);
+    return false;
+  }
+
+  return true;
+}
+
+/* Normally distributed, with a standard deviation of 1 */
+static double
+gauss (void)
+{
+  double u = (rand () + 1.0) / (RAND_MAX + 2.0)
+       , v = (rand () + 1.0) / (RAND_MAX + 2.0);
+  return sqrt (-2.0 * log (u)) * cos (2.0 * M_PI * v);
+}
+
+/* Two minutes of climbing and sinking by up to 22 m, through pressures with
+ * 0.3 m of noise at 50 Hz and an accelerometer with 0.3 m/s² of noise and
+ * a 0.15 m/s² bias. After the first minute the altitude and the climb rate
+ * have to be within VERTICAL_H_RMS and VERTICAL_V_RMS, and the bias found.
+ */
+#define VERTICAL_H_RMS 0.1  /* m */
+#define VERTICAL_V_RMS 0.1  /* m/s */
+
+static bool
+check_vertical (error_t *const err)
+{
+  const double p0 = 101325.0, dt = 1.0 / LSM303DLHC_ACC_RATE, bias = 0.15;
+  double h_sum = 0, v_sum = 0;
+  int n = 0;
+  vertical_t vertical;
+
+  srand (3);
+  vertical_init (&vertical, p0);
+
+  for (int step = 0; step < 120 * LSM303DLHC_ACC_RATE; ++step) {
+    double t = step * dt
+         , h = 20.0 * sin (0.3 * t) + 2.0 * sin (1.7 * t)
+         , v = 6.0 * cos (0.3 * t) + 3.4 * cos (1.7 * t)
+         , a = -1.8 * sin (0.3 * t) - 5.78 * sin (1.7 * t);
+
+    vertical_predict (&vertical, dt, a + bias + 0.3 * gauss ());
+
+    if (step % 27 == 0) {
+      double p = p0 * pow ( 1.0 - (h + 0.3 * gauss ()) / ALTITUDE_SCALE
+                          , ALTITUDE_EXPONENT );
+      bmp085_result_t res = { .have_result = true, .pressure = p };
+      vertical_baro (&vertical, &res);
+    }
+
+    if (t >= 60.0) {
+      h_sum += (vertical.h - h) * (vertical.h - h);
+      v_sum += (vertical.v - v) * (vertical.v - v);
+      ++n;
+    }
+  }
+
+  double h_rms = sqrt (h_sum / n), v_rms = sqrt (v_sum / n);
+  if (h_rms > VERTICAL_H_RMS || v_rms > VERTICAL_V_RMS ||
+      fabs (vertical.bias - bias) > 0.02) {
+    error_printf ( err, "check_vertical: %.3f m, %.3f m/s, bias %.3f m/s² off"
+                 , h_rms, v_rms, vertical.bias - bias );
+    return false;
+  }
+
+  return true;
+}
+
+/* The bounds altitude.h gives, against the formula in double, from 30 to
+ * 110 kPa with p0 from 90 to 110 kPa. And the batch has to match the
+ * single calls bit for bit, for every count and for pressures that are not
+ * positive or not numbers.
+ */
+#define ALTITUDE_TOLERANCE 0.01  /* m */
+#define PRESSURE_TOLERANCE 0.1   /* Pa */
+
+static bool
+check_altitude (error_t *const err)
+{
+  double h_worst = 0, p_worst = 0;
+
+  for (float p0 = 90000.0f; p0 <= 110000.0f; p0 += 1000.0f) {
+    for (float p = 30000.0f; p <= 110000.0f; p += 1.7f) {
+      double h = ALTITUDE_SCALE * (1.0 - pow ( (double)p / p0
+                                             , 1.0 / ALTITUDE_EXPONENT ));
+      h_worst = fmax (h_worst, fabs (altitude_from_pressure (p, p0) - h));
+
+      /* The altitude as a float is what the inverse gets to see. */
+      float hf = h;
+      double q = p0 * pow (1.0 - hf / ALTITUDE_SCALE, ALTITUDE_EXPONENT);
+      p_worst = fmax (p_worst, fabs (pressure_from_altitude (hf, p0) - q));
+    }
+  }
+
+  if (h_worst > ALTITUDE_TOLERANCE || p_worst > PRESSURE_TOLERANCE) {
+    error_printf ( err, "check_altitude: %.4f m, %.4f Pa off the formula"
+                 , h_worst, p_worst );
+    return false;
+  }
+
+  float p[64], a[64], b[64];
+  srand (4);
+  for (int round = 0; round < 1000; ++round) {
+    for (int i = 0; i < 64; ++i)
+      p[i] = rand () % 16 == 0 ? (rand () % 2 ? -1.0f : NAN)
+                               : (float)rand () / RAND_MAX * 200000.0f;
+
+    for (size_t n = 0; n <= 64; ++n) {
+      memset (a, 0, sizeof a);
+      memset (b, 0, sizeof b);
+      altitude_from_pressure_batch (p, n, 101325.0f, a);
+      for (size_t i = 0; i < n; ++i)
+        b[i] = altitude_from_pressure (p[i], 101325.0f);
+
+      if (memcmp (a, b, sizeof a) != 0) {
+        error_printf ( err, "check_altitude: %s differs from single calls"
+                            " at n=%zu", altitude_impl (), n );
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/* Ninety seconds of the tumble at the magnetometer rate with ±0.5 µT of
+ * noise; the corrected field must then point within MAG_TOLERANCE of the
+ * truth in every direction, including those the tumble never reached.
+ */
+#define MAG_TOLERANCE 0.5  /* ° */
+
+static bool
+check_mag_calibration (error_t *const err)
+{
+  mag_calibration_t cal;
+  double worst = 0;
+
+  mag_calibration_init (&cal);
+  srand (5);
+  for (int step = 0; step < 90 * LSM303DLHC_MAG_RATE; ++step) {
+    double u[3], raw[3];
+    scenario_mag_tumble ((double)step / LSM303DLHC_MAG_RATE, u);
+    scenario_mag_distort (u, raw);
+    for (int i = 0; i < 3; ++i)
+      raw[i] += ((double)rand () / RAND_MAX - 0.5) * 1e-6;
+    mag_calibration_update (&cal, raw);
+  }
+
+  if (! cal.valid) {
+    error_printf (err, "check_mag_calibration: no solution");
+    return false;
+  }
+
+  /* A spiral over the whole sphere, poles included */
+  for (int i = 0; i < 1000; ++i) {
+    const double az = 0.1 * i, el = asin (2.0 * i / 1000 - 1.0)
+               , u[3] = { cos (el) * cos (az), cos (el) * sin (az)
+                        , sin (el) };
+    double raw[3], out[3];
+    scenario_mag_distort (u, raw);
+    mag_calibration_apply (&cal, raw, out);
+
+    double dot = 0, n = 0;
+    for (int j = 0; j < 3; ++j) {
+      dot += out[j] * u[j];
+      n += out[j] * out[j];
+    }
+    double angle = acos (fmin (1, dot / sqrt (n))) * 180.0 / M_PI;
+    worst = fmax (worst, angle);
+  }
+
+  if (worst > MAG_TOLERANCE) {
+    error_printf (err, "check_mag_calibration: %.2f° off the truth", worst);
+    return false;
+  }
+
+  return true;
+}
+
+/* Twenty seconds still at one temperature, twenty of tumbling at another,
+ * twenty still at a third, then half a minute of a slow, even turn about
+ * gravity between them, with ±0.3 °/s and ±0.05 m/s² of noise. The bias has
+ * to come out within GYRO_BIAS_TOLERANCE at the temperatures held still at
+ * and, interpolated, at the one turned at.
+ */
+#define GYRO_BIAS_TOLERANCE 0.01  /* °/s */
+
+static bool
+check_gyro_bias (error_t *const err)
+{
+  static const struct {
+    double seconds;
+    int temp;
+    double turn;  /* radian/s about z; -1 for the tumble */
+  } phases[] = { { 20, 10, 0 }, { 20, 15, -1 }, { 20, 30, 0 }
+               , { 30, 20, 5.0 * M_PI / 180.0 } };
+  const double g = 9.80665;
+  gyro_bias_t gb;
+  double t = 0, next_acc = 0;
+
+  gyro_bias_init (&gb, L3GD20_RATE, LSM303DLHC_ACC_RATE);
+  srand (6);
+
+  for (size_t p = 0; p < sizeof (phases) / sizeof (phases[0]); ++p) {
+    double bias[3], end = t + phases[p].seconds;
+    scenario_gyro_bias (phases[p].temp, bias);
+
+    for (; t < end; t += 1.0 / L3GD20_RATE) {
+      const bool tumble = phases[p].turn < 0;
+      double w[3] = { tumble ? 0.8 * sin (0.7 * t) : 0
+                    , tumble ? 0.6 * sin (0.45 * t + 1.0) : 0
+                    , tumble ? 0.5 * cos (0.3 * t) : phases[p].turn };
+      for (int i = 0; i < 3; ++i)
+        w[i] += bias[i] + ((double)rand () / RAND_MAX - 0.5) * 0.6 * M_PI / 180;
+
+      /* The accelerometer runs faster; its samples come in between. */
+      for (; next_acc <= t; next_acc += 1.0 / LSM303DLHC_ACC_RATE) {
+        double a[3] = { tumble ? g * sin (0.7 * next_acc) : 0
+                      , tumble ? g * cos (0.45 * next_acc) : 0
+                      , g };
+        for (int i = 0; i < 3; ++i)
+          a[i] += ((double)rand () / RAND_MAX - 0.5) * 0.1;
+        gyro_bias_acc (&gb, a);
+      }
+
+      gyro_bias_gyro (&gb, phases[p].temp, w);
+    }
+  }
+
+  double worst = 0;
+  for (int temp = 10; temp <= 30; temp += 10) {
+    double truth[3], bias[3];
+    scenario_gyro_bias (temp, truth);
+    if (! gyro_bias_get (&gb, temp, bias)) {
+      error_printf (err, "check_gyro_bias: nothing learnt");
+      return false;
+    }
+
+    for (int i = 0; i < 3; ++i)
+      worst = fmax (worst, fabs (bias[i] - truth[i]) * 180.0 / M_PI);
+  }
+
+  if (worst > GYRO_BIAS_TOLERANCE) {
+    error_printf (err, "check_gyro_bias: %.4f °/s off the truth", worst);
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+same_error ( error_t *const full, error_t *const compact
+           , const bool still_compact, error_t *const err )
+{
+  if (compact->compact != still_compact) {
+    error_printf ( err, "check_error: \"%s\" %s compact"
+                 , error_message (full), still_compact ? "not" : "still" );
+    return false;
+  }
+
+  if (strcmp (error_message (full), error_message (compact)) != 0) {
+    error_printf ( err, "check_error: \"%s\" compact, \"%s\" full"
+                 , error_message (compact), error_message (full) );
+    return false;
+  }
+
+  return true;
+}
+
+/* A compact error has to come out with the message a full one has,
+ * truncated the same way when it is too long, formatting the printf
+ * arguments it kept only then. A %s, which it cannot keep, or too many
+ * arguments make it stop being compact.
+ */
+static bool
+check_error (error_t *const err)
+{
+  static const char *const prefixes[] =
+    { "i2c_bus_read_block", "l3gd20_run", "i2c_sensors_run", "acquisition" };
+  char long_prefix[ERROR_SIZE / 4];
+
+  memset (long_prefix, 'x', sizeof long_prefix - 1);
+  long_prefix[sizeof long_prefix - 1] = '\0';
+
+  for (int n = 0; n <= ERROR_TRACE_SIZE; ++n) {
+    ERROR_DECLARE (full);
+    ERROR_DECLARE_COMPACT (compact);
+
+    error_strerror (&full, EREMOTEIO);
+    error_strerror (&compact, EREMOTEIO);
+    for (int i = 0; i < n; ++i) {
+      const char *prefix = n == ERROR_TRACE_SIZE ? long_prefix
+                                                 : prefixes[i % 4];
+      error_prefix (&full, prefix);
+      error_prefix (&compact, prefix);
+    }
+
+    if (! same_error (&full, &compact, true, err))
+      return false;
+  }
+
+  /* Arguments of every kind kept, and formatted only by error_message */
+  {
+    ERROR_DECLARE (full);
+    ERROR_DECLARE_COMPACT (compact);
+    int where = 0;
+
+    error_t *const both[] = { &full, &compact };
+    for (int i = 0; i < 2; ++i) {
+      error_strerror (both[i], EREMOTEIO);
+      error_prefix_printf (both[i], "i2c_sim: no ACK from 0x%02x", 0x6b);
+      error_prefix_printf ( both[i], "%d %u %ld %zu", -3, 7u, -40000L
+                          , (size_t)12 );
+      error_prefix_printf ( both[i], "%.2f %c %p 100%%", 3.14159, 'x'
+                          , (void *)&where );
+      error_prefix_printf ( both[i], "%hhd %hu %+6lld|%-4x|", 300, 70000
+                          , -5LL, 0xbeefu );
+      error_prefix (both[i], "l3gd20_run");
+    }
+    if (! same_error (&full, &compact, true, err))
+      return false;
+  }
+
+  /* A %s is formatted right away, while its string is still there */
+  {
+    ERROR_DECLARE (full);
+    ERROR_DECLARE_COMPACT (compact);
+    char path[] = "/dev/i2c-1";
+
+    error_errno (&full);
+    error_errno (&compact);
+    error_prefix_printf (&full, "open %s failed", path);
+    error_prefix_printf (&compact, "open %s failed", path);
+    path[9] = '7';
+    if (! same_error (&full, &compact, false, err))
+      return false;
+  }
+
+  /* More arguments than a trace entry keeps */
+  {
+    ERROR_DECLARE (full);
+    ERROR_DECLARE_COMPACT (compact);
+
+    error_strerror (&full, EIO);
+    error_strerror (&compact, EIO);
+    error_prefix_printf (&full, "%d %d %d %d %d", 1, 2, 3, 4, 5);
+    error_prefix_printf (&compact, "%d %d %d %d %d", 1, 2, 3, 4, 5);
+    error_prefix (&full, "acquisition");
+    error_prefix (&compact, "acquisition");
+    if (! same_error (&full, &compact, false, err))
+      return false;
+  }
+
+  return true;
+}
+
+/* Two seconds of a unit tone at freq Hz sampled at rate Hz through config,
+ * in blocks of every size. Leaves in worst how far the output, from the
+ * first half second on, is off gain times the tone delayed as
+ * decimate_delay says.
+ */
+static bool
+decimate_tone ( const decimate_config_t *const config, const double rate
+              , const double freq, const double gain, double *const worst
+              , error_t *const err )
+{
+  decimate_t *dec = decimate_new (config, err);
+  if (! dec)
+    return false;
+
+  const int64_t period = NS_PER_S / rate;
+  int64_t group_delay, latency;
+  decimate_delay (dec, period, &group_delay, &latency);
+
+  sample_block_t in, out;
+  *worst = 0;
+  for (long k = 0, b = 0; k < 2 * rate; ++b) {
+    in.count = 1 + b * 7 % SAMPLE_BLOCK_SIZE;
+    in.overrun = false;
+    in.period = period;
+    for (size_t i = 0; i < in.count; ++i, ++k)
+      in.x[i] = in.y[i] = in.z[i] = sin (2 * M_PI * freq * k * period / 1e9);
+    in.time = (k - 1) * period;
+
+    decimate_block (dec, &in, &out);
+    for (size_t j = 0; j < out.count; ++j) {
+      double t = out.time - (double)(out.count - 1 - j) * out.period
+                          - group_delay;
+      if (t < 0.5e9)
+        continue;
+      double x = gain * sin (2 * M_PI * freq * t / 1e9);
+      *worst = fmax (*worst, fabs (out.x[j] - x));
+      *worst = fmax (*worst, fabs (out.z[j] - x));
+    }
+  }
+
+  decimate_free (dec);
+  return true;
+}
+
+/* Gyro results among accelerometer-only records, with one sample missed,
+ * handed to decimate_records a few records at a time: what comes out has
+ * to be what decimate_block makes of the same samples, with the block
+ * after the missed one marked as an overrun.
+ */
+static bool
+decimate_records_same (error_t *const err)
+{
+  enum { RECORDS = 3000, MISSED = 1000 };
+  static acquisition_record_t records[RECORDS];
+  static float in_x[RECORDS], out_x[2][RECORDS];
+  const int64_t period = NS_PER_S / L3GD20_RATE;
+
+  size_t n = 0;
+  for (size_t k = 0; k < RECORDS; ++k) {
+    i2c_sensors_result_t *const res = &records[k].res;
+    memset (res, 0, sizeof *res);
+    if (k % 3 == 2) {
+      res->acc.have_result = true;
+      continue;
+    }
+
+    res->gyro.have_result = true;
+    res->gyro.time = NS_PER_S + (int64_t)(n + (n >= MISSED)) * period;
+    res->gyro.x = in_x[n] = sinf (n * 0.05f);
+    ++n;
+    res->gyro.y = res->gyro.z = 0;
+  }
+
+  decimate_t *a = decimate_new (&scenario_decimate_gyro, err), *b = NULL;
+  if (! a || ! (b = decimate_new (&scenario_decimate_gyro, err))) {
+    if (a)
+      decimate_free (a);
+    return false;
+  }
+
+  size_t count[2] = { 0, 0 };
+  unsigned overruns = 0;
+  sample_block_t in, out;
+  for (size_t k = 0, m = 1; k < RECORDS; m = m % 40 + 1) {
+    size_t take = m < RECORDS - k ? m : RECORDS - k;
+    while (take) {
+      size_t took = decimate_records ( a, DECIMATE_GYRO, &records[k], take
+                                     , &out );
+      k += took;
+      take -= took;
+      overruns += out.overrun;
+      for (size_t j = 0; j < out.count; ++j)
+        out_x[0][count[0]++] = out.x[j];
+    }
+  }
+
+  memset (&in, 0, sizeof in);
+  in.period = period;
+  for (size_t i = 0; i < n; i += in.count) {
+    in.count = n - i < SAMPLE_BLOCK_SIZE ? n - i : SAMPLE_BLOCK_SIZE;
+    memcpy (in.x, &in_x[i], in.count * sizeof (float));
+    decimate_block (b, &in, &out);
+    for (size_t j = 0; j < out.count; ++j)
+      out_x[1][count[1]++] = out.x[j];
+  }
+
+  decimate_free (b);
+  decimate_free (a);
+
+  if ( count[0] != count[1] || overruns != 1 ||
+       memcmp (out_x[0], out_x[1], count[0] * sizeof (float)) ) {
+    error_printf ( err, "check_decimate: %zu samples, %u overruns from "
+                        "records; %zu from blocks"
+                 , count[0], overruns, count[1] );
+    return false;
+  }
+
+  return true;
+}
+
+/* decimate_block has to match decimate_block_scalar bit for bit, over
+ * blocks of every size; a 10 Hz tone has to come through within
+ * DECIMATE_TOLERANCE, delayed as decimate_delay says, and one that would
+ * alias has to be gone to within it, 60 dB down. The CIC stage is held to
+ * its own response.
+ */
+#define DECIMATE_TOLERANCE 1e-3
+
+static bool
+check_decimate (error_t *const err)
+{
+  const decimate_config_t *const configs[] =
+    { &scenario_decimate_acc, &scenario_decimate_gyro, &scenario_decimate_cic };
+  const double rates[] = { LSM303DLHC_ACC_RATE, L3GD20_RATE, L3GD20_RATE };
+
+  srand (7);
+  for (int c = 0; c < 3; ++c) {
+    decimate_t *a = decimate_new (configs[c], err), *b = NULL;
+    if (! a || ! (b = decimate_new (configs[c], err))) {
+      if (a)
+        decimate_free (a);
+      return false;
+    }
+
+    sample_block_t in, out_a, out_b;
+    bool same = true;
+    for (int round = 0; same && round < 1000; ++round) {
+      in.count = rand () % (SAMPLE_BLOCK_SIZE + 1);
+      in.overrun = rand () % 64 == 0;
+      in.time = round * (int64_t)NS_PER_S;
+      in.period = NS_PER_S / rates[c];
+      for (size_t i = 0; i < in.count; ++i) {
+        in.x[i] = (float)rand () / RAND_MAX * 40 - 20;
+        in.y[i] = (float)rand () / RAND_MAX * 2e-4f;
+        in.z[i] = (float)rand () / RAND_MAX - 0.5f;
+      }
+
+      memset (&out_a, 0, sizeof out_a);
+      memset (&out_b, 0, sizeof out_b);
+      decimate_block (a, &in, &out_a);
+      decimate_block_scalar (b, &in, &out_b);
+      same = memcmp (&out_a, &out_b, sizeof out_a) == 0;
+    }
+
+    decimate_free (b);
+    decimate_free (a);
+    if (! same) {
+      error_printf ( err, "check_decimate: %s differs from scalar for %u/%u"
+                   , decimate_impl (), configs[c]->up, configs[c]->down );
+      return false;
+    }
+  }
+
+  /* The CIC response at 10 Hz, and a null at its output rate */
+  const double x = M_PI * 10 / L3GD20_RATE
+             , box = sin (4 * x) / (4 * sin (x))
+             , cic = pow (box, scenario_decimate_cic.taps);
+  const struct {
+    const decimate_config_t *config;
+    double rate, freq, gain;
+  } tones[] = { { &scenario_decimate_acc, LSM303DLHC_ACC_RATE, 10, 1 }
+              , { &scenario_decimate_acc, LSM303DLHC_ACC_RATE, 400, 0 }
+              , { &scenario_decimate_gyro, L3GD20_RATE, 10, 1 }
+              , { &scenario_decimate_gyro, L3GD20_RATE, 300, 0 }
+              , { &scenario_decimate_cic, L3GD20_RATE, 10, cic }
+              , { &scenario_decimate_cic, L3GD20_RATE, L3GD20_RATE / 4.0, 0 } };
+
+  for (size_t i = 0; i < sizeof tones / sizeof *tones; ++i) {
+    double worst;
+    if (! decimate_tone ( tones[i].config, tones[i].rate, tones[i].freq
+                        , tones[i].gain, &worst, err ))
+      return false;
+
+    if (worst > DECIMATE_TOLERANCE) {
+      error_printf ( err, "check_decimate: %.5f off at %g Hz for %u/%u"
+                   , worst, tones[i].freq, tones[i].config->up
+                   , tones[i].config->down );
+      return false;
+    }
+  }
+
+  return decimate_records_same (err);
+}
+
+
+/* convert_xyz has to match convert_xyz_scalar bit for bit, for every count
+ * (so every mix of vector and scalar tail) and the full int16 range.
+ */
+static bool
+check_convert (error_t *const err)
+{
+  const sample_scale_t scales[] = {
+    { { L3GD20_SCALE, L3GD20_SCALE, L3GD20_SCALE }, { 0, 0, 0 } },
+    { { LSM303DLHC_ACC_SCALE, LSM303DLHC_ACC_SCALE, LSM303DLHC_ACC_SCALE }
+    , { 0.0123f, -0.0456f, 0.0789f } },
+    { { LSM303DLHC_MAG_SCALE_XY, LSM303DLHC_MAG_SCALE_Z
+      , LSM303DLHC_MAG_SCALE_XY }
+    , { -1e-3f, 2e-3f, -3e-3f } },
+  };
+  uint8_t data[SAMPLE_BLOCK_SIZE * 6] __attribute__ ((aligned (16)));
+  sample_block_t a, b;
+
+  srand (1);
+  for (int round = 0; round < 1000; ++round) {
+    for (size_t i = 0; i < sizeof data; ++i)
+      data[i] = rand ();
+
+    const sample_scale_t *scale =
+      &scales[round % (sizeof scales / sizeof *scales)];
+    for (size_t n = 0; n <= SAMPLE_BLOCK_SIZE; ++n) {
+      memset (&a, 0, sizeof a);
+      memset (&b, 0, sizeof b);
+      convert_xyz (data, n, scale, a.x, a.y, a.z);
+      convert_xyz_scalar (data, n, scale, b.x, b.y, b.z);
+
+      if (memcmp (&a, &b, sizeof a) != 0) {
+        error_printf ( err, "check_convert: %s differs from scalar at n=%zu"
+                     , convert_xyz_impl (), n );
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
@@ -1,7 +1,8 @@
 #ifndef INCLUDE_COMMON_H
 #define INCLUDE_COMMON_H
 
-#define GPIO_PATH "/sys/class/gpio/gpio%u/value"
+#define GPIO_PATH      "/sys/class/gpio/gpio%u/value"
+#define GPIO_EDGE_PATH "/sys/class/gpio/gpio%u/edge"
 
 #define POISON 0x42424242
 
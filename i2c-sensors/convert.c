@@ -0,0 +1,204 @@
+/* Block conversion of raw x, y, z samples to float */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "convert.h"
+
+#include "i2c-utilities.h"
+#include "sample.h"
+#include "simd.h"
+
+#ifdef SIMD_NEON
+static size_t convert_neon ( const uint8_t *const data, const size_t n
+                           , const sample_scale_t *const scale
+                           , float *const x, float *const y, float *const z );
+#endif
+
+#ifdef SIMD_SSE2
+static size_t convert_sse2 ( const uint8_t *const data, const size_t n
+                           , const sample_scale_t *const scale
+                           , float *const x, float *const y, float *const z );
+static size_t convert_avx2 ( const uint8_t *const data, const size_t n
+                           , const sample_scale_t *const scale
+                           , float *const x, float *const y, float *const z );
+#endif
+
+void
+convert_xyz ( const uint8_t *const data, const size_t n
+            , const sample_scale_t *const scale
+            , float *const x, float *const y, float *const z )
+{
+  size_t done = 0;
+
+#if defined SIMD_NEON
+  done = convert_neon (data, n, scale, x, y, z);
+#elif defined SIMD_SSE2
+  done = simd_have_avx2 () ? convert_avx2 (data, n, scale, x, y, z)
+                           : convert_sse2 (data, n, scale, x, y, z);
+#endif
+
+  /* What did not fill a whole vector */
+  convert_xyz_scalar ( &data[done * 6], n - done, scale
+                     , &x[done], &y[done], &z[done] );
+}
+
+void
+convert_xyz_scalar ( const uint8_t *const data, const size_t n
+                   , const sample_scale_t *const scale
+                   , float *const x, float *const y, float *const z )
+{
+  const float k[3] = { scale->scale[0], scale->scale[1], scale->scale[2] }
+            , b[3] = { scale->bias[0], scale->bias[1], scale->bias[2] };
+
+  for (size_t i = 0; i < n; ++i) {
+    const uint8_t *d = &data[i * 6];
+    x[i] = (int16_t)i2c_be16 (&d[0]) * k[0] + b[0];
+    y[i] = (int16_t)i2c_be16 (&d[2]) * k[1] + b[1];
+    z[i] = (int16_t)i2c_be16 (&d[4]) * k[2] + b[2];
+  }
+}
+
+const char *
+convert_xyz_impl (void)
+{
+  return simd_impl ();
+}
+
+#ifdef SIMD_NEON
+/* Eight samples at a time; vld3 takes the x, y and z apart on its own. */
+static size_t
+convert_neon ( const uint8_t *const data, const size_t n
+             , const sample_scale_t *const scale
+             , float *const x, float *const y, float *const z )
+{
+  float *const out[3] = { x, y, z };
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    int16x8x3_t v = vld3q_s16 ((const int16_t *)&data[i * 6]);
+
+    for (int axis = 0; axis < 3; ++axis) {
+      /* Big- to little-endian */
+      int16x8_t s = vreinterpretq_s16_u8 (vrev16q_u8 (vreinterpretq_u8_s16
+                                                        (v.val[axis])));
+      float32x4_t lo = vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (s)))
+                , hi = vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (s)))
+                , k = vdupq_n_f32 (scale->scale[axis])
+                , b = vdupq_n_f32 (scale->bias[axis]);
+
+      /* Not vmlaq: keep the two roundings of the scalar path. */
+      vst1q_f32 (&out[axis][i],     vaddq_f32 (vmulq_f32 (lo, k), b));
+      vst1q_f32 (&out[axis][i + 4], vaddq_f32 (vmulq_f32 (hi, k), b));
+    }
+  }
+
+  return i;
+}
+#endif /* SIMD_NEON */
+
+#ifdef SIMD_SSE2
+/* Four int16 to float, sign-extended from the upper halves of an unpack. */
+#define CVT_LO(v) \
+  _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16))
+#define CVT_HI(v) \
+  _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16))
+
+/* Four samples at a time: a = x0 y0 z0 x1, b = y1 z1 x2 y2, c = z2 x3 y3 z3
+ * get shuffled into x, y and z.
+ */
+static size_t
+convert_sse2 ( const uint8_t *const data, const size_t n
+             , const sample_scale_t *const scale
+             , float *const x, float *const y, float *const z )
+{
+  const __m128 kx = _mm_set1_ps (scale->scale[0])
+             , ky = _mm_set1_ps (scale->scale[1])
+             , kz = _mm_set1_ps (scale->scale[2])
+             , bx = _mm_set1_ps (scale->bias[0])
+             , by = _mm_set1_ps (scale->bias[1])
+             , bz = _mm_set1_ps (scale->bias[2]);
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    const uint8_t *d = &data[i * 6];
+    __m128i v0 = _mm_loadu_si128 ((const __m128i *)d)
+          , v1 = _mm_loadl_epi64 ((const __m128i *)(d + 16));
+
+    /* Big- to little-endian */
+    v0 = _mm_or_si128 (_mm_slli_epi16 (v0, 8), _mm_srli_epi16 (v0, 8));
+    v1 = _mm_or_si128 (_mm_slli_epi16 (v1, 8), _mm_srli_epi16 (v1, 8));
+
+    __m128 a = CVT_LO (v0), b = CVT_HI (v0), c = CVT_LO (v1);
+
+    __m128 h  = _mm_shuffle_ps (b, c, _MM_SHUFFLE (1, 1, 2, 2))
+         , vx = _mm_shuffle_ps (a, h, _MM_SHUFFLE (2, 0, 3, 0));
+
+    __m128 g  = _mm_shuffle_ps (a, b, _MM_SHUFFLE (0, 0, 1, 1))
+         , k  = _mm_shuffle_ps (b, c, _MM_SHUFFLE (2, 2, 3, 3))
+         , vy = _mm_shuffle_ps (g, k, _MM_SHUFFLE (2, 0, 2, 0));
+
+    g = _mm_shuffle_ps (a, b, _MM_SHUFFLE (1, 1, 2, 2));
+    k = _mm_shuffle_ps (c, c, _MM_SHUFFLE (3, 3, 0, 0));
+    __m128 vz = _mm_shuffle_ps (g, k, _MM_SHUFFLE (2, 0, 2, 0));
+
+    _mm_storeu_ps (&x[i], _mm_add_ps (_mm_mul_ps (vx, kx), bx));
+    _mm_storeu_ps (&y[i], _mm_add_ps (_mm_mul_ps (vy, ky), by));
+    _mm_storeu_ps (&z[i], _mm_add_ps (_mm_mul_ps (vz, kz), bz));
+  }
+
+  return i;
+}
+
+/* Eight samples at a time. Of a = x0 y0 z0 x1 y1 z1 x2 y2,
+ * b = z2 x3 y3 z3 x4 y4 z4 x5 and c = y5 z5 x6 y6 z6 x7 y7 z7, the lanes
+ * holding one axis never overlap, so two blends gather them and a
+ * permutation puts them in order.
+ */
+__attribute__ ((target ("avx2")))
+static size_t
+convert_avx2 ( const uint8_t *const data, const size_t n
+             , const sample_scale_t *const scale
+             , float *const x, float *const y, float *const z )
+{
+  const __m128i swap = _mm_setr_epi8 ( 1, 0, 3, 2, 5, 4, 7, 6
+                                     , 9, 8, 11, 10, 13, 12, 15, 14 );
+  const __m256i ix = _mm256_setr_epi32 (0, 3, 6, 1, 4, 7, 2, 5)
+              , iy = _mm256_setr_epi32 (1, 4, 7, 2, 5, 0, 3, 6)
+              , iz = _mm256_setr_epi32 (2, 5, 0, 3, 6, 1, 4, 7);
+  const __m256 kx = _mm256_set1_ps (scale->scale[0])
+             , ky = _mm256_set1_ps (scale->scale[1])
+             , kz = _mm256_set1_ps (scale->scale[2])
+             , bx = _mm256_set1_ps (scale->bias[0])
+             , by = _mm256_set1_ps (scale->bias[1])
+             , bz = _mm256_set1_ps (scale->bias[2]);
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    const __m128i *d = (const __m128i *)&data[i * 6];
+    __m256 v[3];
+    for (int j = 0; j < 3; ++j)
+      v[j] = _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32
+                                   (_mm_shuffle_epi8 ( _mm_loadu_si128 (&d[j])
+                                                     , swap )));
+
+    __m256 vx = _mm256_blend_ps (v[0], v[1], 0x92)
+         , vy = _mm256_blend_ps (v[0], v[1], 0x24)
+         , vz = _mm256_blend_ps (v[0], v[1], 0x49);
+    vx = _mm256_blend_ps (vx, v[2], 0x24);
+    vy = _mm256_blend_ps (vy, v[2], 0x49);
+    vz = _mm256_blend_ps (vz, v[2], 0x92);
+    vx = _mm256_permutevar8x32_ps (vx, ix);
+    vy = _mm256_permutevar8x32_ps (vy, iy);
+    vz = _mm256_permutevar8x32_ps (vz, iz);
+
+    _mm256_storeu_ps (&x[i], _mm256_add_ps (_mm256_mul_ps (vx, kx), bx));
+    _mm256_storeu_ps (&y[i], _mm256_add_ps (_mm256_mul_ps (vy, ky), by));
+    _mm256_storeu_ps (&z[i], _mm256_add_ps (_mm256_mul_ps (vz, kz), bz));
+  }
+
+  simd_avx2_leave ();
+  return i;
+}
+#endif /* SIMD_SSE2 */
@@ -0,0 +1,38 @@
+/* Block conversion of raw x, y, z samples to float
+ *
+ * Turns n samples of big-endian int16 x, y, z, as a FIFO burst read brings
+ * them in (at an even address), into separate x, y and z float arrays with
+ * the scale and bias of a sample_scale_t, rounded to float, applied. Uses
+ * NEON on ARM, AVX2 (when the CPU has it) or SSE2 on x86, and plain C
+ * elsewhere. Every path multiplies and then adds, each rounded to float, so
+ * they all give exactly what convert_xyz_scalar does; the one exception is
+ * that ARMv7 NEON flushes denormals to zero, which takes a scale and bias
+ * much smaller than any of ours to matter.
+ */
+
+#ifndef INCLUDE_CONVERT_H
+#define INCLUDE_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sample.h"
+
+void
+convert_xyz ( const uint8_t *const data, const size_t n
+            , const sample_scale_t *const scale
+            , float *const x, float *const y, float *const z );
+
+/* The reference the vector paths are held to */
+void
+convert_xyz_scalar ( const uint8_t *const data, const size_t n
+                   , const sample_scale_t *const scale
+                   , float *const x, float *const y, float *const z );
+
+/* Which implementation convert_xyz uses: "neon", "avx2", "sse2" or
+ * "scalar".
+ */
+const char *
+convert_xyz_impl (void);
+
+#endif /* INCLUDE_CONVERT_H */
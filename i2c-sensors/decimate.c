@@ -0,0 +1,433 @@
+/* Anti-alias filtering and decimation of x, y, z sample blocks
+ *
+ * Output n of the prototype filter h (of length taps * up, at up times the
+ * input rate) is sum h[k*up + p] x[i - k] over k, with i = n*down / up and
+ * p = n*down % up, so every phase p has its own taps at the input rate.
+ * They are stored backwards and padded at the old end to a multiple of
+ * eight, which makes each output one dot product with the history as it
+ * lies in memory.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decimate.h"
+
+#include "common.h"
+#include "error-utilities.h"
+#include "sample.h"
+#include "simd.h"
+#include "time-utilities.h"
+
+/* For aligned vector loads of the taps */
+#define ALIGNMENT 32
+
+typedef float (*dot_t) ( const float *const taps, const float *const x
+                       , const size_t n );
+
+struct decimate {
+  decimate_config_t config;
+  size_t width;      /* Taps per phase, padded */
+  float *taps;       /* up rows of width, backwards */
+  float *history[3]; /* width - 1 old samples and a block, per axis */
+  size_t held;       /* Samples in the history */
+  uint64_t next;     /* Where the next output is, times up */
+  double delay;      /* Group delay in input periods */
+  int64_t last;      /* Of the last sample decimate_records took; 0: none */
+};
+
+static bool design ( decimate_t *const dec, double *const h, const size_t n
+                   , error_t *const err );
+static void run ( decimate_t *const dec, const sample_block_t *const in
+                , sample_block_t *const out, const dot_t dot );
+static float dot_scalar ( const float *const taps, const float *const x
+                        , const size_t n );
+
+#ifdef SIMD_NEON
+static float dot_neon ( const float *const taps, const float *const x
+                      , const size_t n );
+#endif
+
+#ifdef SIMD_SSE2
+static float dot_sse2 ( const float *const taps, const float *const x
+                      , const size_t n );
+static float dot_avx2 ( const float *const taps, const float *const x
+                      , const size_t n );
+#endif
+
+decimate_t *
+decimate_new (const decimate_config_t *const config, error_t *const err)
+{
+  const unsigned up = config->up, down = config->down;
+
+  if (! (up >= 1 && down >= up && config->taps >= 1 &&
+         (config->kind == DECIMATE_FIR || up == 1) &&
+         (config->kind == DECIMATE_CIC ||
+          (config->cutoff > 0 && config->cutoff <= 1)))) {
+    error_printf ( err, "Invalid configuration: %u/%u, %u taps, cutoff %g"
+                 , up, down, config->taps, config->cutoff );
+    goto invalid;
+  }
+
+  /* Every CIC stage, a moving sum of down inputs, makes the response
+   * down - 1 taps longer.
+   */
+  const size_t n = config->kind == DECIMATE_FIR ? config->taps
+                 : config->taps * (down - 1) + 1
+             , width = (n + 7) / 8 * 8;
+  if (width > DECIMATE_MAX_TAPS) {
+    error_printf (err, "Too many taps: %zu", n);
+    goto invalid;
+  }
+
+  decimate_t *dec = malloc (sizeof (decimate_t));
+  if (! dec) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto malloc_failed;
+  }
+
+  dec->config = *config;
+  dec->width = width;
+  dec->held = 0;
+  dec->next = 0;
+  dec->last = 0;
+
+  int errnum;
+  const size_t length = width - 1 + SAMPLE_BLOCK_SIZE
+             , size = (up * width + 3 * length) * sizeof (float);
+  if ((errnum = posix_memalign ((void **)&dec->taps, ALIGNMENT, size))) {
+    error_strerror (err, errnum);
+    error_prefix (err, "posix_memalign failed");
+    goto taps_failed;
+  }
+  for (int axis = 0; axis < 3; ++axis)
+    dec->history[axis] = &dec->taps[up * width + axis * length];
+
+  double *h = malloc (n * up * sizeof (double));
+  if (! h) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto h_failed;
+  }
+
+  if (! design (dec, h, n, err))
+    goto design_failed;
+
+  /* Phase p backwards, with its sum made 1 so that a constant comes through
+   * as it is from every phase
+   */
+  memset (dec->taps, 0, up * width * sizeof (float));
+  for (unsigned p = 0; p < up; ++p) {
+    double sum = 0;
+    for (size_t k = 0; k < n; ++k)
+      sum += h[k * up + p];
+    for (size_t k = 0; k < n; ++k)
+      dec->taps[p * width + width - 1 - k] = h[k * up + p] / sum;
+  }
+
+  dec->delay = (n * up - 1) / (2.0 * up);
+
+  free (h);
+  return dec;
+
+design_failed:
+  free (h);
+
+h_failed:
+  free (dec->taps);
+
+taps_failed:
+  free (dec);
+
+malloc_failed:
+invalid:
+  error_prefix (err, "decimate_new");
+  return NULL;
+}
+
+void
+decimate_free (decimate_t *const dec)
+{
+  free (dec->taps);
+  dec->taps = (float *)POISON;
+  free (dec);
+}
+
+void
+decimate_block ( decimate_t *const dec, const sample_block_t *const in
+               , sample_block_t *const out )
+{
+#if defined SIMD_NEON
+  run (dec, in, out, dot_neon);
+#elif defined SIMD_SSE2
+  run (dec, in, out, simd_have_avx2 () ? dot_avx2 : dot_sse2);
+#else
+  run (dec, in, out, dot_scalar);
+#endif
+}
+
+size_t
+decimate_records ( decimate_t *const dec, const decimate_source_t source
+                 , const acquisition_record_t *const records
+                 , const size_t count, sample_block_t *const out )
+{
+  sample_block_t in;
+  in.count = 0;
+  in.overrun = false;
+  in.time = dec->last;
+  in.period = NS_PER_S / (source == DECIMATE_GYRO ? L3GD20_RATE
+                                                  : LSM303DLHC_ACC_RATE);
+
+  size_t i;
+  for (i = 0; i < count && in.count < SAMPLE_BLOCK_SIZE; ++i) {
+    const i2c_sensors_result_t *const res = &records[i].res;
+    bool have;
+    int64_t time;
+    double x, y, z;
+    if (source == DECIMATE_GYRO) {
+      have = res->gyro.have_result;
+      time = res->gyro.time;
+      x = res->gyro.x;
+      y = res->gyro.y;
+      z = res->gyro.z;
+    } else {
+      have = res->acc.have_result;
+      time = res->acc.time;
+      x = res->acc.x;
+      y = res->acc.y;
+      z = res->acc.z;
+    }
+    if (! have)
+      continue;
+
+    /* A sample missed: this block ends before it, the next one with it */
+    if (dec->last && time - dec->last > in.period * 3 / 2) {
+      if (in.count)
+        break;
+      in.overrun = true;
+    }
+
+    in.x[in.count] = x;
+    in.y[in.count] = y;
+    in.z[in.count] = z;
+    ++in.count;
+    in.time = dec->last = time;
+  }
+
+  decimate_block (dec, &in, out);
+  return i;
+}
+
+void
+decimate_block_scalar ( decimate_t *const dec, const sample_block_t *const in
+                      , sample_block_t *const out )
+{
+  run (dec, in, out, dot_scalar);
+}
+
+void
+decimate_delay ( const decimate_t *const dec, const int64_t period
+               , int64_t *const group_delay, int64_t *const latency )
+{
+  *group_delay = llround (dec->delay * period);
+  *latency = period * dec->config.down / dec->config.up;
+}
+
+const char *
+decimate_impl (void)
+{
+  return simd_impl ();
+}
+
+/* The prototype filter into h, n taps per phase */
+static bool
+design ( decimate_t *const dec, double *const h, const size_t n
+       , error_t *const err )
+{
+  const decimate_config_t *const config = &dec->config;
+
+  if (config->kind == DECIMATE_CIC) {
+    /* A moving sum of down, convolved with itself once per stage */
+    size_t length = 1;
+    h[0] = 1;
+    for (unsigned stage = 0; stage < config->taps; ++stage) {
+      for (size_t k = length + config->down - 1; k-- > 0; ) {
+        double sum = 0;
+        for (size_t j = 0; j < config->down; ++j)
+          if (k >= j && k - j < length)
+            sum += h[k - j];
+        h[k] = sum;
+      }
+      length += config->down - 1;
+    }
+    return true;
+  }
+
+  /* The cutoff in cycles per sample at up times the input rate */
+  const size_t length = n * config->up;
+  const double fc = config->cutoff / (2.0 * config->down)
+             , middle = (length - 1) / 2.0;
+  for (size_t k = 0; k < length; ++k) {
+    double t = k - middle
+         , sinc = t == 0 ? 2 * fc : sin (2 * M_PI * fc * t) / (M_PI * t)
+         , w = length == 1 ? 1
+             : 0.42 - 0.5 * cos (2 * M_PI * k / (length - 1))
+               + 0.08 * cos (4 * M_PI * k / (length - 1));
+    h[k] = sinc * w;
+  }
+
+  /* A phase of a very short filter with a low cutoff can add up to
+   * nothing.
+   */
+  for (unsigned p = 0; p < config->up; ++p) {
+    double sum = 0;
+    for (size_t k = 0; k < n; ++k)
+      sum += h[k * config->up + p];
+    if (! (fabs (sum) > 1e-6)) {
+      error_printf (err, "Phase %u has no gain: too few taps", p);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void
+run ( decimate_t *const dec, const sample_block_t *const in
+    , sample_block_t *const out, const dot_t dot )
+{
+  const unsigned up = dec->config.up, down = dec->config.down;
+  const size_t width = dec->width;
+  const float *const src[3] = { in->x, in->y, in->z };
+  float *const dst[3] = { out->x, out->y, out->z };
+
+  out->count = 0;
+  out->overrun = in->overrun;
+  out->time = in->time;
+  out->period = in->period * down / up;
+
+  if (in->count == 0)
+    return;
+
+  /* As if the first sample had always been there, which it is as much as
+   * anything else
+   */
+  if (dec->held == 0) {
+    for (int axis = 0; axis < 3; ++axis)
+      for (size_t j = 0; j < width - 1; ++j)
+        dec->history[axis][j] = src[axis][0];
+    dec->held = width - 1;
+    dec->next = (uint64_t)dec->held * up;
+  }
+
+  const size_t before = dec->held;
+  for (int axis = 0; axis < 3; ++axis)
+    memcpy ( &dec->history[axis][before], src[axis]
+           , in->count * sizeof (float) );
+  dec->held += in->count;
+
+  size_t i = 0, p = 0;
+  while (dec->next / up < dec->held) {
+    i = dec->next / up;
+    p = dec->next % up;
+    for (int axis = 0; axis < 3; ++axis)
+      dst[axis][out->count] = dot ( &dec->taps[p * width]
+                                  , &dec->history[axis][i - (width - 1)]
+                                  , width );
+    ++out->count;
+    dec->next += down;
+  }
+
+  /* Between input samples i and i + 1 at p/up */
+  if (out->count)
+    out->time = in->time - (int64_t)(dec->held - 1 - i) * in->period
+              + (int64_t)p * in->period / up;
+
+  /* Keep the oldest any later output needs. */
+  const size_t drop = dec->held - (width - 1);
+  for (int axis = 0; axis < 3; ++axis)
+    memmove ( dec->history[axis], &dec->history[axis][drop]
+            , (width - 1) * sizeof (float) );
+  dec->held = width - 1;
+  dec->next -= (uint64_t)drop * up;
+}
+
+/* In eight lanes, j % 8, which get added up as the vector paths do. */
+static float
+dot_scalar (const float *const taps, const float *const x, const size_t n)
+{
+  float lane[8] = { 0 };
+  for (size_t j = 0; j < n; j += 8)
+    for (int l = 0; l < 8; ++l)
+      lane[l] += taps[j + l] * x[j + l];
+
+  float a = lane[0] + lane[4], b = lane[1] + lane[5]
+      , c = lane[2] + lane[6], d = lane[3] + lane[7];
+  return (a + c) + (b + d);
+}
+
+#ifdef SIMD_NEON
+static float
+dot_neon (const float *const taps, const float *const x, const size_t n)
+{
+  float32x4_t lo = vdupq_n_f32 (0), hi = vdupq_n_f32 (0);
+
+  /* Not vmlaq: keep the two roundings of the scalar path. */
+  for (size_t j = 0; j < n; j += 8) {
+    lo = vaddq_f32 (lo, vmulq_f32 (vld1q_f32 (&taps[j]), vld1q_f32 (&x[j])));
+    hi = vaddq_f32 ( hi, vmulq_f32 ( vld1q_f32 (&taps[j + 4])
+                                   , vld1q_f32 (&x[j + 4]) ));
+  }
+
+  float32x4_t t = vaddq_f32 (lo, hi);
+  float32x2_t u = vadd_f32 (vget_low_f32 (t), vget_high_f32 (t));
+  return vget_lane_f32 (u, 0) + vget_lane_f32 (u, 1);
+}
+#endif /* SIMD_NEON */
+
+#ifdef SIMD_SSE2
+/* Lanes 0 to 3 and 4 to 7 as the scalar path adds them up */
+static inline float
+sum_halves (const __m128 lo, const __m128 hi)
+{
+  __m128 t = _mm_add_ps (lo, hi)
+       , u = _mm_add_ps (t, _mm_movehl_ps (t, t));
+  return _mm_cvtss_f32 (_mm_add_ss (u, _mm_shuffle_ps (u, u, 1)));
+}
+
+static float
+dot_sse2 (const float *const taps, const float *const x, const size_t n)
+{
+  __m128 lo = _mm_setzero_ps (), hi = _mm_setzero_ps ();
+
+  for (size_t j = 0; j < n; j += 8) {
+    lo = _mm_add_ps ( lo, _mm_mul_ps ( _mm_load_ps (&taps[j])
+                                     , _mm_loadu_ps (&x[j]) ));
+    hi = _mm_add_ps ( hi, _mm_mul_ps ( _mm_load_ps (&taps[j + 4])
+                                     , _mm_loadu_ps (&x[j + 4]) ));
+  }
+
+  return sum_halves (lo, hi);
+}
+
+__attribute__ ((target ("avx2")))
+static float
+dot_avx2 (const float *const taps, const float *const x, const size_t n)
+{
+  __m256 s = _mm256_setzero_ps ();
+
+  for (size_t j = 0; j < n; j += 8)
+    s = _mm256_add_ps ( s, _mm256_mul_ps ( _mm256_load_ps (&taps[j])
+                                         , _mm256_loadu_ps (&x[j]) ));
+
+  __m128 lo = _mm256_castps256_ps128 (s), hi = _mm256_extractf128_ps (s, 1);
+
+  simd_avx2_leave ();
+  return sum_halves (lo, hi);
+}
+#endif /* SIMD_SSE2 */
@@ -0,0 +1,99 @@
+/* Anti-alias filtering and decimation of x, y, z sample blocks
+ *
+ * Brings a stream down from the output data rate of a sensor to the rate of
+ * whatever consumes it by up/down, e.g. 25/168 from the accelerometer's
+ * 1344 Hz or 5/19 from the gyro's 760 Hz to 200 Hz, with a polyphase FIR
+ * filter that only computes the samples it keeps. Dropping samples instead
+ * would fold the propellers' vibration down into the band of the control
+ * loop.
+ *
+ * The filter is a Blackman-windowed sinc of taps per phase at the input
+ * rate, or, for whole factors (up 1), the response of a CIC decimator of
+ * taps stages: nothing to tune, and nulls right on what would alias onto
+ * DC. The dot products use NEON on ARM, AVX2 (when the CPU has it) or SSE2
+ * on x86 and plain C elsewhere, summing in eight lanes in the same order,
+ * so every path gives exactly what decimate_block_scalar does (but for
+ * ARMv7 NEON flushing denormals, as in convert.h).
+ */
+
+#ifndef INCLUDE_DECIMATE_H
+#define INCLUDE_DECIMATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "acquisition.h"
+#include "error-utilities.h"
+#include "sample.h"
+
+/* Taps per phase, rounded up to a multiple of eight */
+#define DECIMATE_MAX_TAPS 512
+
+typedef struct decimate decimate_t;
+
+typedef enum {
+  DECIMATE_FIR,
+  DECIMATE_CIC
+} decimate_kind_t;
+
+/* The results of acquisition records that decimate_records takes */
+typedef enum {
+  DECIMATE_GYRO,
+  DECIMATE_ACC
+} decimate_source_t;
+
+typedef struct {
+  decimate_kind_t kind;
+  unsigned up, down;  /* Output rate = input rate * up / down, up <= down */
+  unsigned taps;      /* FIR: taps per phase; CIC: stages */
+  double cutoff;      /* FIR: -6 dB point over the output Nyquist rate */
+} decimate_config_t;
+
+decimate_t *
+decimate_new (const decimate_config_t *const config, error_t *const err);
+
+void
+decimate_free (decimate_t *const dec);
+
+/* Filter the samples of in and put those kept into out, with out->period
+ * the output period and out->time that of the newest one (which lies
+ * between input samples unless up is 1); out->count may be 0. The stage
+ * starts as if the first sample had always been there, and carries on
+ * across an overrun, which it passes on.
+ */
+void
+decimate_block ( decimate_t *const dec, const sample_block_t *const in
+               , sample_block_t *const out );
+
+/* decimate_block for the source results among records[0..count-1], at the
+ * sensor's output data rate. Takes records until SAMPLE_BLOCK_SIZE samples
+ * have been gathered, or until one comes more than half a period late,
+ * which starts the next call's block as an overrun. Returns how many
+ * records it took; call again with the rest until they are all taken.
+ */
+size_t
+decimate_records ( decimate_t *const dec, const decimate_source_t source
+                 , const acquisition_record_t *const records
+                 , const size_t count, sample_block_t *const out );
+
+/* The reference the vector paths are held to */
+void
+decimate_block_scalar ( decimate_t *const dec, const sample_block_t *const in
+                      , sample_block_t *const out );
+
+/* For an input period in ns: how far the output lags behind what went in,
+ * the same at every frequency as the filter is symmetric, which the time of
+ * an output sample does not include; and the longest that a change of the
+ * input then waits for the next output sample.
+ */
+void
+decimate_delay ( const decimate_t *const dec, const int64_t period
+               , int64_t *const group_delay, int64_t *const latency );
+
+/* Which implementation decimate_block uses: "neon", "avx2", "sse2" or
+ * "scalar".
+ */
+const char *
+decimate_impl (void);
+
+#endif /* INCLUDE_DECIMATE_H */
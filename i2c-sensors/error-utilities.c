@@ -1,7 +1,32 @@
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #include "error-utilities.h"
 
+/* What a printf conversion takes */
+typedef enum { ARG_NONE, ARG_SIGNED, ARG_UNSIGNED, ARG_CHAR, ARG_DOUBLE
+             , ARG_POINTER, ARG_UNSUPPORTED } arg_kind_t;
+
+typedef enum { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_Z, LEN_J, LEN_T }
+  arg_length_t;
+
+/* A conversion: format[1] up to format[head] are its flags, width and
+ * precision, and it ends before format[end].
+ */
+typedef struct {
+  size_t head, end;
+  arg_length_t length;
+  char conversion;
+  arg_kind_t kind;
+} spec_t;
+
+static void insert (error_t *const err, const char *const str, size_t len);
+static void parse_spec (const char *const format, spec_t *const spec);
+static error_arg_t fetch (const spec_t *const spec, va_list *const ap);
+static size_t format_trace ( const error_trace_t *const trace, char *const buf
+                           , const size_t size );
+
 error_t *
 error_new (void)
 {
@@ -9,8 +34,7 @@ error_new (void)
   if (! err)
     return NULL;
 
-  err->terminating_zero = '\0';
-  err->message = &err->terminating_zero;
+  error_init (err, false);
 
   return err;
 }
@@ -24,16 +48,315 @@ error_free (error_t *const err)
 void
 error_insertn (error_t *const err, const char *const str, size_t len)
 {
-  /* Copy chars from back to front. Stop whenever the start of either the error
-   * buffer or the string is reached.
+  if (err->compact) {
+    error_message (err);
+    err->compact = false;
+  }
+
+  if (err->code == ERROR_NONE)
+    err->code = ERROR_OTHER;
+
+  insert (err, str, len);
+}
+
+void
+error_vprintf (error_t *const err, const char *const format, va_list ap)
+{
+  if (err->compact && error_trace_vprintf (err, format, ap))
+    return;
+
+  /* Format into the free space in front of the message and move it up to
+   * the message, which takes a second buffer only when it does not fit.
    */
-  const char *strp = &str[len];
+  size_t room = err->message - err->buffer;
+  va_list aq;
+  va_copy (aq, ap);
+  int len = vsnprintf (err->buffer, room, format, aq);
+  va_end (aq);
+
+  if (len < 0)
+    return;
+
+  if ((size_t)len < room) {
+    if (err->code == ERROR_NONE)
+      err->code = ERROR_OTHER;
+
+    err->message -= len;
+    memmove (err->message, err->buffer, len);
+    return;
+  }
+
+  char buf[ERROR_SIZE];
+  len = vsnprintf (buf, ERROR_SIZE, format, ap);
+  error_insertn (err, buf, len);
+}
+
+bool
+error_trace_vprintf (error_t *const err, const char *const format, va_list ap)
+{
+  error_arg_t args[ERROR_ARGS];
+  unsigned n = 0;
+  bool kept = true;
+
+  va_list aq;
+  va_copy (aq, ap);
+  for (const char *p = format; (p = strchr (p, '%')); ) {
+    spec_t spec;
+    parse_spec (p, &spec);
+    p += spec.end;
+
+    if (spec.kind == ARG_NONE)
+      continue;
+    if (spec.kind == ARG_UNSUPPORTED || n == ERROR_ARGS) {
+      kept = false;
+      break;
+    }
+    args[n++] = fetch (&spec, &aq);
+  }
+  va_end (aq);
+
+  if (! kept) {
+    error_message (err);
+    err->compact = false;
+    return false;
+  }
+
+  unsigned i = err->trace_len;
+  error_trace (err, format);
+  if (i < ERROR_TRACE_SIZE) {
+    err->trace[i].format = true;
+    memcpy (err->trace[i].args, args, n * sizeof (error_arg_t));
+  }
+
+  return true;
+}
+
+const char *
+error_message (error_t *const err)
+{
+  if (! err->compact)
+    return err->message;
+
+  err->message = &err->terminating_zero;
+
+  if (err->code == ERROR_ERRNO) {
+    char buf[200];
+    int res = strerror_r (err->errnum, buf, 200);
+    (void)res;
+    insert (err, buf, strlen (buf));
+  }
 
-  for (; strp > str && err->message > err->buffer; --strp, --err->message)
-    err->message[-1] = strp[-1];
+  unsigned n = err->trace_len < ERROR_TRACE_SIZE ? err->trace_len
+                                                 : ERROR_TRACE_SIZE;
+  for (unsigned i = 0; i < n; ++i) {
+    if (*err->message != '\0')
+      insert (err, ": ", 2);
 
-  if (err->message == err->buffer && strp > str)
+    if (err->trace[i].format) {
+      char buf[ERROR_SIZE];
+      insert (err, buf, format_trace (&err->trace[i], buf, ERROR_SIZE));
+    } else {
+      insert (err, err->trace[i].str, strlen (err->trace[i].str));
+    }
+  }
+
+  if (err->trace_len > ERROR_TRACE_SIZE)
+    insert (err, "...: ", 5);
+
+  return err->message;
+}
+
+static void
+insert (error_t *const err, const char *const str, size_t len)
+{
+  /* Copy what fits of the end of str. */
+  size_t room = err->message - err->buffer;
+  size_t n = len < room ? len : room;
+
+  err->message -= n;
+  memcpy (err->message, &str[len - n], n);
+
+  if (n < len)
     /* str did not fit. Set the beginning of the message to "..." */
     for (int i = 0; i < 3 && err->buffer[i] != '\0'; ++i)
       err->buffer[i] = '.';
 }
+
+static void
+parse_spec (const char *const format, spec_t *const spec)
+{
+  size_t i = 1;
+
+  while (format[i] != '\0' && strchr ("-+ #0", format[i]))
+    ++i;
+  while (format[i] >= '0' && format[i] <= '9')
+    ++i;
+  if (format[i] == '.')
+    for (++i; format[i] >= '0' && format[i] <= '9'; ++i)
+      ;
+  spec->head = i;
+
+  spec->length = LEN_NONE;
+  bool long_double = false;
+  switch (format[i]) {
+  case 'h':
+    spec->length = format[i + 1] == 'h' ? LEN_HH : LEN_H;
+    break;
+  case 'l':
+    spec->length = format[i + 1] == 'l' ? LEN_LL : LEN_L;
+    break;
+  case 'z': spec->length = LEN_Z; break;
+  case 'j': spec->length = LEN_J; break;
+  case 't': spec->length = LEN_T; break;
+  case 'L': long_double = true; ++i; break;
+  }
+  if (spec->length == LEN_HH || spec->length == LEN_LL)
+    i += 2;
+  else if (spec->length != LEN_NONE)
+    ++i;
+
+  spec->conversion = format[i];
+  spec->end = format[i] == '\0' ? i : i + 1;
+
+  switch (spec->conversion) {
+  case '%':
+    spec->kind = ARG_NONE;
+    break;
+  case 'd': case 'i':
+    spec->kind = ARG_SIGNED;
+    break;
+  case 'u': case 'o': case 'x': case 'X':
+    spec->kind = ARG_UNSIGNED;
+    break;
+  case 'c':
+    spec->kind = spec->length == LEN_NONE ? ARG_CHAR : ARG_UNSUPPORTED;
+    break;
+  case 'f': case 'F': case 'e': case 'E':
+  case 'g': case 'G': case 'a': case 'A':
+    spec->kind = (spec->length == LEN_NONE || spec->length == LEN_L) &&
+                 ! long_double ? ARG_DOUBLE : ARG_UNSUPPORTED;
+    break;
+  case 'p':
+    spec->kind = spec->length == LEN_NONE ? ARG_POINTER : ARG_UNSUPPORTED;
+    break;
+  default:  /* %s, %n, a * width or precision, the end of the format */
+    spec->kind = ARG_UNSUPPORTED;
+    break;
+  }
+
+  if (long_double && spec->kind != ARG_NONE)
+    spec->kind = ARG_UNSUPPORTED;
+}
+
+/* The argument for spec, converted as printf would, to be printed with the
+ * ll length
+ */
+static error_arg_t
+fetch (const spec_t *const spec, va_list *const ap)
+{
+  error_arg_t arg;
+
+  switch (spec->kind) {
+  case ARG_SIGNED:
+    switch (spec->length) {
+    case LEN_HH: arg.i = (signed char)va_arg (*ap, int); break;
+    case LEN_H:  arg.i = (short)va_arg (*ap, int); break;
+    case LEN_L:  arg.i = va_arg (*ap, long); break;
+    case LEN_LL: arg.i = va_arg (*ap, long long); break;
+    case LEN_Z:  arg.i = va_arg (*ap, ssize_t); break;
+    case LEN_J:  arg.i = va_arg (*ap, intmax_t); break;
+    case LEN_T:  arg.i = va_arg (*ap, ptrdiff_t); break;
+    default:     arg.i = va_arg (*ap, int); break;
+    }
+    break;
+  case ARG_UNSIGNED:
+    switch (spec->length) {
+    case LEN_HH: arg.u = (unsigned char)va_arg (*ap, unsigned); break;
+    case LEN_H:  arg.u = (unsigned short)va_arg (*ap, unsigned); break;
+    case LEN_L:  arg.u = va_arg (*ap, unsigned long); break;
+    case LEN_LL: arg.u = va_arg (*ap, unsigned long long); break;
+    case LEN_Z:  arg.u = va_arg (*ap, size_t); break;
+    case LEN_J:  arg.u = va_arg (*ap, uintmax_t); break;
+    case LEN_T:  arg.u = (size_t)va_arg (*ap, ptrdiff_t); break;
+    default:     arg.u = va_arg (*ap, unsigned); break;
+    }
+    break;
+  case ARG_CHAR:
+    arg.i = va_arg (*ap, int);
+    break;
+  case ARG_DOUBLE:
+    arg.d = va_arg (*ap, double);
+    break;
+  default:
+    arg.p = va_arg (*ap, const void *);
+    break;
+  }
+
+  return arg;
+}
+
+/* trace's format with its arguments into buf, one conversion at a time.
+ * Returns the length, truncated to fit.
+ */
+static size_t
+format_trace ( const error_trace_t *const trace, char *const buf
+             , const size_t size )
+{
+  size_t len = 0;
+  unsigned n = 0;
+
+  for (const char *p = trace->str; *p != '\0' && len + 1 < size; ) {
+    const char *q = strchr (p, '%');
+    size_t literal = q ? (size_t)(q - p) : strlen (p);
+    if (literal > size - 1 - len)
+      literal = size - 1 - len;
+    memcpy (&buf[len], p, literal);
+    len += literal;
+    if (! q)
+      break;
+
+    spec_t spec;
+    parse_spec (q, &spec);
+    p = q + spec.end;
+
+    /* The conversion on its own, with the ll length for integers */
+    char conversion[32];
+    snprintf ( conversion, sizeof conversion, "%%%.*s%s%c"
+             , (int)spec.head - 1, &q[1]
+             , spec.kind == ARG_SIGNED || spec.kind == ARG_UNSIGNED ? "ll" : ""
+             , spec.conversion );
+
+    const error_arg_t *arg = &trace->args[n];
+    int w = 0;
+    switch (spec.kind) {
+    case ARG_NONE:
+      w = snprintf (&buf[len], size - len, "%%");
+      break;
+    case ARG_SIGNED:
+      w = snprintf (&buf[len], size - len, conversion, arg->i);
+      break;
+    case ARG_UNSIGNED:
+      w = snprintf (&buf[len], size - len, conversion, arg->u);
+      break;
+    case ARG_CHAR:
+      w = snprintf (&buf[len], size - len, conversion, (int)arg->i);
+      break;
+    case ARG_DOUBLE:
+      w = snprintf (&buf[len], size - len, conversion, arg->d);
+      break;
+    case ARG_POINTER:
+      w = snprintf (&buf[len], size - len, conversion, arg->p);
+      break;
+    default:  /* error_trace_vprintf took none of these */
+      break;
+    }
+    if (spec.kind != ARG_NONE)
+      ++n;
+
+    if (w > 0)
+      len += (size_t)w < size - len ? (size_t)w : size - 1 - len;
+  }
+
+  buf[len] = '\0';
+  return len;
+}
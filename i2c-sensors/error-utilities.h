@@ -3,25 +3,111 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
 #define ERROR_SIZE 1000
 
+#define ERROR_TRACE_SIZE 8
+
+/* printf arguments a compact error keeps per trace entry */
+#define ERROR_ARGS 4
+
+typedef enum {
+  ERROR_NONE,   /* Nothing has been recorded */
+  ERROR_ERRNO,  /* errnum says what failed */
+  ERROR_OTHER   /* Only the message does */
+} error_code_t;
+
 /* The message cursor points to the last byte (which must be initialized as
  * '\0') and is moved toward the start as functions insert strings to the
  * error. This way truncation will happen to the least important information.
+ *
+ * A compact error builds no text: error_strerror and error_errno only note
+ * the errno, and error_prefix and the printf functions only note their
+ * string, which therefore has to be static, along with up to ERROR_ARGS
+ * integer, floating-point or pointer arguments. error_message puts the
+ * message together from that when asked. A %s argument, which may not
+ * outlive the call, or any other insertion does so right away, and the
+ * error stops being compact.
  */
+typedef union {
+  long long i;
+  unsigned long long u;
+  double d;
+  const void *p;
+} error_arg_t;
+
 typedef struct {
+  const char *str;
+  bool format;  /* str is a printf format for args */
+  error_arg_t args[ERROR_ARGS];
+} error_trace_t;
+
+typedef struct {
+  error_code_t code;
+  int errnum;
+  bool compact;
+  unsigned trace_len;  /* Past ERROR_TRACE_SIZE, the outermost are lost */
+  error_trace_t trace[ERROR_TRACE_SIZE];  /* Innermost first */
+  char *message;
   char buffer[ERROR_SIZE-1];
   char terminating_zero;
-  char *message;
 } error_t;
 
 /* Use when you want the error object on the stack. */
 #define ERROR_DECLARE(name) \
-  error_t name = { "", '\0', &name.terminating_zero }
+  error_t name = { .message = &name.terminating_zero }
+
+/* The same for a compact error, without clearing the buffer. A statement of
+ * its own, not an initializer.
+ */
+#define ERROR_DECLARE_COMPACT(name) \
+  error_t name;                     \
+  error_init (&name, true)
+
+static inline void
+error_init (error_t *const err, const bool compact)
+{
+  err->code = ERROR_NONE;
+  err->errnum = 0;
+  err->compact = compact;
+  err->trace_len = 0;
+  err->terminating_zero = '\0';
+  err->message = &err->terminating_zero;
+}
+
+/* Forget what was recorded, to use err again. */
+static inline void
+error_clear (error_t *const err)
+{
+  error_init (err, err->compact);
+}
+
+/* The message, put together first if err is compact. */
+const char *
+error_message (error_t *const err);
+
+static inline void
+error_trace (error_t *const err, const char *const str)
+{
+  if (err->code == ERROR_NONE)
+    err->code = ERROR_OTHER;
+
+  if (err->trace_len < ERROR_TRACE_SIZE) {
+    err->trace[err->trace_len].str = str;
+    err->trace[err->trace_len].format = false;
+  }
+  ++err->trace_len;
+}
+
+/* For a compact err: trace format with its arguments. Returns false, with
+ * err no longer compact and ap untouched, when they cannot be kept.
+ */
+bool
+error_trace_vprintf (error_t *const err, const char *const format, va_list ap);
 
 /* Use when you want the error object in the heap. */
 error_t *
@@ -39,13 +125,8 @@ error_insert (error_t *const err, const char *const str)
   error_insertn (err, str, strlen (str));
 }
 
-static inline void
-error_vprintf (error_t *const err, const char *const format, va_list ap)
-{
-  char buf[ERROR_SIZE];
-  int len = vsnprintf (buf, ERROR_SIZE, format, ap);
-  error_insertn (err, buf, len);
-}
+void
+error_vprintf (error_t *const err, const char *const format, va_list ap);
 
 static inline void
 error_printf (error_t *const err, const char *const format, ...)
@@ -63,6 +144,11 @@ error_printf (error_t *const err, const char *const format, ...)
 static inline void
 error_prefix (error_t *const err, const char *const prefix)
 {
+  if (err->compact) {
+    error_trace (err, prefix);
+    return;
+  }
+
   error_insertn (err, ": ", 2);
   error_insert (err, prefix);
 }
@@ -74,17 +160,23 @@ error_prefix_printf (error_t *const err, const char *const format, ...)
 static inline void
 error_prefix_printf (error_t *const err, const char *const format, ...)
 {
-  error_insertn (err, ": ", 2);
-
   va_list ap;
   va_start (ap, format);
-  error_vprintf (err, format, ap);
+  if (! (err->compact && error_trace_vprintf (err, format, ap))) {
+    error_insertn (err, ": ", 2);
+    error_vprintf (err, format, ap);
+  }
   va_end (ap);
 }
 
 static inline void
 error_strerror (error_t *const err, int errnum)
 {
+  err->code = ERROR_ERRNO;
+  err->errnum = errnum;
+  if (err->compact)
+    return;
+
   char buf[200];
 
   /* Assign to an int to make sure we have the XSI-compliant strerror_r. */
@@ -0,0 +1,96 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "file-utilities.h"
+
+bool
+file_load ( const char *const path, void *const buf, const size_t size
+          , size_t *const len, error_t *const err )
+{
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "open %s failed", path);
+    goto error;
+  }
+
+  ssize_t n = read (fd, buf, size);
+  if (n < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "read %s failed", path);
+    close (fd);
+    goto error;
+  }
+  close (fd);
+
+  *len = n;
+  return true;
+
+error:
+  error_prefix (err, "file_load");
+  return false;
+}
+
+bool
+file_save_atomic ( const char *const path, const void *const buf
+                 , const size_t size, error_t *const err )
+{
+  char *tmp = malloc (strlen (path) + sizeof (".tmp"));
+  if (! tmp) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto malloc_failed;
+  }
+  sprintf (tmp, "%s.tmp", path);
+
+  int fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "open %s failed", tmp);
+    goto open_failed;
+  }
+
+  /* On disk before it takes the old one's place */
+  ssize_t n = write (fd, buf, size);
+  if (n < 0 || (size_t)n != size || fsync (fd) < 0) {
+    if (n >= 0 && (size_t)n != size)
+      error_printf (err, "short write");
+    else
+      error_errno (err);
+    error_prefix_printf (err, "write %s failed", tmp);
+    goto write_failed;
+  }
+
+  if (close (fd) < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "close %s failed", tmp);
+    goto close_failed;
+  }
+
+  if (rename (tmp, path) < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "rename to %s failed", path);
+    goto close_failed;
+  }
+
+  free (tmp);
+  return true;
+
+write_failed:
+  close (fd);
+
+close_failed:
+  unlink (tmp);
+
+open_failed:
+  free (tmp);
+
+malloc_failed:
+  error_prefix (err, "file_save_atomic");
+  return false;
+}
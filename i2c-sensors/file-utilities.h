@@ -0,0 +1,24 @@
+/* Small binary files, such as what the calibrations save */
+
+#ifndef INCLUDE_FILE_UTILITIES_H
+#define INCLUDE_FILE_UTILITIES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "error-utilities.h"
+
+/* Read up to size bytes of path into buf; len gets how many there were. */
+bool
+file_load ( const char *const path, void *const buf, const size_t size
+          , size_t *const len, error_t *const err );
+
+/* Replace path with the size bytes at buf. They go to path.tmp first, which
+ * is synced and renamed over path, so that path is either the old file or
+ * the new one whenever the power goes.
+ */
+bool
+file_save_atomic ( const char *const path, const void *const buf
+                 , const size_t size, error_t *const err );
+
+#endif /* INCLUDE_FILE_UTILITIES_H */
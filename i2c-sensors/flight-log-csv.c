@@ -0,0 +1,79 @@
+/* Convert a binary flight log to CSV on stdout */
+
+#include <stdio.h>
+
+#include "bmp085.h"
+#include "error-utilities.h"
+#include "flight-log.h"
+#include "time-utilities.h"
+
+static const char *const sensor_names[] =
+  { [FLIGHT_LOG_BARO] = "baro", [FLIGHT_LOG_GYRO] = "gyro"
+  , [FLIGHT_LOG_ACC]  = "acc",  [FLIGHT_LOG_MAG]  = "mag" };
+
+int
+main (int argc, char **argv)
+{
+  ERROR_DECLARE (err);
+
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s LOG\n", argv[0]);
+    return 2;
+  }
+
+  flight_log_reader_t *reader = flight_log_open (argv[1], &err);
+  if (! reader)
+    goto error;
+
+  const flight_log_header_t *header = flight_log_header (reader);
+  size_t count;
+  const flight_log_record_t *records = flight_log_records (reader, &count);
+
+  bmp085_comp_t comp;
+  bmp085_comp_init (&comp, &header->bmp085_calib, header->bmp085_oss);
+
+  /* Seconds since the log was created; °C, Pa, radian/s, m/s², T */
+  printf ("time,sensor,sequence,temperature,pressure,x,y,z\n");
+
+  for (size_t i = 0; i < count; ++i) {
+    const flight_log_record_t *r = &records[i];
+    double time = (r->time - header->started) / (double)NS_PER_S;
+    double scale[3];
+
+    switch (r->sensor) {
+    case FLIGHT_LOG_BARO: {
+      bmp085_result_t res;
+      bmp085_compensate (&comp, r->data[0], r->data[1], &res);
+      printf ( "%.6f,%s,%u,%.1f,%.0f,,,\n", time, sensor_names[r->sensor]
+             , r->sequence, res.temperature, res.pressure );
+      continue;
+    }
+    case FLIGHT_LOG_GYRO:
+      scale[0] = scale[1] = scale[2] = header->gyro_scale;
+      break;
+    case FLIGHT_LOG_ACC:
+      scale[0] = scale[1] = scale[2] = header->acc_scale;
+      break;
+    case FLIGHT_LOG_MAG:
+      scale[0] = scale[1] = header->mag_scale_xy;
+      scale[2] = header->mag_scale_z;
+      break;
+    default:
+      fprintf (stderr, "%s: record %zu: unknown sensor %u\n", argv[0], i
+              , r->sensor);
+      continue;
+    }
+
+    printf ( "%.6f,%s,%u,,,%.6g,%.6g,%.6g\n", time, sensor_names[r->sensor]
+           , r->sequence, r->data[0]*scale[0], r->data[1]*scale[1]
+           , r->data[2]*scale[2] );
+  }
+
+  flight_log_reader_free (reader);
+
+  return 0;
+
+error:
+  fprintf (stderr, "%s: %s\n", argv[0], error_message (&err));
+  return 1;
+}
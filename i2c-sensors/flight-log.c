@@ -0,0 +1,378 @@
+/* Binary flight log */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "flight-log.h"
+
+#include "bmp085.h"
+#include "common.h"
+#include "error-utilities.h"
+#include "i2c-sensors.h"
+#include "l3gd20.h"
+#include "lsm303dlhc-acc.h"
+#include "lsm303dlhc-mag.h"
+#include "time-utilities.h"
+
+/* Preallocated and mapped at a time; a multiple of the page size and of
+ * FLIGHT_LOG_RECORD_SIZE, so records never straddle two chunks.
+ */
+#define CHUNK_SIZE (4 << 20)
+
+#define N_SENSORS 4
+
+struct flight_log {
+  int fd;
+  flight_log_header_t *header;  /* Mapped by itself for as long as we live */
+  uint8_t *chunk;               /* The chunk being written */
+  off_t chunk_offset;           /* Where chunk is in the file */
+  size_t used;                  /* Bytes of chunk taken */
+  uint64_t count;
+  uint32_t sequences[N_SENSORS];
+  int64_t synced;               /* Record time of the last sync */
+};
+
+struct flight_log_reader {
+  int fd;
+  void *map;
+  size_t size;
+  size_t count;
+};
+
+static bool map_chunk (flight_log_t *const log, error_t *const err);
+
+flight_log_t *
+flight_log_new ( const char *const path, const bmp085_calib_t *const calib
+               , const int16_t oss, error_t *const err )
+{
+  flight_log_t *log = malloc (sizeof (flight_log_t));
+  if (! log) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto malloc_failed;
+  }
+
+  log->chunk_offset = 0;
+  log->count = 0;
+  memset (log->sequences, 0, sizeof (log->sequences));
+
+  if ((log->fd = open (path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+      < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "open %s failed", path);
+    goto open_failed;
+  }
+
+  if (! map_chunk (log, err))
+    goto map_chunk_failed;
+
+  log->header = mmap ( NULL, FLIGHT_LOG_HEADER_SIZE, PROT_READ | PROT_WRITE
+                     , MAP_SHARED, log->fd, 0 );
+  if (log->header == MAP_FAILED) {
+    error_errno (err);
+    error_prefix (err, "mmap header failed");
+    goto mmap_header_failed;
+  }
+
+  flight_log_header_t *header = log->header;
+  memset (header, 0, FLIGHT_LOG_HEADER_SIZE);
+  memcpy (header->magic, FLIGHT_LOG_MAGIC, sizeof (FLIGHT_LOG_MAGIC));
+  header->version      = FLIGHT_LOG_VERSION;
+  header->header_size  = FLIGHT_LOG_HEADER_SIZE;
+  header->record_size  = FLIGHT_LOG_RECORD_SIZE;
+  header->bmp085_oss   = oss;
+  header->bmp085_calib = *calib;
+  header->gyro_scale   = L3GD20_SCALE;
+  header->acc_scale    = LSM303DLHC_ACC_SCALE;
+  header->mag_scale_xy = LSM303DLHC_MAG_SCALE_XY;
+  header->mag_scale_z  = LSM303DLHC_MAG_SCALE_Z;
+  header->started      = log->synced = time_monotonic ();
+
+  log->used = FLIGHT_LOG_HEADER_SIZE;
+
+  return log;
+
+mmap_header_failed:
+  munmap (log->chunk, CHUNK_SIZE);
+
+map_chunk_failed:
+  close (log->fd);
+  unlink (path);
+
+open_failed:
+  free (log);
+
+malloc_failed:
+  error_prefix (err, "flight_log_new");
+  return NULL;
+}
+
+bool
+flight_log_close (flight_log_t *const log, error_t *const err)
+{
+  bool ok = true;
+
+  log->header->count = log->count;
+  if (msync (log->chunk, log->used, MS_SYNC) < 0 ||
+      msync (log->header, FLIGHT_LOG_HEADER_SIZE, MS_SYNC) < 0) {
+    error_errno (err);
+    error_prefix (err, "msync failed");
+    ok = false;
+  }
+
+  munmap (log->chunk, CHUNK_SIZE);
+  munmap (log->header, FLIGHT_LOG_HEADER_SIZE);
+
+  /* Drop the preallocated tail. */
+  off_t size = FLIGHT_LOG_HEADER_SIZE + log->count * FLIGHT_LOG_RECORD_SIZE;
+  if (ok && ftruncate (log->fd, size) < 0) {
+    error_errno (err);
+    error_prefix (err, "ftruncate failed");
+    ok = false;
+  }
+
+  if (close (log->fd) < 0 && ok) {
+    error_errno (err);
+    error_prefix (err, "close failed");
+    ok = false;
+  }
+
+  log->fd = POISON;
+  log->chunk = (uint8_t *)POISON;
+  log->header = (flight_log_header_t *)POISON;
+  free (log);
+
+  if (! ok)
+    error_prefix (err, "flight_log_close");
+  return ok;
+}
+
+bool
+flight_log_write ( flight_log_t *const log
+                 , const i2c_sensors_result_t *const res, error_t *const err )
+{
+  flight_log_record_t record = { .reserved0 = 0, .reserved = { 0 } };
+
+  if (res->baro.have_result) {
+    record.time = res->baro.time;
+    record.sensor = FLIGHT_LOG_BARO;
+    record.data[0] = res->baro.ut;
+    record.data[1] = res->baro.up;
+    record.data[2] = 0;
+    if (! flight_log_append (log, &record, err))
+      goto error;
+  }
+
+  const struct {
+    bool have_result;
+    int64_t time;
+    const int16_t *raw;
+  } xyz[] = { [FLIGHT_LOG_GYRO] = { res->gyro.have_result, res->gyro.time
+                                  , res->gyro.raw }
+            , [FLIGHT_LOG_ACC]  = { res->acc.have_result, res->acc.time
+                                  , res->acc.raw }
+            , [FLIGHT_LOG_MAG]  = { res->mag.have_result, res->mag.time
+                                  , res->mag.raw } };
+
+  for (int sensor = FLIGHT_LOG_GYRO; sensor <= FLIGHT_LOG_MAG; ++sensor) {
+    if (! xyz[sensor].have_result)
+      continue;
+
+    record.time = xyz[sensor].time;
+    record.sensor = sensor;
+    for (int i = 0; i < 3; ++i)
+      record.data[i] = xyz[sensor].raw[i];
+    if (! flight_log_append (log, &record, err))
+      goto error;
+  }
+
+  return true;
+
+error:
+  error_prefix (err, "flight_log_write");
+  return false;
+}
+
+bool
+flight_log_append ( flight_log_t *const log
+                  , const flight_log_record_t *const record
+                  , error_t *const err )
+{
+  if (log->used == CHUNK_SIZE) {
+    /* Let the full chunk go and move on to the next one. */
+    msync (log->chunk, CHUNK_SIZE, MS_ASYNC);
+    munmap (log->chunk, CHUNK_SIZE);
+    log->chunk_offset += CHUNK_SIZE;
+
+    if (! map_chunk (log, err))
+      goto error;
+  }
+
+  flight_log_record_t *r = (flight_log_record_t *)(log->chunk + log->used);
+  *r = *record;
+  if (record->sensor < N_SENSORS)
+    r->sequence = log->sequences[record->sensor]++;
+
+  log->used += FLIGHT_LOG_RECORD_SIZE;
+  ++log->count;
+
+  if (record->time - log->synced >= FLIGHT_LOG_SYNC_INTERVAL &&
+      ! flight_log_sync (log, err))
+    goto error;
+
+  return true;
+
+error:
+  error_prefix (err, "flight_log_append");
+  return false;
+}
+
+bool
+flight_log_sync (flight_log_t *const log, error_t *const err)
+{
+  log->header->count = log->count;
+
+  if (msync (log->chunk, log->used, MS_ASYNC) < 0 ||
+      msync (log->header, FLIGHT_LOG_HEADER_SIZE, MS_ASYNC) < 0) {
+    error_errno (err);
+    error_prefix (err, "flight_log_sync: msync failed");
+    return false;
+  }
+
+  log->synced = time_monotonic ();
+  return true;
+}
+
+flight_log_reader_t *
+flight_log_open (const char *const path, error_t *const err)
+{
+  flight_log_reader_t *reader = malloc (sizeof (flight_log_reader_t));
+  if (! reader) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto malloc_failed;
+  }
+
+  if ((reader->fd = open (path, O_RDONLY | O_CLOEXEC)) < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "open %s failed", path);
+    goto open_failed;
+  }
+
+  struct stat st;
+  if (fstat (reader->fd, &st) < 0) {
+    error_errno (err);
+    error_prefix (err, "fstat failed");
+    goto fstat_failed;
+  }
+
+  if (st.st_size < FLIGHT_LOG_HEADER_SIZE) {
+    error_printf (err, "%s: too short for a flight log", path);
+    goto fstat_failed;
+  }
+
+  reader->size = st.st_size;
+  reader->map = mmap (NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+  if (reader->map == MAP_FAILED) {
+    error_errno (err);
+    error_prefix (err, "mmap failed");
+    goto fstat_failed;
+  }
+
+  const flight_log_header_t *header = reader->map;
+  if (memcmp (header->magic, FLIGHT_LOG_MAGIC, sizeof (FLIGHT_LOG_MAGIC))) {
+    error_printf (err, "%s: not a flight log", path);
+    goto header_failed;
+  }
+
+  if (header->version != FLIGHT_LOG_VERSION ||
+      header->header_size != FLIGHT_LOG_HEADER_SIZE ||
+      header->record_size != FLIGHT_LOG_RECORD_SIZE) {
+    error_printf (err, "%s: unsupported flight log version %u", path
+                 , header->version);
+    goto header_failed;
+  }
+
+  /* The preallocated tail of a log that was never closed is zeros. */
+  const flight_log_record_t *records = flight_log_records (reader, NULL);
+  size_t room = (reader->size - FLIGHT_LOG_HEADER_SIZE) /
+                FLIGHT_LOG_RECORD_SIZE;
+  size_t count = header->count < room ? header->count : room;
+  while (count < room && records[count].time != 0)
+    ++count;
+  reader->count = count;
+
+  return reader;
+
+header_failed:
+  munmap (reader->map, reader->size);
+
+fstat_failed:
+  close (reader->fd);
+
+open_failed:
+  free (reader);
+
+malloc_failed:
+  error_prefix (err, "flight_log_open");
+  return NULL;
+}
+
+void
+flight_log_reader_free (flight_log_reader_t *const reader)
+{
+  munmap (reader->map, reader->size);
+  reader->map = (void *)POISON;
+
+  close (reader->fd);
+  reader->fd = POISON;
+
+  free (reader);
+}
+
+const flight_log_header_t *
+flight_log_header (const flight_log_reader_t *const reader)
+{
+  return reader->map;
+}
+
+const flight_log_record_t *
+flight_log_records ( const flight_log_reader_t *const reader
+                   , size_t *const count )
+{
+  if (count)
+    *count = reader->count;
+
+  return (const flight_log_record_t *)
+           ((const uint8_t *)reader->map + FLIGHT_LOG_HEADER_SIZE);
+}
+
+/* Preallocate the chunk at chunk_offset and map it. */
+static bool
+map_chunk (flight_log_t *const log, error_t *const err)
+{
+  int errnum;
+  if ((errnum = posix_fallocate (log->fd, log->chunk_offset, CHUNK_SIZE))) {
+    error_strerror (err, errnum);
+    error_prefix (err, "map_chunk: posix_fallocate failed");
+    return false;
+  }
+
+  log->chunk = mmap ( NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED
+                    , log->fd, log->chunk_offset );
+  if (log->chunk == MAP_FAILED) {
+    error_errno (err);
+    error_prefix (err, "map_chunk: mmap failed");
+    return false;
+  }
+
+  log->used = 0;
+  return true;
+}
@@ -0,0 +1,111 @@
+/* Binary flight log
+ *
+ * A FLIGHT_LOG_HEADER_SIZE byte header followed by FLIGHT_LOG_RECORD_SIZE byte
+ * records, one per sensor sample, in host byte order (little-endian on the
+ * BeagleBone). Records hold the raw readings; the header has what it takes to
+ * turn them into units.
+ */
+
+#ifndef INCLUDE_FLIGHT_LOG_H
+#define INCLUDE_FLIGHT_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bmp085.h"
+#include "error-utilities.h"
+#include "i2c-sensors.h"
+
+#define FLIGHT_LOG_MAGIC   "I2CSLOG"  /* With its '\0', 8 bytes */
+#define FLIGHT_LOG_VERSION 1
+
+#define FLIGHT_LOG_HEADER_SIZE 128
+#define FLIGHT_LOG_RECORD_SIZE 32
+
+#define FLIGHT_LOG_SYNC_INTERVAL 1000000000  /* ns */
+
+typedef enum { FLIGHT_LOG_BARO, FLIGHT_LOG_GYRO, FLIGHT_LOG_ACC
+             , FLIGHT_LOG_MAG } flight_log_sensor_t;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t record_size;
+  int32_t bmp085_oss;
+  bmp085_calib_t bmp085_calib;
+  uint8_t reserved0[2];
+  double gyro_scale;    /* radian/s per LSB */
+  double acc_scale;     /* m/s² per LSB */
+  double mag_scale_xy;  /* T per LSB */
+  double mag_scale_z;
+  int64_t started;      /* CLOCK_MONOTONIC ns when the log was created */
+  uint64_t count;       /* Records; brought up to date on every sync */
+  uint8_t reserved[32];
+} flight_log_header_t;
+
+typedef struct {
+  int64_t time;       /* CLOCK_MONOTONIC ns */
+  uint16_t sensor;    /* flight_log_sensor_t */
+  uint16_t reserved0;
+  uint32_t sequence;  /* Per sensor; a gap means lost samples */
+  int32_t data[3];    /* BARO: UT, UP; the others: x, y, z */
+  uint8_t reserved[4];
+} flight_log_record_t;
+
+_Static_assert ( sizeof (flight_log_header_t) == FLIGHT_LOG_HEADER_SIZE
+               , "flight_log_header_t layout" );
+_Static_assert ( sizeof (flight_log_record_t) == FLIGHT_LOG_RECORD_SIZE
+               , "flight_log_record_t layout" );
+
+typedef struct flight_log flight_log_t;
+
+/* Create (or truncate) the log at path. The file grows in preallocated,
+ * memory-mapped chunks, so writing a record costs no system call except
+ * when a chunk fills up or a sync is due.
+ */
+flight_log_t *
+flight_log_new ( const char *const path, const bmp085_calib_t *const calib
+               , const int16_t oss, error_t *const err );
+
+/* Syncs, trims the file to its records and closes it. */
+bool
+flight_log_close (flight_log_t *const log, error_t *const err);
+
+/* A record for every result in res. */
+bool
+flight_log_write ( flight_log_t *const log
+                 , const i2c_sensors_result_t *const res, error_t *const err );
+
+bool
+flight_log_append ( flight_log_t *const log
+                  , const flight_log_record_t *const record
+                  , error_t *const err );
+
+/* Write the header count and schedule the dirty pages for writeback. Done by
+ * itself every FLIGHT_LOG_SYNC_INTERVAL of record time.
+ */
+bool
+flight_log_sync (flight_log_t *const log, error_t *const err);
+
+/* Reading a log back: the whole file is mapped read-only. */
+typedef struct flight_log_reader flight_log_reader_t;
+
+/* Records past the header count that were written out before a crash are
+ * picked up too.
+ */
+flight_log_reader_t *
+flight_log_open (const char *const path, error_t *const err);
+
+void
+flight_log_reader_free (flight_log_reader_t *const reader);
+
+const flight_log_header_t *
+flight_log_header (const flight_log_reader_t *const reader);
+
+const flight_log_record_t *
+flight_log_records ( const flight_log_reader_t *const reader
+                   , size_t *const count );
+
+#endif /* INCLUDE_FLIGHT_LOG_H */
@@ -0,0 +1,205 @@
+/* Sysfs GPIO input lines */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gpio.h"
+
+#include "common.h"
+#include "error-utilities.h"
+
+struct gpio {
+  int fd;
+  short events;  /* POLLPRI for sysfs edges, POLLIN for a plain stream */
+};
+
+static bool set_edge ( const char *const edge_path, const gpio_edge_t edge
+                     , error_t *const err );
+
+gpio_t *
+gpio_new (const int number, const gpio_edge_t edge, error_t *const err)
+{
+  char value_path[100], edge_path[100];
+  if (snprintf (value_path, 100, GPIO_PATH, number) < 0 ||
+      snprintf (edge_path, 100, GPIO_EDGE_PATH, number) < 0) {
+    error_insert (err, "snprintf failed");
+    error_prefix (err, "gpio_new");
+    return NULL;
+  }
+
+  return gpio_new_path (value_path, edge_path, edge, err);
+}
+
+gpio_t *
+gpio_new_path ( const char *const value_path, const char *const edge_path
+              , const gpio_edge_t edge, error_t *const err )
+{
+  gpio_t *gpio = malloc (sizeof (gpio_t));
+  if (! gpio) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto malloc_failed;
+  }
+
+  gpio->events = edge_path ? POLLPRI : POLLIN;
+
+  /* GPIO_EDGE_NONE leaves the edge file as it is: plain reads need none,
+   * and the line may not have one at all.
+   */
+  if (edge_path && edge != GPIO_EDGE_NONE && ! set_edge (edge_path, edge, err))
+    goto set_edge_failed;
+
+  if ((gpio->fd = open (value_path, O_RDONLY | O_NONBLOCK)) < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "open %s failed", value_path);
+    goto open_failed;
+  }
+
+  /* The first poll on a sysfs value file reports a change unconditionally;
+   * reading the value consumes that.
+   */
+  bool value;
+  if (edge_path && ! gpio_read (gpio, &value, err))
+    goto read_failed;
+
+  return gpio;
+
+read_failed:
+  close (gpio->fd);
+
+open_failed:
+set_edge_failed:
+  free (gpio);
+
+malloc_failed:
+  error_prefix (err, "gpio_new_path");
+  return NULL;
+}
+
+void
+gpio_free (gpio_t *const gpio)
+{
+  close (gpio->fd);
+  gpio->fd = POISON;
+  free (gpio);
+}
+
+int
+gpio_fd (const gpio_t *const gpio)
+{
+  return gpio->fd;
+}
+
+short
+gpio_events (const gpio_t *const gpio)
+{
+  return gpio->events;
+}
+
+bool
+gpio_read (gpio_t *const gpio, bool *const value, error_t *const err)
+{
+  char buf[100];
+  ssize_t count;
+
+  /* A plain stream can not seek, and does not need to. */
+  if (lseek (gpio->fd, 0, SEEK_SET) == -1 && errno != ESPIPE) {
+    error_errno (err);
+    error_prefix (err, "seek failed");
+    goto error;
+  }
+
+  count = read (gpio->fd, buf, 100);
+  if (count == -1 && errno != EAGAIN) {
+    error_errno (err);
+    error_prefix (err, "read failed");
+    goto error;
+  }
+
+  *value = count >= 2 && buf[count-2] == '1' && buf[count-1] == '\n';
+  return true;
+
+error:
+  error_prefix (err, "gpio_read");
+  return false;
+}
+
+bool
+gpio_wait ( gpio_t *const gpio, const int timeout_ms, bool *const fired
+          , bool *const value, error_t *const err )
+{
+  struct pollfd pfd = { .fd = gpio->fd, .events = gpio->events };
+
+  *fired = false;
+
+  int n;
+  do {
+    n = poll (&pfd, 1, timeout_ms);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) {
+    error_errno (err);
+    error_prefix (err, "poll failed");
+    goto error;
+  }
+
+  if (n == 0)
+    return true;
+
+  if (! gpio_read (gpio, value, err))
+    goto error;
+
+  *fired = true;
+  return true;
+
+error:
+  error_prefix (err, "gpio_wait");
+  return false;
+}
+
+static bool
+set_edge ( const char *const edge_path, const gpio_edge_t edge
+         , error_t *const err )
+{
+  static const char *const names[] =
+    { [GPIO_EDGE_NONE] = "none\n", [GPIO_EDGE_RISING] = "rising\n"
+    , [GPIO_EDGE_FALLING] = "falling\n", [GPIO_EDGE_BOTH] = "both\n" };
+
+  /* Writing needs root, so leave an already configured line alone. */
+  char buf[20];
+  ssize_t count;
+  size_t len = strlen (names[edge]);
+  int fd = open (edge_path, O_RDONLY);
+  if (fd >= 0) {
+    count = read (fd, buf, 20);
+    close (fd);
+    if (count == (ssize_t)len && memcmp (buf, names[edge], len) == 0)
+      return true;
+  }
+
+  fd = open (edge_path, O_WRONLY);
+  if (fd < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "open %s failed", edge_path);
+    goto error;
+  }
+
+  if (write (fd, names[edge], len) != (ssize_t)len) {
+    error_errno (err);
+    error_prefix_printf (err, "write %s failed", edge_path);
+    close (fd);
+    goto error;
+  }
+
+  close (fd);
+  return true;
+
+error:
+  error_prefix (err, "set_edge");
+  return false;
+}
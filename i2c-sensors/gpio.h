@@ -0,0 +1,51 @@
+/* Sysfs GPIO input lines */
+
+#ifndef INCLUDE_GPIO_H
+#define INCLUDE_GPIO_H
+
+#include <stdbool.h>
+
+#include "error-utilities.h"
+
+typedef struct gpio gpio_t;
+
+typedef enum { GPIO_EDGE_NONE, GPIO_EDGE_RISING, GPIO_EDGE_FALLING
+             , GPIO_EDGE_BOTH } gpio_edge_t;
+
+/* Open /sys/class/gpio/gpioN/value. Unless edge is GPIO_EDGE_NONE, the edge
+ * file gets configured so that the fd signals POLLPRI on that edge; with
+ * GPIO_EDGE_NONE it is not written at all.
+ */
+gpio_t *
+gpio_new (const int number, const gpio_edge_t edge, error_t *const err);
+
+/* Open an arbitrary value file, e.g. of a gpio-mockup line, configuring
+ * edge_path as gpio_new does. With edge_path NULL the fd is taken to be a
+ * plain stream (a pipe in a test, say) that becomes readable whenever the
+ * line has changed.
+ */
+gpio_t *
+gpio_new_path ( const char *const value_path, const char *const edge_path
+              , const gpio_edge_t edge, error_t *const err );
+
+void
+gpio_free (gpio_t *const gpio);
+
+/* For poll/epoll; see gpio_events for what to wait for. */
+int
+gpio_fd (const gpio_t *const gpio);
+
+short
+gpio_events (const gpio_t *const gpio);
+
+bool
+gpio_read (gpio_t *const gpio, bool *const value, error_t *const err);
+
+/* Wait up to timeout_ms (-1: forever) for the configured edge. On an edge the
+ * value gets read, which also re-arms the sysfs notification.
+ */
+bool
+gpio_wait ( gpio_t *const gpio, const int timeout_ms, bool *const fired
+          , bool *const value, error_t *const err );
+
+#endif /* INCLUDE_GPIO_H */
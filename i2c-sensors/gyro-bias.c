@@ -0,0 +1,207 @@
+/* Gyro bias, learnt while the craft holds still */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gyro-bias.h"
+
+#include "error-utilities.h"
+#include "file-utilities.h"
+
+#define MAGIC "gyrobs1"
+
+/* What gyro_bias_save writes, in the machine's own byte order */
+typedef struct {
+  char magic[8];
+  struct {
+    double bias[3];
+    uint64_t n;
+  } cells[GYRO_BIAS_TEMPS];
+} saved_t;
+
+static void track ( double *const mean, double *const var, bool *const have
+                  , const double alpha, const double *const x );
+static int lookup ( const gyro_bias_t *const gb, const int temp
+                  , double *const bias );
+static inline int cell_index (const int temp);
+
+void
+gyro_bias_init ( gyro_bias_t *const gb, const double gyro_rate
+               , const double acc_rate )
+{
+  memset (gb, 0, sizeof (gyro_bias_t));
+  gb->gyro_rate = gyro_rate;
+  gb->acc_rate = acc_rate;
+}
+
+void
+gyro_bias_gyro (gyro_bias_t *const gb, const int temp, const double *const w)
+{
+  track ( gb->gyro_mean, &gb->gyro_var, &gb->have_gyro
+        , 1.0 / (GYRO_BIAS_WINDOW * gb->gyro_rate), w );
+
+  const double gyro_quiet = 3 * GYRO_BIAS_GYRO_QUIET * GYRO_BIAS_GYRO_QUIET
+             , acc_quiet  = 3 * GYRO_BIAS_ACC_QUIET * GYRO_BIAS_ACC_QUIET;
+  if (! (gb->gyro_var < gyro_quiet && gb->acc_var < acc_quiet)) {
+    gb->quiet = 0;
+    return;
+  }
+
+  if (++gb->quiet < GYRO_BIAS_SETTLE * gb->gyro_rate)
+    return;
+
+  gyro_bias_cell_t *const cell = &gb->cells[cell_index (temp)];
+
+  /* Only what has been learnt, or a cell that took the start of a turn
+   * would vouch for the rest of it
+   */
+  double known[3];
+  const int far = lookup (gb, temp, known);
+  if (far >= 0) {
+    const double step = GYRO_BIAS_STEP + sqrt (3) * GYRO_BIAS_DRIFT * far;
+    double d = 0;
+    for (int i = 0; i < 3; ++i)
+      d += (gb->gyro_mean[i] - known[i]) * (gb->gyro_mean[i] - known[i]);
+    if (d > step * step)
+      return;
+  }
+
+  const double memory = GYRO_BIAS_MEMORY * gb->gyro_rate
+             , k = 1.0 / fmin (cell->n + 1, memory);
+  for (int i = 0; i < 3; ++i)
+    cell->bias[i] += k * (w[i] - cell->bias[i]);
+  ++cell->n;
+}
+
+void
+gyro_bias_acc (gyro_bias_t *const gb, const double *const a)
+{
+  track ( gb->acc_mean, &gb->acc_var, &gb->have_acc
+        , 1.0 / (GYRO_BIAS_WINDOW * gb->acc_rate), a );
+}
+
+bool
+gyro_bias_get ( const gyro_bias_t *const gb, const int temp
+              , double *const bias )
+{
+  return lookup (gb, temp, bias) >= 0;
+}
+
+bool
+gyro_bias_load ( gyro_bias_t *const gb, const char *const path
+               , error_t *const err )
+{
+  saved_t saved;
+
+  size_t n;
+  if (! file_load (path, &saved, sizeof (saved), &n, err))
+    goto error;
+
+  if (n != sizeof (saved) || memcmp (saved.magic, MAGIC, sizeof (MAGIC))) {
+    error_printf (err, "%s: not a gyro bias table", path);
+    goto error;
+  }
+
+  for (int i = 0; i < GYRO_BIAS_TEMPS; ++i) {
+    memcpy (gb->cells[i].bias, saved.cells[i].bias, sizeof (double[3]));
+    gb->cells[i].n = saved.cells[i].n;
+  }
+
+  return true;
+
+error:
+  error_prefix (err, "gyro_bias_load");
+  return false;
+}
+
+bool
+gyro_bias_save ( const gyro_bias_t *const gb, const char *const path
+               , error_t *const err )
+{
+  saved_t saved;
+  memset (&saved, 0, sizeof (saved));
+  memcpy (saved.magic, MAGIC, sizeof (MAGIC));
+  for (int i = 0; i < GYRO_BIAS_TEMPS; ++i) {
+    memcpy (saved.cells[i].bias, gb->cells[i].bias, sizeof (double[3]));
+    saved.cells[i].n = gb->cells[i].n;
+  }
+
+  if (! file_save_atomic (path, &saved, sizeof (saved), err)) {
+    error_prefix (err, "gyro_bias_save");
+    return false;
+  }
+
+  return true;
+}
+
+/* Exponentially weighted mean and summed variance of x, started at the
+ * first sample
+ */
+static void
+track ( double *const mean, double *const var, bool *const have
+      , const double alpha, const double *const x )
+{
+  if (! *have) {
+    memcpy (mean, x, 3 * sizeof (double));
+    *var = 0;
+    *have = true;
+    return;
+  }
+
+  double d = 0;
+  for (int i = 0; i < 3; ++i) {
+    mean[i] += alpha * (x[i] - mean[i]);
+    d += (x[i] - mean[i]) * (x[i] - mean[i]);
+  }
+  *var += alpha * (d - *var);
+}
+
+/* gyro_bias_get, returning how many °C away the nearest cell learnt is, or
+ * -1 without any
+ */
+static int
+lookup (const gyro_bias_t *const gb, const int temp, double *const bias)
+{
+  const unsigned long learnt = GYRO_BIAS_LEARNT * gb->gyro_rate;
+  const int at = cell_index (temp);
+  int below = -1, above = -1;
+
+  for (int i = at; i >= 0; --i)
+    if (gb->cells[i].n >= learnt) {
+      below = i;
+      break;
+    }
+  for (int i = at; i < GYRO_BIAS_TEMPS; ++i)
+    if (gb->cells[i].n >= learnt) {
+      above = i;
+      break;
+    }
+
+  if (below < 0 && above < 0) {
+    bias[0] = bias[1] = bias[2] = 0;
+    return -1;
+  }
+
+  if (below < 0 || above == below) {
+    memcpy (bias, gb->cells[above].bias, 3 * sizeof (double));
+  } else if (above < 0) {
+    memcpy (bias, gb->cells[below].bias, 3 * sizeof (double));
+  } else {
+    const double f = (double)(at - below) / (above - below);
+    for (int i = 0; i < 3; ++i)
+      bias[i] = gb->cells[below].bias[i] +
+                f * (gb->cells[above].bias[i] - gb->cells[below].bias[i]);
+  }
+
+  return below < 0 ? above - at
+       : above < 0 ? at - below
+       : (at - below < above - at ? at - below : above - at);
+}
+
+static inline int
+cell_index (const int temp)
+{
+  return temp + GYRO_BIAS_TEMPS / 2;
+}
@@ -0,0 +1,104 @@
+/* Gyro bias, learnt while the craft holds still
+ *
+ * The L3GD20's zero-rate level is off by up to 25 °/s at full scale and
+ * moves by about 0.04 °/s per °C. While the gyro and the accelerometer have
+ * both been quiet for a while, the mean rate can only be the bias, and is
+ * taken into a table with a cell for every OUT_TEMP reading. A temperature
+ * not learnt yet gets the cells learnt on either side of it, interpolated,
+ * or the nearest one beyond them.
+ */
+
+#ifndef INCLUDE_GYRO_BIAS_H
+#define INCLUDE_GYRO_BIAS_H
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "error-utilities.h"
+
+/* OUT_TEMP is a signed byte, 1 °C per LSB from an unspecified zero. */
+#define GYRO_BIAS_TEMPS 256
+
+/* Time constant of the running means and variances */
+#define GYRO_BIAS_WINDOW 0.25  /* s */
+
+/* Quiet is below this RMS per axis around the running mean: a few LSB of
+ * either at the ranges the drivers set, far below running motors.
+ */
+#define GYRO_BIAS_GYRO_QUIET (1.0 * M_PI / 180.0)  /* radian/s */
+#define GYRO_BIAS_ACC_QUIET  0.5                   /* m/s² */
+
+/* Quiet for this long before the rate counts as bias */
+#define GYRO_BIAS_SETTLE 1.0  /* s */
+
+/* The most the bias moves per °C, per axis, by the datasheet */
+#define GYRO_BIAS_DRIFT (0.04 * M_PI / 180.0)  /* radian/s */
+
+/* Once there is a bias, a mean rate farther off it than this, plus what the
+ * drift could account for between the temperature and the nearest one
+ * learnt, is a slow, even turn (about gravity, so the accelerometer cannot
+ * tell) rather than bias.
+ */
+#define GYRO_BIAS_STEP (1.0 * M_PI / 180.0)  /* radian/s */
+
+/* A cell averages all it has been given up to this many seconds' worth, and
+ * forgets at that rate afterwards.
+ */
+#define GYRO_BIAS_MEMORY 10.0  /* s */
+
+/* Seconds' worth that make a cell count as learnt */
+#define GYRO_BIAS_LEARNT 1.0  /* s */
+
+typedef struct {
+  double bias[3];    /* radian/s */
+  unsigned long n;   /* Samples taken */
+} gyro_bias_cell_t;
+
+typedef struct {
+  double gyro_rate, acc_rate;       /* Hz */
+  bool have_gyro, have_acc;         /* The means have been started */
+  double gyro_mean[3], gyro_var;    /* Running, the variance summed */
+  double acc_mean[3], acc_var;      /* Likewise */
+  unsigned long quiet;              /* Gyro samples since it got quiet */
+  gyro_bias_cell_t cells[GYRO_BIAS_TEMPS];  /* By OUT_TEMP + 128 */
+} gyro_bias_t;
+
+/* Nothing learnt, for a gyro and an accelerometer at these output data
+ * rates
+ */
+void
+gyro_bias_init ( gyro_bias_t *const gb, const double gyro_rate
+               , const double acc_rate );
+
+/* Take a gyro sample (x, y, z in radian/s, bias included) at the OUT_TEMP
+ * reading temp.
+ */
+void
+gyro_bias_gyro (gyro_bias_t *const gb, const int temp, const double *const w);
+
+/* Take an accelerometer sample (x, y, z in m/s²). Without any, the gyro
+ * alone says when it is quiet.
+ */
+void
+gyro_bias_acc (gyro_bias_t *const gb, const double *const a);
+
+/* The bias at the OUT_TEMP reading temp, in radian/s. Returns false, with
+ * zeros, while nothing has been learnt.
+ */
+bool
+gyro_bias_get ( const gyro_bias_t *const gb, const int temp
+              , double *const bias );
+
+/* The table as gyro_bias_save left it; the rates and the detector stay.
+ * gb is left alone on failure.
+ */
+bool
+gyro_bias_load ( gyro_bias_t *const gb, const char *const path
+               , error_t *const err );
+
+/* Replaces path as a whole, through a temporary file next to it. */
+bool
+gyro_bias_save ( const gyro_bias_t *const gb, const char *const path
+               , error_t *const err );
+
+#endif /* INCLUDE_GYRO_BIAS_H */
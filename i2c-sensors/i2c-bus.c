@@ -0,0 +1,312 @@
+/* I2C bus shared by the sensor drivers */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "i2c-bus.h"
+
+#include "common.h"
+#include "error-utilities.h"
+#include "i2c-utilities.h"
+#include "time-utilities.h"
+
+#define N_ADDRS 128  /* 7-bit addressing */
+
+#define NO_ADDR (-1)
+
+struct i2c_bus {
+  const i2c_transport_t *transport;
+  void *ctx;
+  int selected;  /* Last address given to select, or NO_ADDR */
+  unsigned long ioctls;
+  i2c_bus_stats_t stats[N_ADDRS];
+};
+
+static inline void count ( i2c_bus_t *const bus, const uint16_t addr
+                         , const unsigned long bytes, const bool ok );
+
+static const i2c_transport_t linux_transport;
+
+i2c_bus_t *
+i2c_bus_new (const char *const dev, error_t *const err)
+{
+  int *fd = malloc (sizeof (int));
+  if (! fd) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto malloc_failed;
+  }
+
+  if ((*fd = open (dev, O_RDWR)) < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "open %s failed", dev);
+    goto open_failed;
+  }
+
+  i2c_bus_t *bus = i2c_bus_new_transport (&linux_transport, fd, err);
+  if (! bus)
+    goto bus_failed;
+
+  return bus;
+
+bus_failed:
+  close (*fd);
+
+open_failed:
+  free (fd);
+
+malloc_failed:
+  error_prefix (err, "i2c_bus_new");
+  return NULL;
+}
+
+i2c_bus_t *
+i2c_bus_new_transport ( const i2c_transport_t *const transport, void *const ctx
+                      , error_t *const err )
+{
+  i2c_bus_t *bus = malloc (sizeof (i2c_bus_t));
+  if (! bus) {
+    error_errno (err);
+    error_prefix (err, "i2c_bus_new_transport: malloc failed");
+    return NULL;
+  }
+
+  bus->transport = transport;
+  bus->ctx = ctx;
+  bus->selected = NO_ADDR;
+  i2c_bus_stats_reset (bus);
+
+  return bus;
+}
+
+void
+i2c_bus_free (i2c_bus_t *const bus)
+{
+  if (bus->transport->free)
+    bus->transport->free (bus->ctx);
+  bus->ctx = (void *)POISON;
+  bus->selected = POISON;
+
+  free (bus);
+}
+
+bool
+i2c_bus_select (i2c_bus_t *const bus, const uint16_t addr, error_t *const err)
+{
+  if (bus->selected == addr)
+    return true;
+
+  ++bus->ioctls;
+  if (addr < N_ADDRS)
+    ++bus->stats[addr].selects;
+
+  if (! bus->transport->select (bus->ctx, addr, err)) {
+    bus->selected = NO_ADDR;
+    error_prefix (err, "i2c_bus_select");
+    return false;
+  }
+
+  bus->selected = addr;
+  return true;
+}
+
+bool
+i2c_bus_read_u8 ( i2c_bus_t *const bus, const uint16_t addr
+                , const uint8_t command, uint8_t *const data
+                , error_t *const err )
+{
+  bool ok = bus->transport->read_block (bus->ctx, addr, command, data, 1, err);
+  count (bus, addr, 2, ok);
+  if (! ok) {
+    error_prefix (err, "i2c_bus_read_u8");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+i2c_bus_read_block ( i2c_bus_t *const bus, const uint16_t addr
+                   , const uint8_t command, uint8_t *const data
+                   , const uint16_t len, error_t *const err )
+{
+  bool ok = bus->transport->read_block ( bus->ctx, addr, command, data, len
+                                       , err );
+  count (bus, addr, 1 + len, ok);
+  if (! ok) {
+    error_prefix (err, "i2c_bus_read_block");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+i2c_bus_write_u8 ( i2c_bus_t *const bus, const uint16_t addr
+                 , const uint8_t command, const uint8_t data
+                 , error_t *const err )
+{
+  if (! i2c_bus_select (bus, addr, err))
+    goto error;
+
+  bool ok = bus->transport->write_u8 (bus->ctx, addr, command, data, err);
+  count (bus, addr, 2, ok);
+  if (! ok)
+    goto error;
+
+  return true;
+
+error:
+  error_prefix (err, "i2c_bus_write_u8");
+  return false;
+}
+
+bool
+i2c_bus_submit ( i2c_bus_t *const bus, i2c_batch_t *const batch
+               , error_t *const err )
+{
+  if (batch->n_msgs == 0)
+    return true;
+
+  ++bus->ioctls;
+  bool ok = bus->transport->transfer (bus->ctx, batch, err);
+
+  /* The kernel does not say how far a failed batch got, so all of it
+   * counts as failed.
+   */
+  for (uint16_t i = 0; i < batch->n_msgs; ++i) {
+    const struct i2c_msg *msg = &batch->msgs[i];
+    if (msg->addr >= N_ADDRS)
+      continue;
+
+    /* Every write starts a transfer; a read continues the preceding one. */
+    if (! (msg->flags & I2C_M_RD)) {
+      if (ok)
+        ++bus->stats[msg->addr].transactions;
+      else
+        ++bus->stats[msg->addr].failures;
+    }
+    if (ok)
+      bus->stats[msg->addr].bytes += msg->len;
+  }
+
+  if (! ok) {
+    error_prefix (err, "i2c_bus_submit");
+    return false;
+  }
+
+  return true;
+}
+
+const i2c_bus_stats_t *
+i2c_bus_stats (const i2c_bus_t *const bus, const uint16_t addr)
+{
+  return &bus->stats[addr % N_ADDRS];
+}
+
+unsigned long
+i2c_bus_ioctls (const i2c_bus_t *const bus)
+{
+  return bus->ioctls;
+}
+
+int64_t
+i2c_bus_wire_time (const i2c_bus_t *const bus, const unsigned long hz)
+{
+  uint64_t bits = 0;
+
+  /* Nine clocks per byte with its ACK, plus an address byte and about a
+   * byte's worth of start, repeated start and stop per transaction.
+   */
+  for (int addr = 0; addr < N_ADDRS; ++addr)
+    bits += 9 * (bus->stats[addr].bytes + 2 * bus->stats[addr].transactions);
+
+  return bits * NS_PER_S / hz;
+}
+
+void
+i2c_bus_stats_reset (i2c_bus_t *const bus)
+{
+  bus->ioctls = 0;
+  memset (bus->stats, 0, sizeof (bus->stats));
+}
+
+void
+i2c_bus_dump (const i2c_bus_t *const bus, FILE *const stream)
+{
+  fprintf ( stream, "i2c_bus: transport=%s ioctls=%lu\n", bus->transport->name
+          , bus->ioctls );
+
+  for (int addr = 0; addr < N_ADDRS; ++addr) {
+    const i2c_bus_stats_t *stats = &bus->stats[addr];
+    if (! (stats->transactions || stats->selects || stats->failures))
+      continue;
+
+    fprintf ( stream
+            , "i2c_bus: addr=0x%02x transactions=%lu bytes=%lu selects=%lu"
+              " failures=%lu\n"
+            , addr, stats->transactions, stats->bytes, stats->selects
+            , stats->failures );
+  }
+}
+
+/* One call into the transport, and the transaction it made if ok */
+static inline void
+count ( i2c_bus_t *const bus, const uint16_t addr, const unsigned long bytes
+      , const bool ok )
+{
+  ++bus->ioctls;
+  if (addr >= N_ADDRS)
+    return;
+
+  if (ok) {
+    ++bus->stats[addr].transactions;
+    bus->stats[addr].bytes += bytes;
+  } else {
+    ++bus->stats[addr].failures;
+  }
+}
+
+/* Linux i2c-dev; ctx points to the fd. */
+
+static bool
+linux_select (void *const ctx, const uint16_t addr, error_t *const err)
+{
+  return i2c_slave (*(int *)ctx, addr, err);
+}
+
+static bool
+linux_read_block ( void *const ctx, const uint16_t addr, const uint8_t command
+                 , uint8_t *const data, const uint16_t len, error_t *const err )
+{
+  return i2c_read_block (*(int *)ctx, addr, command, data, len, err);
+}
+
+static bool
+linux_write_u8 ( void *const ctx, const uint16_t addr, const uint8_t command
+               , const uint8_t data, error_t *const err )
+{
+  return i2c_write_u8 (*(int *)ctx, command, data, err);
+}
+
+static bool
+linux_transfer (void *const ctx, i2c_batch_t *const batch, error_t *const err)
+{
+  return i2c_batch_submit (*(int *)ctx, batch, err);
+}
+
+static void
+linux_free (void *const ctx)
+{
+  close (*(int *)ctx);
+  free (ctx);
+}
+
+static const i2c_transport_t linux_transport =
+  { .name = "linux", .select = linux_select, .read_block = linux_read_block
+  , .write_u8 = linux_write_u8, .transfer = linux_transfer
+  , .free = linux_free };
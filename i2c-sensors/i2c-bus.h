@@ -0,0 +1,100 @@
+/* I2C bus shared by the sensor drivers */
+
+#ifndef INCLUDE_I2C_BUS_H
+#define INCLUDE_I2C_BUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "error-utilities.h"
+#include "i2c-utilities.h"
+
+typedef struct i2c_bus i2c_bus_t;
+
+/* How the bus reaches the chips: the Linux i2c-dev interface, or something
+ * else such as i2c-sim.h. Every call gets the ctx the bus was created with.
+ * read_block and write_u8 are one combined transaction each; transfer puts
+ * the whole batch on the bus back to back.
+ */
+typedef struct {
+  const char *name;
+  bool (*select) (void *const ctx, const uint16_t addr, error_t *const err);
+  bool (*read_block) ( void *const ctx, const uint16_t addr
+                     , const uint8_t command, uint8_t *const data
+                     , const uint16_t len, error_t *const err );
+  bool (*write_u8) ( void *const ctx, const uint16_t addr
+                   , const uint8_t command, const uint8_t data
+                   , error_t *const err );
+  bool (*transfer) ( void *const ctx, i2c_batch_t *const batch
+                   , error_t *const err );
+  void (*free) (void *const ctx);  /* By i2c_bus_free; NULL if not ours */
+} i2c_transport_t;
+
+/* Per slave address. A transaction is one transfer on the wire, starting with
+ * a start condition: a register write, or a register address write plus the
+ * read after the repeated start. Only those that went through count toward
+ * transactions and bytes; a NAK or any other error counts as a failure.
+ */
+typedef struct {
+  unsigned long transactions;
+  unsigned long bytes;     /* Payload, register addresses included */
+  unsigned long selects;   /* I2C_SLAVE ioctls */
+  unsigned long failures;  /* Transactions that failed */
+} i2c_bus_stats_t;
+
+/* The Linux transport on an i2c-dev device such as /dev/i2c-1. */
+i2c_bus_t *
+i2c_bus_new (const char *const dev, error_t *const err);
+
+i2c_bus_t *
+i2c_bus_new_transport ( const i2c_transport_t *const transport, void *const ctx
+                      , error_t *const err );
+
+void
+i2c_bus_free (i2c_bus_t *const bus);
+
+/* Point the transport at addr for the transfers that do not carry it, the
+ * SMBus ones on Linux. Only goes to the transport if another address was
+ * selected last.
+ */
+bool
+i2c_bus_select (i2c_bus_t *const bus, const uint16_t addr, error_t *const err);
+
+bool
+i2c_bus_read_u8 ( i2c_bus_t *const bus, const uint16_t addr
+                , const uint8_t command, uint8_t *const data
+                , error_t *const err );
+
+bool
+i2c_bus_read_block ( i2c_bus_t *const bus, const uint16_t addr
+                   , const uint8_t command, uint8_t *const data
+                   , const uint16_t len, error_t *const err );
+
+bool
+i2c_bus_write_u8 ( i2c_bus_t *const bus, const uint16_t addr
+                 , const uint8_t command, const uint8_t data
+                 , error_t *const err );
+
+bool
+i2c_bus_submit ( i2c_bus_t *const bus, i2c_batch_t *const batch
+               , error_t *const err );
+
+const i2c_bus_stats_t *
+i2c_bus_stats (const i2c_bus_t *const bus, const uint16_t addr);
+
+/* Number of calls into the transport so far: ioctls, on Linux. */
+unsigned long
+i2c_bus_ioctls (const i2c_bus_t *const bus);
+
+/* Estimate of the ns the transfers so far kept the bus busy at hz. */
+int64_t
+i2c_bus_wire_time (const i2c_bus_t *const bus, const unsigned long hz);
+
+void
+i2c_bus_stats_reset (i2c_bus_t *const bus);
+
+void
+i2c_bus_dump (const i2c_bus_t *const bus, FILE *const stream);
+
+#endif /* INCLUDE_I2C_BUS_H */
@@ -1,8 +1,8 @@
-#include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <sys/stat.h>
-#include <sys/types.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include "i2c-sensors.h"
@@ -10,21 +10,103 @@
 #include "bmp085.h"
 #include "common.h"
 #include "error-utilities.h"
+#include "flight-log.h"
+#include "gpio.h"
+#include "gyro-bias.h"
+#include "i2c-bus.h"
 #include "l3gd20.h"
 #include "lsm303dlhc-acc.h"
 #include "lsm303dlhc-mag.h"
+#include "mag-calibration.h"
+#include "schedule.h"
+#include "time-utilities.h"
+
+typedef enum { SOURCE_BARO, SOURCE_GYRO, SOURCE_ACC, SOURCE_MAG, N_SOURCES }
+  source_id_t;
+
+_Static_assert ( (int)SOURCE_MAG == (int)I2C_SENSORS_MAG &&
+                 (int)FLIGHT_LOG_MAG == (int)I2C_SENSORS_MAG
+               , "sensor orders" );
+
+#define SOURCE_TIMER N_SOURCES
+
+/* A sensor with a data-ready line that has stayed quiet this long gets
+ * serviced from the timer anyway, in case an edge was missed.
+ */
+#define WATCHDOG (100 * 1000000)  /* ns */
+
+#define BUS_HZ 400000
+
+typedef struct {
+  int fd;          /* Data-ready line, or -1: polled on its own deadline */
+  gpio_t *gpio;    /* The line if it is ours; bmp085 owns the EOC line */
+  int64_t period;  /* ns between samples at the output data rate */
+  int64_t last;    /* CLOCK_MONOTONIC ns of the last service */
+  bool fresh;      /* The last service produced a sample */
+  unsigned long serviced, late;
+} source_t;
 
 struct i2c_sensors {
-  int fd;
+  i2c_bus_t *bus;
   bmp085_t *bmp085;
   l3gd20_t *l3gd20;
   lsm303dlhc_acc_t *lsm303dlhc_acc;
   lsm303dlhc_mag_t *lsm303dlhc_mag;
+  i2c_batch_t batch;
+  int epoll_fd;  /* -1 unless i2c_sensors_events_start has been called */
+  int timer_fd;
+  source_t sources[N_SOURCES];
+  schedule_t schedule;
+  int64_t started;  /* CLOCK_MONOTONIC ns at i2c_sensors_events_start */
+
+  /* Set instead of the bus and the drivers when replaying a log */
+  flight_log_reader_t *replay;
+  const flight_log_record_t *records;
+  size_t n_records, next_record;
+  i2c_sensors_pace_t pace;
+  int64_t replay_offset;  /* CLOCK_MONOTONIC minus log time, once started */
+  sample_scale_t replay_scales[N_SOURCES];  /* From the log header */
+  bmp085_comp_t replay_comp;                /* Likewise */
+  mag_calibration_t *replay_calibration;    /* NULL unless attached */
 };
 
+static bool service ( i2c_sensors_t *const sensors, const source_id_t id
+                    , const int64_t now, const bool edge
+                    , i2c_sensors_result_t *const res, error_t *const err );
+static bool run_due ( i2c_sensors_t *const sensors, const int64_t now
+                    , i2c_sensors_result_t *const res, error_t *const err );
+static bool reschedule ( i2c_sensors_t *const sensors, const source_id_t id
+                       , const int64_t now, error_t *const err );
+static bool arm_timer (i2c_sensors_t *const sensors, error_t *const err);
+static void clear_results (i2c_sensors_result_t *const res);
+static void to_result ( i2c_sensors_t *const sensors
+                      , const i2c_sensors_raw_t *const raw
+                      , i2c_sensors_result_t *const res );
+static bool replay ( i2c_sensors_t *const sensors
+                   , i2c_sensors_result_t *const res, const int timeout_ms
+                   , error_t *const err );
+static bool replay_raw ( i2c_sensors_t *const sensors
+                       , i2c_sensors_raw_t *const raw, const int timeout_ms
+                       , error_t *const err );
+
 i2c_sensors_t *
 i2c_sensors_new ( const char *const dev, const int bmp085_eoc_gpio
                 , error_t *const err )
+{
+  i2c_sensors_t *sensors = NULL;
+
+  i2c_bus_t *bus = i2c_bus_new (dev, err);
+  if (bus)
+    sensors = i2c_sensors_new_bus (bus, bmp085_eoc_gpio, err);
+
+  if (! sensors)
+    error_prefix (err, "i2c_sensors_new");
+  return sensors;
+}
+
+i2c_sensors_t *
+i2c_sensors_new_bus ( i2c_bus_t *const bus, const int bmp085_eoc_gpio
+                    , error_t *const err )
 {
   i2c_sensors_t *sensors = malloc (sizeof (i2c_sensors_t));
   if (! sensors) {
@@ -33,24 +115,22 @@ i2c_sensors_new ( const char *const dev, const int bmp085_eoc_gpio
     goto malloc_failed;
   }
 
-  if ((sensors->fd = open (dev, O_RDWR)) < 0) {
-    error_errno (err);
-    error_prefix_printf (err, "open %s failed", dev);
-    goto open_failed;
-  }
+  sensors->epoll_fd = sensors->timer_fd = -1;
+  sensors->replay = NULL;
+  sensors->bus = bus;
 
-  if (! (sensors->bmp085 = bmp085_new (sensors->fd, bmp085_eoc_gpio, 3, err)))
+  if (! (sensors->bmp085 = bmp085_new (sensors->bus, bmp085_eoc_gpio, 3, err)))
     goto bmp085_failed;
 
-  if (! (sensors->l3gd20 = l3gd20_new (sensors->fd, err)))
+  if (! (sensors->l3gd20 = l3gd20_new (sensors->bus, err)))
     goto l3gd20_failed;
 
   if (! (sensors->lsm303dlhc_acc =
-           lsm303dlhc_acc_new (sensors->fd, err)))
+           lsm303dlhc_acc_new (sensors->bus, err)))
     goto lsm303dlhc_acc_failed;
 
   if (! (sensors->lsm303dlhc_mag =
-           lsm303dlhc_mag_new (sensors->fd, err)))
+           lsm303dlhc_mag_new (sensors->bus, err)))
     goto lsm303dlhc_mag_failed;
 
   return sensors;
@@ -68,19 +148,82 @@ l3gd20_failed:
   bmp085_free (sensors->bmp085);
 
 bmp085_failed:
-  close (sensors->fd);
+  free (sensors);
+
+malloc_failed:
+  i2c_bus_free (bus);
+  error_prefix (err, "i2c_sensors_new_bus");
+  return NULL;
+}
+
+i2c_sensors_t *
+i2c_sensors_new_replay ( const char *const log_path
+                       , const i2c_sensors_pace_t pace, error_t *const err )
+{
+  i2c_sensors_t *sensors = malloc (sizeof (i2c_sensors_t));
+  if (! sensors) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto malloc_failed;
+  }
+
+  sensors->epoll_fd = sensors->timer_fd = -1;
+  sensors->bus = NULL;
+  sensors->started = time_monotonic ();
+
+  if (! (sensors->replay = flight_log_open (log_path, err)))
+    goto open_failed;
+
+  sensors->records = flight_log_records (sensors->replay, &sensors->n_records);
+  sensors->next_record = 0;
+  sensors->pace = pace;
+  sensors->replay_offset = 0;
+  sensors->replay_calibration = NULL;
+
+  const flight_log_header_t *header = flight_log_header (sensors->replay);
+  double gyro = header->gyro_scale, acc = header->acc_scale
+       , mag_xy = header->mag_scale_xy, mag_z = header->mag_scale_z;
+  sensors->replay_scales[SOURCE_GYRO] =
+    (sample_scale_t){ .scale = { gyro, gyro, gyro } };
+  sensors->replay_scales[SOURCE_ACC] =
+    (sample_scale_t){ .scale = { acc, acc, acc } };
+  sensors->replay_scales[SOURCE_MAG] =
+    (sample_scale_t){ .scale = { mag_xy, mag_xy, mag_z } };
+  bmp085_comp_init ( &sensors->replay_comp, &header->bmp085_calib
+                   , header->bmp085_oss );
+
+  for (int id = 0; id < N_SOURCES; ++id)
+    sensors->sources[id] = (source_t){ .fd = -1 };
+
+  return sensors;
 
 open_failed:
   free (sensors);
 
 malloc_failed:
-  error_prefix (err, "i2c_sensors_new");
+  error_prefix (err, "i2c_sensors_new_replay");
   return NULL;
 }
 
+bool
+i2c_sensors_replay_end (const i2c_sensors_t *const sensors)
+{
+  return sensors->replay && sensors->next_record == sensors->n_records;
+}
+
 void
 i2c_sensors_free (i2c_sensors_t *const sensors)
 {
+  if (sensors->replay) {
+    flight_log_reader_free (sensors->replay);
+    sensors->replay = (flight_log_reader_t *)POISON;
+    free (sensors);
+    return;
+  }
+
+  if (sensors->epoll_fd >= 0)
+    i2c_sensors_events_stop (sensors);
+
   bmp085_free (sensors->bmp085);
   sensors->bmp085 = (bmp085_t *)POISON;
 
@@ -93,8 +236,8 @@ i2c_sensors_free (i2c_sensors_t *const sensors)
   lsm303dlhc_mag_free (sensors->lsm303dlhc_mag);
   sensors->lsm303dlhc_mag = (lsm303dlhc_mag_t *)POISON;
 
-  close (sensors->fd);
-  sensors->fd = POISON;
+  i2c_bus_free (sensors->bus);
+  sensors->bus = (i2c_bus_t *)POISON;
 
   free (sensors);
 }
@@ -102,13 +245,95 @@ i2c_sensors_free (i2c_sensors_t *const sensors)
 void
 i2c_sensors_dump (const i2c_sensors_t *const sensors, FILE *const stream)
 {
+  if (sensors->replay) {
+    fprintf ( stream, "i2c_sensors: replay record=%zu/%zu pace=%s\n"
+            , sensors->next_record, sensors->n_records
+            , sensors->pace == I2C_SENSORS_REPLAY_FAST ? "fast" : "realtime" );
+    return;
+  }
+
   bmp085_dump (sensors->bmp085, stream);
+  i2c_bus_dump (sensors->bus, stream);
+}
+
+const bmp085_calib_t *
+i2c_sensors_bmp085_calib ( const i2c_sensors_t *const sensors
+                         , int16_t *const oss )
+{
+  if (sensors->replay) {
+    const flight_log_header_t *header = flight_log_header (sensors->replay);
+    *oss = header->bmp085_oss;
+    return &header->bmp085_calib;
+  }
+
+  *oss = bmp085_oss (sensors->bmp085);
+  return bmp085_calib (sensors->bmp085);
+}
+
+bool
+i2c_sensors_bmp085_temp_cadence ( i2c_sensors_t *const sensors
+                                , const unsigned temp_every
+                                , const int64_t temp_interval
+                                , error_t *const err )
+{
+  if (sensors->replay)
+    return true;
+
+  if (! bmp085_temp_cadence ( sensors->bmp085, temp_every, temp_interval
+                            , err )) {
+    error_prefix (err, "i2c_sensors_bmp085_temp_cadence");
+    return false;
+  }
+
+  return true;
+}
+
+void
+i2c_sensors_mag_calibration ( i2c_sensors_t *const sensors
+                            , mag_calibration_t *const cal )
+{
+  if (sensors->replay)
+    sensors->replay_calibration = cal;
+  else
+    lsm303dlhc_mag_calibration (sensors->lsm303dlhc_mag, cal);
+}
+
+void
+i2c_sensors_gyro_bias (i2c_sensors_t *const sensors, gyro_bias_t *const gb)
+{
+  if (sensors->replay)
+    return;
+
+  l3gd20_gyro_bias (sensors->l3gd20, gb);
+  lsm303dlhc_acc_gyro_bias (sensors->lsm303dlhc_acc, gb);
+}
+
+const sample_scale_t *
+i2c_sensors_scale ( const i2c_sensors_t *const sensors
+                  , const i2c_sensors_id_t id )
+{
+  if (sensors->replay)
+    return &sensors->replay_scales[id];
+
+  switch (id) {
+  case I2C_SENSORS_GYRO:
+    return l3gd20_scale (sensors->l3gd20);
+  case I2C_SENSORS_ACC:
+    return lsm303dlhc_acc_scale (sensors->lsm303dlhc_acc);
+  case I2C_SENSORS_MAG:
+    return lsm303dlhc_mag_scale (sensors->lsm303dlhc_mag);
+  default:
+    return NULL;
+  }
 }
 
 bool
 i2c_sensors_run ( i2c_sensors_t *const sensors, i2c_sensors_result_t *const res
                 , error_t *const err)
 {
+  if (sensors->replay)
+    return replay (sensors, res, -1, err);
+
   if (! (bmp085_run (sensors->bmp085, &res->baro, err) &&
          l3gd20_run (sensors->l3gd20, &res->gyro, err) &&
          lsm303dlhc_acc_run (sensors->lsm303dlhc_acc, &res->acc, err) &&
@@ -121,3 +346,587 @@ error:
   error_prefix (err, "i2c_sensors_run");
   return false;
 }
+
+bool
+i2c_sensors_run_raw ( i2c_sensors_t *const sensors
+                    , i2c_sensors_raw_t *const raw, error_t *const err )
+{
+  if (sensors->replay)
+    return replay_raw (sensors, raw, -1, err);
+
+  bool fresh[N_SOURCES];
+
+  raw->fresh = 0;
+
+  if (! (bmp085_run_raw (sensors->bmp085, &raw->baro, &fresh[SOURCE_BARO], err)
+         && l3gd20_run_raw ( sensors->l3gd20, &raw->gyro, &fresh[SOURCE_GYRO]
+                           , err )
+         && lsm303dlhc_acc_run_raw ( sensors->lsm303dlhc_acc, &raw->acc
+                                   , &fresh[SOURCE_ACC], err )
+         && lsm303dlhc_mag_run_raw ( sensors->lsm303dlhc_mag, &raw->mag
+                                   , &fresh[SOURCE_MAG], err ))) {
+    error_prefix (err, "i2c_sensors_run_raw");
+    return false;
+  }
+
+  for (int id = 0; id < N_SOURCES; ++id)
+    if (fresh[id])
+      raw->fresh |= I2C_SENSORS_FLAG (id);
+
+  return true;
+}
+
+bool
+i2c_sensors_run_batch ( i2c_sensors_t *const sensors
+                      , i2c_sensors_result_t *const res, error_t *const err )
+{
+  if (sensors->replay)
+    return replay (sensors, res, -1, err);
+
+  i2c_batch_t *batch = &sensors->batch;
+  i2c_batch_clear (batch);
+
+  if (! (bmp085_batch_prepare (sensors->bmp085, batch, err) &&
+         l3gd20_batch_prepare (sensors->l3gd20, batch, err) &&
+         lsm303dlhc_acc_batch_prepare (sensors->lsm303dlhc_acc, batch, err) &&
+         lsm303dlhc_mag_batch_prepare (sensors->lsm303dlhc_mag, batch, err)))
+    goto error;
+
+  if (! i2c_bus_submit (sensors->bus, batch, err))
+    goto error;
+
+  bmp085_batch_finish (sensors->bmp085, &res->baro);
+  l3gd20_batch_finish (sensors->l3gd20, &res->gyro);
+  lsm303dlhc_acc_batch_finish (sensors->lsm303dlhc_acc, &res->acc);
+  lsm303dlhc_mag_batch_finish (sensors->lsm303dlhc_mag, &res->mag);
+
+  return true;
+
+error:
+  error_prefix (err, "i2c_sensors_run_batch");
+  return false;
+}
+
+bool
+i2c_sensors_events_start ( i2c_sensors_t *const sensors
+                         , const int l3gd20_drdy_gpio
+                         , const int lsm303dlhc_acc_drdy_gpio
+                         , error_t *const err )
+{
+  if (sensors->replay) {
+    sensors->started = time_monotonic ();
+    return true;
+  }
+
+  source_t *sources = sensors->sources;
+  const int gpios[N_SOURCES] = { [SOURCE_BARO] = -1
+                               , [SOURCE_GYRO] = l3gd20_drdy_gpio
+                               , [SOURCE_ACC]  = lsm303dlhc_acc_drdy_gpio
+                               , [SOURCE_MAG]  = -1 };
+  const int64_t periods[N_SOURCES] =
+    { [SOURCE_BARO] = BMP085_CONVERSION_TIME_MAX
+    , [SOURCE_GYRO] = NS_PER_S / L3GD20_RATE
+    , [SOURCE_ACC]  = NS_PER_S / LSM303DLHC_ACC_RATE
+    , [SOURCE_MAG]  = NS_PER_S / LSM303DLHC_MAG_RATE };
+
+  for (int id = 0; id < N_SOURCES; ++id)
+    sources[id] = (source_t){ .fd = -1, .period = periods[id] };
+  sources[SOURCE_BARO].fd = bmp085_eoc_fd (sensors->bmp085);
+
+  for (int id = 0; id < N_SOURCES; ++id) {
+    if (gpios[id] < 0)
+      continue;
+
+    if (! (sources[id].gpio = gpio_new (gpios[id], GPIO_EDGE_RISING, err)))
+      goto gpio_failed;
+    sources[id].fd = gpio_fd (sources[id].gpio);
+  }
+
+  bool gyro_drdy, acc_drdy;
+  if (! l3gd20_set_drdy ( sensors->l3gd20, sources[SOURCE_GYRO].gpio != NULL
+                        , &gyro_drdy, err ))
+    goto gyro_drdy_failed;
+  if (! lsm303dlhc_acc_set_drdy ( sensors->lsm303dlhc_acc
+                                , sources[SOURCE_ACC].gpio != NULL, &acc_drdy
+                                , err ))
+    goto acc_drdy_failed;
+
+  if ((sensors->epoll_fd = epoll_create1 (EPOLL_CLOEXEC)) < 0) {
+    error_errno (err);
+    error_prefix (err, "epoll_create1 failed");
+    goto epoll_create_failed;
+  }
+
+  if ((sensors->timer_fd =
+         timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    error_errno (err);
+    error_prefix (err, "timerfd_create failed");
+    goto timerfd_create_failed;
+  }
+
+  struct epoll_event ev = { .events = EPOLLIN, .data.u32 = SOURCE_TIMER };
+  if (epoll_ctl (sensors->epoll_fd, EPOLL_CTL_ADD, sensors->timer_fd, &ev) < 0)
+    goto epoll_ctl_errno;
+
+  for (int id = 0; id < N_SOURCES; ++id) {
+    if (sources[id].fd < 0)
+      continue;
+
+    /* The EOC line is the BMP085's own, and a sysfs edge all the same */
+    uint32_t events = id == SOURCE_BARO
+                    ? EPOLLPRI : (uint32_t)gpio_events (sources[id].gpio);
+    ev = (struct epoll_event){ .events = events | EPOLLERR, .data.u32 = id };
+    if (epoll_ctl (sensors->epoll_fd, EPOLL_CTL_ADD, sources[id].fd, &ev) < 0)
+      goto epoll_ctl_errno;
+  }
+
+  /* Read whatever is pending so that the data-ready lines go low and the
+   * next sample makes an edge. That also gives every source its first
+   * deadline.
+   */
+  i2c_sensors_result_t res;
+  int64_t now = time_monotonic ();
+
+  schedule_clear (&sensors->schedule);
+  i2c_bus_stats_reset (sensors->bus);
+  sensors->started = now;
+
+  clear_results (&res);
+  for (int id = 0; id < N_SOURCES; ++id)
+    if (! (service (sensors, id, now, false, &res, err) &&
+           reschedule (sensors, id, now, err)))
+      goto prime_failed;
+
+  if (! arm_timer (sensors, err))
+    goto prime_failed;
+
+  return true;
+
+epoll_ctl_errno:
+  error_errno (err);
+  error_prefix (err, "epoll_ctl failed");
+
+prime_failed:
+  close (sensors->timer_fd);
+  sensors->timer_fd = -1;
+
+timerfd_create_failed:
+  close (sensors->epoll_fd);
+  sensors->epoll_fd = -1;
+
+epoll_create_failed:
+  {
+    /* Best effort, as in i2c_sensors_events_stop; err has the story. */
+    ERROR_DECLARE_COMPACT (restore_err);
+    (void)lsm303dlhc_acc_set_drdy ( sensors->lsm303dlhc_acc, acc_drdy, NULL
+                                  , &restore_err );
+  }
+
+acc_drdy_failed:
+  {
+    ERROR_DECLARE_COMPACT (restore_err);
+    (void)l3gd20_set_drdy (sensors->l3gd20, gyro_drdy, NULL, &restore_err);
+  }
+
+gyro_drdy_failed:
+gpio_failed:
+  for (int id = 0; id < N_SOURCES; ++id) {
+    if (sources[id].gpio)
+      gpio_free (sources[id].gpio);
+    sources[id].gpio = NULL;
+  }
+
+  error_prefix (err, "i2c_sensors_events_start");
+  return false;
+}
+
+void
+i2c_sensors_events_stop (i2c_sensors_t *const sensors)
+{
+  /* Never read */
+  ERROR_DECLARE_COMPACT (err);
+
+  if (sensors->replay)
+    return;
+
+  /* Best effort; the lines are closed either way. */
+  (void)(l3gd20_set_drdy (sensors->l3gd20, false, NULL, &err) &&
+         lsm303dlhc_acc_set_drdy (sensors->lsm303dlhc_acc, false, NULL, &err));
+
+  close (sensors->timer_fd);
+  sensors->timer_fd = -1;
+
+  close (sensors->epoll_fd);
+  sensors->epoll_fd = -1;
+
+  for (int id = 0; id < N_SOURCES; ++id) {
+    if (sensors->sources[id].gpio)
+      gpio_free (sensors->sources[id].gpio);
+    sensors->sources[id].gpio = NULL;
+  }
+}
+
+bool
+i2c_sensors_wait ( i2c_sensors_t *const sensors, i2c_sensors_result_t *const res
+                 , const int timeout_ms, error_t *const err )
+{
+  struct epoll_event events[N_SOURCES + 1];
+
+  if (sensors->replay)
+    return replay (sensors, res, timeout_ms, err);
+
+  clear_results (res);
+
+  int n = epoll_wait (sensors->epoll_fd, events, N_SOURCES + 1, timeout_ms);
+  if (n < 0) {
+    if (errno == EINTR)
+      return true;
+
+    error_errno (err);
+    error_prefix (err, "epoll_wait failed");
+    goto error;
+  }
+
+  int64_t now = time_monotonic ();
+
+  for (int i = 0; i < n; ++i) {
+    source_id_t id = events[i].data.u32;
+
+    if (id == SOURCE_TIMER) {
+      uint64_t expirations;
+      if (read (sensors->timer_fd, &expirations, sizeof (expirations)) < 0 &&
+          errno != EAGAIN) {
+        error_errno (err);
+        error_prefix (err, "read timerfd failed");
+        goto error;
+      }
+
+      if (! run_due (sensors, now, res, err))
+        goto error;
+
+      continue;
+    }
+
+    /* Reading the value re-arms the edge. */
+    bool value;
+    gpio_t *gpio = sensors->sources[id].gpio;
+    if (! (id == SOURCE_BARO ? bmp085_eoc_ack (sensors->bmp085, err)
+                             : gpio_read (gpio, &value, err)))
+      goto error;
+
+    if (! service (sensors, id, now, true, res, err))
+      goto error;
+  }
+
+  return true;
+
+error:
+  error_prefix (err, "i2c_sensors_wait");
+  return false;
+}
+
+void
+i2c_sensors_stats ( const i2c_sensors_t *const sensors
+                  , i2c_sensors_stats_t *const stats )
+{
+  const source_t *sources = sensors->sources;
+  int64_t elapsed = time_monotonic () - sensors->started;
+  int64_t wire = sensors->replay ? 0
+               : i2c_bus_wire_time (sensors->bus, BUS_HZ);
+
+  stats->bus_load = elapsed > 0 ? (double)wire / elapsed : 0.0;
+  stats->bus_budget = 1.0 - stats->bus_load;
+
+  stats->baro = (i2c_sensors_source_stats_t){ sources[SOURCE_BARO].serviced
+                                            , sources[SOURCE_BARO].late };
+  stats->gyro = (i2c_sensors_source_stats_t){ sources[SOURCE_GYRO].serviced
+                                            , sources[SOURCE_GYRO].late };
+  stats->acc  = (i2c_sensors_source_stats_t){ sources[SOURCE_ACC].serviced
+                                            , sources[SOURCE_ACC].late };
+  stats->mag  = (i2c_sensors_source_stats_t){ sources[SOURCE_MAG].serviced
+                                            , sources[SOURCE_MAG].late };
+}
+
+/* Service every source whose deadline has passed and give it the next one. */
+static bool
+run_due ( i2c_sensors_t *const sensors, const int64_t now
+        , i2c_sensors_result_t *const res, error_t *const err )
+{
+  schedule_t *sched = &sensors->schedule;
+
+  while (! schedule_empty (sched) && schedule_top (sched)->due <= now) {
+    schedule_entry_t e = schedule_pop (sched);
+    source_t *source = &sensors->sources[e.id];
+
+    /* A line that has signaled since this deadline was set only needs its
+     * watchdog moved.
+     */
+    bool quiet = source->fd < 0 || now - source->last >= WATCHDOG;
+
+    if (source->fd < 0 && now - e.due > source->period)
+      ++source->late;
+
+    if (quiet && ! service (sensors, e.id, now, false, res, err))
+      return false;
+
+    if (! reschedule (sensors, e.id, now, err))
+      return false;
+  }
+
+  return arm_timer (sensors, err);
+}
+
+static bool
+reschedule ( i2c_sensors_t *const sensors, const source_id_t id
+           , const int64_t now, error_t *const err )
+{
+  source_t *source = &sensors->sources[id];
+  int64_t due;
+
+  if (source->fd >= 0)
+    due = source->last + WATCHDOG;
+  else if (source->fresh)
+    /* The sample just appeared, so the next one is a period away. */
+    due = now + source->period;
+  else
+    /* Not there yet; the output data rate and our clock drift apart, so
+     * look again soon rather than a whole period later.
+     */
+    due = now + source->period / 4;
+
+  if (! schedule_push (&sensors->schedule, id, due)) {
+    error_insert (err, "reschedule: schedule full");
+    return false;
+  }
+
+  return true;
+}
+
+/* Point the one-shot timer at the earliest deadline. */
+static bool
+arm_timer (i2c_sensors_t *const sensors, error_t *const err)
+{
+  if (schedule_empty (&sensors->schedule))
+    return true;
+
+  int64_t due = schedule_top (&sensors->schedule)->due;
+  struct itimerspec spec = { .it_interval = { 0, 0 }
+                           , .it_value = { due / NS_PER_S, due % NS_PER_S } };
+
+  if (timerfd_settime (sensors->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+    error_errno (err);
+    error_prefix (err, "arm_timer: timerfd_settime failed");
+    return false;
+  }
+
+  return true;
+}
+
+/* With edge set, the source's data-ready line woke us up at now, which makes
+ * a better sample time than the end of the transfer.
+ */
+static bool
+service ( i2c_sensors_t *const sensors, const source_id_t id
+        , const int64_t now, const bool edge
+        , i2c_sensors_result_t *const res, error_t *const err )
+{
+  source_t *source = &sensors->sources[id];
+  i2c_sensors_result_t r;
+  bool ok = true;
+
+  source->last = now;
+  ++source->serviced;
+
+  /* Into a scratch result so that an empty poll does not clear a sample
+   * this source delivered earlier in the same wait.
+   */
+  switch (id) {
+  case SOURCE_BARO:
+    ok = bmp085_run (sensors->bmp085, &r.baro, err);
+    if (edge)
+      r.baro.time = now;
+    if ((source->fresh = ok && r.baro.have_result))
+      res->baro = r.baro;
+    break;
+  case SOURCE_GYRO:
+    ok = l3gd20_run (sensors->l3gd20, &r.gyro, err);
+    if (edge)
+      r.gyro.time = now;
+    if ((source->fresh = ok && r.gyro.have_result))
+      res->gyro = r.gyro;
+    break;
+  case SOURCE_ACC:
+    ok = lsm303dlhc_acc_run (sensors->lsm303dlhc_acc, &r.acc, err);
+    if (edge)
+      r.acc.time = now;
+    if ((source->fresh = ok && r.acc.have_result))
+      res->acc = r.acc;
+    break;
+  case SOURCE_MAG:
+    ok = lsm303dlhc_mag_run (sensors->lsm303dlhc_mag, &r.mag, err);
+    if ((source->fresh = ok && r.mag.have_result))
+      res->mag = r.mag;
+    break;
+  default:
+    break;
+  }
+
+  return ok;
+}
+
+static void
+clear_results (i2c_sensors_result_t *const res)
+{
+  res->baro.have_result = false;
+  res->gyro.have_result = false;
+  res->acc.have_result  = false;
+  res->mag.have_result  = false;
+}
+
+/* Bring raw samples into units, as the drivers would have. */
+static void
+to_result ( i2c_sensors_t *const sensors
+          , const i2c_sensors_raw_t *const raw
+          , i2c_sensors_result_t *const res )
+{
+  clear_results (res);
+
+  if (raw->fresh & I2C_SENSORS_FLAG (I2C_SENSORS_BARO)) {
+    bmp085_compensate ( &sensors->replay_comp, raw->baro.ut, raw->baro.up
+                      , &res->baro );
+    res->baro.time = raw->baro.time;
+  }
+
+  const sample_scale_t *scale;
+  const sample_raw_t *s;
+
+  if (raw->fresh & I2C_SENSORS_FLAG (I2C_SENSORS_GYRO)) {
+    scale = i2c_sensors_scale (sensors, I2C_SENSORS_GYRO);
+    s = &raw->gyro;
+    res->gyro = (l3gd20_result_t){ .have_result = true, .time = s->time
+                                 , .x = sample_units (scale, s->xyz, 0)
+                                 , .y = sample_units (scale, s->xyz, 1)
+                                 , .z = sample_units (scale, s->xyz, 2)
+                                 , .raw = { s->xyz[0], s->xyz[1], s->xyz[2] }
+                                 };
+  }
+
+  if (raw->fresh & I2C_SENSORS_FLAG (I2C_SENSORS_ACC)) {
+    scale = i2c_sensors_scale (sensors, I2C_SENSORS_ACC);
+    s = &raw->acc;
+    res->acc = (lsm303dlhc_acc_result_t){ .have_result = true, .time = s->time
+                                        , .x = sample_units (scale, s->xyz, 0)
+                                        , .y = sample_units (scale, s->xyz, 1)
+                                        , .z = sample_units (scale, s->xyz, 2)
+                                        , .raw = { s->xyz[0], s->xyz[1]
+                                                 , s->xyz[2] } };
+  }
+
+  if (raw->fresh & I2C_SENSORS_FLAG (I2C_SENSORS_MAG)) {
+    scale = i2c_sensors_scale (sensors, I2C_SENSORS_MAG);
+    s = &raw->mag;
+    res->mag = (lsm303dlhc_mag_result_t){ .have_result = true, .time = s->time
+                                        , .x = sample_units (scale, s->xyz, 0)
+                                        , .y = sample_units (scale, s->xyz, 1)
+                                        , .z = sample_units (scale, s->xyz, 2)
+                                        , .raw = { s->xyz[0], s->xyz[1]
+                                                 , s->xyz[2] } };
+
+    mag_calibration_t *const cal = sensors->replay_calibration;
+    if (cal) {
+      double xyz[3] = { res->mag.x, res->mag.y, res->mag.z };
+      mag_calibration_update (cal, xyz);
+      mag_calibration_apply (cal, xyz, xyz);
+      res->mag.x = xyz[0];
+      res->mag.y = xyz[1];
+      res->mag.z = xyz[2];
+    }
+  }
+}
+
+static bool
+replay ( i2c_sensors_t *const sensors, i2c_sensors_result_t *const res
+       , const int timeout_ms, error_t *const err )
+{
+  i2c_sensors_raw_t raw;
+  if (! replay_raw (sensors, &raw, timeout_ms, err))
+    return false;
+
+  to_result (sensors, &raw, res);
+  return true;
+}
+
+/* Serve logged records until one comes for a sensor that already has its
+ * sample, or, at real-time pace, until one is not due yet. Only the first
+ * record of a call is waited for, up to timeout_ms.
+ */
+static bool
+replay_raw ( i2c_sensors_t *const sensors, i2c_sensors_raw_t *const raw
+           , const int timeout_ms, error_t *const err )
+{
+  bool realtime = sensors->pace == I2C_SENSORS_REPLAY_REALTIME;
+  int64_t deadline = timeout_ms < 0 ? INT64_MAX
+                   : time_monotonic () + (int64_t)timeout_ms * 1000000;
+
+  raw->fresh = 0;
+
+  if (realtime && sensors->replay_offset == 0 &&
+      sensors->next_record < sensors->n_records)
+    sensors->replay_offset =
+      time_monotonic () - sensors->records[sensors->next_record].time;
+
+  while (sensors->next_record < sensors->n_records) {
+    const flight_log_record_t *r = &sensors->records[sensors->next_record];
+
+    if (realtime) {
+      int64_t due = r->time + sensors->replay_offset
+            , now = time_monotonic ();
+      if (due > now) {
+        if (raw->fresh || now >= deadline)
+          break;
+
+        time_sleep_until (due < deadline ? due : deadline);
+        continue;
+      }
+    }
+
+    if (r->sensor >= I2C_SENSORS_N) {
+      error_printf ( err, "replay: record %zu: unknown sensor %u"
+                   , sensors->next_record, r->sensor );
+      return false;
+    }
+
+    if (raw->fresh & I2C_SENSORS_FLAG (r->sensor))
+      return true;
+
+    sample_raw_t xyz = { .time = r->time
+                       , .xyz = { r->data[0], r->data[1], r->data[2] } };
+
+    switch (r->sensor) {
+    case FLIGHT_LOG_BARO:
+      raw->baro = (bmp085_raw_t){ .time = r->time, .ut = r->data[0]
+                                , .up = r->data[1] };
+      break;
+    case FLIGHT_LOG_GYRO:
+      raw->gyro = xyz;
+      break;
+    case FLIGHT_LOG_ACC:
+      raw->acc = xyz;
+      break;
+    case FLIGHT_LOG_MAG:
+      raw->mag = xyz;
+      break;
+    }
+
+    raw->fresh |= I2C_SENSORS_FLAG (r->sensor);
+    ++sensors->next_record;
+    ++sensors->sources[r->sensor].serviced;
+  }
+
+  /* Out of records: let a waiting caller sleep rather than spin. */
+  if (! raw->fresh && sensors->next_record == sensors->n_records &&
+      deadline != INT64_MAX)
+    time_sleep_until (deadline);
+
+  return true;
+}
@@ -6,12 +6,30 @@
 
 #include "bmp085.h"
 #include "error-utilities.h"
+#include "gyro-bias.h"
 #include "l3gd20.h"
 #include "lsm303dlhc-acc.h"
 #include "lsm303dlhc-mag.h"
+#include "sample.h"
 
 typedef struct i2c_sensors i2c_sensors_t;
 
+/* How fast a log is replayed */
+typedef enum { I2C_SENSORS_REPLAY_REALTIME, I2C_SENSORS_REPLAY_FAST }
+  i2c_sensors_pace_t;
+
+typedef struct {
+  unsigned long serviced;
+  unsigned long late;  /* Polls that came more than a period after due */
+} i2c_sensors_source_stats_t;
+
+/* Since i2c_sensors_events_start */
+typedef struct {
+  double bus_load;    /* Estimated share of time the bus spent transferring */
+  double bus_budget;  /* What is left of it */
+  i2c_sensors_source_stats_t baro, gyro, acc, mag;
+} i2c_sensors_stats_t;
+
 typedef struct {
   bmp085_result_t baro;
   l3gd20_result_t gyro;
@@ -19,18 +37,133 @@ typedef struct {
   lsm303dlhc_mag_result_t mag;
 } i2c_sensors_result_t;
 
+/* The sensors, in the order flight_log_sensor_t has them too */
+typedef enum { I2C_SENSORS_BARO, I2C_SENSORS_GYRO, I2C_SENSORS_ACC
+             , I2C_SENSORS_MAG, I2C_SENSORS_N } i2c_sensors_id_t;
+
+#define I2C_SENSORS_FLAG(id) (1u << (id))
+
+/* Unconverted samples. Only those whose I2C_SENSORS_FLAG is in fresh are
+ * new; the rest are left as they were.
+ */
+typedef struct {
+  unsigned fresh;
+  bmp085_raw_t baro;
+  sample_raw_t gyro, acc, mag;
+} i2c_sensors_raw_t;
+
 i2c_sensors_t *
 i2c_sensors_new ( const char *const dev, const int bmp085_eoc_gpio
                 , error_t *const err );
 
+/* The sensors on a bus of any transport, such as the simulated one of
+ * i2c-sim.h. Takes ownership of bus, freeing it on failure too.
+ * bmp085_eoc_gpio may be -1.
+ */
+i2c_sensors_t *
+i2c_sensors_new_bus ( i2c_bus_t *const bus, const int bmp085_eoc_gpio
+                    , error_t *const err );
+
+/* Serve a flight log instead of the hardware. i2c_sensors_run and friends
+ * return the logged samples in order, at most one per sensor per call,
+ * calculated from the raw readings with the calibration in the log and with
+ * the times they were logged at. At REALTIME pace a call waits until the
+ * next sample is as far into the replay as it was into the recording.
+ * Events, stats and the batch variant all work; they only have no bus to
+ * talk to.
+ */
+i2c_sensors_t *
+i2c_sensors_new_replay ( const char *const log_path
+                       , const i2c_sensors_pace_t pace, error_t *const err );
+
+/* Every record of the replayed log has been served. Always false for the
+ * hardware.
+ */
+bool
+i2c_sensors_replay_end (const i2c_sensors_t *const sensors);
+
 void
 i2c_sensors_free (i2c_sensors_t *const sensors);
 
 void
 i2c_sensors_dump (const i2c_sensors_t *const sensors, FILE *const stream);
 
+/* What it takes to redo the BMP085 calculation from the raw readings */
+const bmp085_calib_t *
+i2c_sensors_bmp085_calib ( const i2c_sensors_t *const sensors
+                         , int16_t *const oss );
+
+/* bmp085_temp_cadence; ignored when replaying a log */
+bool
+i2c_sensors_bmp085_temp_cadence ( i2c_sensors_t *const sensors
+                                , const unsigned temp_every
+                                , const int64_t temp_interval
+                                , error_t *const err );
+
+/* lsm303dlhc_mag_calibration, or for a replayed log the same done on the
+ * way to i2c_sensors_result_t
+ */
+void
+i2c_sensors_mag_calibration ( i2c_sensors_t *const sensors
+                            , mag_calibration_t *const cal );
+
+/* l3gd20_gyro_bias and lsm303dlhc_acc_gyro_bias together; ignored when
+ * replaying a log, which has no temperatures
+ */
+void
+i2c_sensors_gyro_bias (i2c_sensors_t *const sensors, gyro_bias_t *const gb);
+
+/* What an LSB of the GYRO, ACC or MAG samples is worth; for BARO there is
+ * i2c_sensors_bmp085_calib.
+ */
+const sample_scale_t *
+i2c_sensors_scale ( const i2c_sensors_t *const sensors
+                  , const i2c_sensors_id_t id );
+
 bool
 i2c_sensors_run ( i2c_sensors_t *const sensors, i2c_sensors_result_t *const res
                 , error_t *const err);
 
+/* i2c_sensors_run without converting anything to double. A replayed log
+ * gives back its records as they are.
+ */
+bool
+i2c_sensors_run_raw ( i2c_sensors_t *const sensors
+                    , i2c_sensors_raw_t *const raw, error_t *const err );
+
+/* Like i2c_sensors_run, but the status and data transfers of all sensors are
+ * submitted to the bus as one I2C_RDWR message list.
+ */
+bool
+i2c_sensors_run_batch ( i2c_sensors_t *const sensors
+                      , i2c_sensors_result_t *const res, error_t *const err );
+
+/* Event-driven acquisition. The BMP085 EOC line and, where wired (pass -1
+ * otherwise), the L3GD20 DRDY and LSM303DLHC accelerometer INT1 lines are
+ * waited on with epoll. Sensors without a line are polled when their output
+ * data rate says the next sample is due, from a min-heap of deadlines that
+ * drives a timerfd.
+ */
+bool
+i2c_sensors_events_start ( i2c_sensors_t *const sensors
+                         , const int l3gd20_drdy_gpio
+                         , const int lsm303dlhc_acc_drdy_gpio
+                         , error_t *const err );
+
+void
+i2c_sensors_events_stop (i2c_sensors_t *const sensors);
+
+/* Sleep until a sensor signals or its timer tick comes, up to timeout_ms (-1:
+ * forever), and service only the sensors that are due. Results not serviced
+ * have have_result false. A result read because its data-ready line fired is
+ * timed at the wake-up rather than at the end of the transfer.
+ */
+bool
+i2c_sensors_wait ( i2c_sensors_t *const sensors, i2c_sensors_result_t *const res
+                 , const int timeout_ms, error_t *const err );
+
+void
+i2c_sensors_stats ( const i2c_sensors_t *const sensors
+                  , i2c_sensors_stats_t *const stats );
+
 #endif /* INCLUDE_I2C_SENSORS_H */
@@ -0,0 +1,574 @@
+/* In-process simulation of the BMP085, L3GD20 and LSM303DLHC on one bus */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2c-sim.h"
+
+#include "bmp085.h"
+#include "common.h"
+#include "error-utilities.h"
+#include "i2c-bus.h"
+#include "i2c-utilities.h"
+#include "time-utilities.h"
+
+#define BMP085_ADDR 0x77
+#define L3GD20_ADDR 0x6b
+#define ACC_ADDR    0x19
+#define MAG_ADDR    0x1e
+
+/* ST sub-address MSB */
+#define AUTO_INCREMENT (1<<7)
+
+/* The L3GD20 and the LSM303DLHC accelerometer share this part of the map. */
+#define ST_CTRL_REG1     0x20
+#define ST_CTRL_REG4     0x23
+#define ST_CTRL_REG5     0x24
+#define ST_STATUS_REG    0x27
+#define ST_OUT_X_L       0x28
+#define ST_OUT_Z_H       0x2d
+#define ST_FIFO_CTRL_REG 0x2e
+#define ST_FIFO_SRC_REG  0x2f
+
+#define ST_CTRL_REG4_BLE     (1<<6)
+#define ST_CTRL_REG5_FIFO_EN (1<<6)
+#define ST_STATUS_REG_ZYXOR  (1<<7)
+#define ST_STATUS_REG_ZYXDA  (1<<3)
+#define ST_FIFO_SRC_WTM      (1<<7)
+#define ST_FIFO_SRC_OVRN     (1<<6)
+#define ST_FIFO_SRC_EMPTY    (1<<5)
+
+#define L3GD20_WHO_AM_I     0x0f
+#define L3GD20_CTRL_REG1_PD (1<<3)
+
+#define MAG_CRA_REG 0x00
+#define MAG_MR_REG  0x02
+#define MAG_OUT_X_H 0x03
+#define MAG_OUT_Y_L 0x08
+#define MAG_SR_REG  0x09
+#define MAG_IRA_REG 0x0a
+#define MAG_SR_DRDY (1<<0)
+
+#define BMP085_CALIB_REG   0xaa
+#define BMP085_CHIP_ID_REG 0xd0
+#define BMP085_CTRL_REG    0xf4
+#define BMP085_DATA        0xf6
+#define BMP085_CTRL_TEMP   0x2e
+#define BMP085_CTRL_PRES   0x34
+
+#define BMP085_TEMP_TIME 4500000  /* ns */
+
+static const int64_t bmp085_pres_times[4] =  /* ns, by oss */
+  { 4500000, 7500000, 13500000, 25500000 };
+
+#define FIFO_SIZE 32
+
+/* After a long quiet spell, only this many samples are made up for. */
+#define MAX_CATCH_UP (2 * FIFO_SIZE)
+
+typedef enum { CHIP_BMP085, CHIP_L3GD20, CHIP_ACC, CHIP_MAG, N_CHIPS } chip_t;
+
+typedef enum { FIFO_BYPASS, FIFO_FIFO, FIFO_STREAM } fifo_mode_t;
+
+typedef struct {
+  chip_t chip;
+  uint16_t addr;
+  uint8_t regs[256];
+  uint8_t pointer;
+  bool increment;
+
+  /* Samples at the output data rate */
+  int64_t t0;         /* When the rate was last set */
+  uint64_t produced;  /* Since t0 */
+  int16_t out[3];     /* x, y, z in the output registers */
+  bool unread;        /* Status DA: out has not been read */
+  bool overrun;       /* Status OR: a sample replaced an unread one */
+  int16_t fifo[FIFO_SIZE][3];
+  unsigned fifo_head, fifo_count;
+
+  /* BMP085 conversion in progress */
+  bool converting;
+  int64_t conversion_end;
+  uint8_t conversion[3];  /* What DATA will read once it ends */
+} device_t;
+
+struct i2c_sim {
+  i2c_sim_config_t config;
+  device_t devices[N_CHIPS];
+  unsigned long transfers;
+  int64_t busy;
+};
+
+static bool transfer ( i2c_sim_t *const sim, struct i2c_msg *const msgs
+                     , const unsigned n_msgs, error_t *const err );
+static device_t *find (i2c_sim_t *const sim, const uint16_t addr);
+static void advance (device_t *const dev, const int64_t now);
+static int64_t period (const device_t *const dev);
+static void sample ( const device_t *const dev, const uint64_t k
+                   , int16_t *const v );
+static fifo_mode_t fifo_mode (const device_t *const dev);
+static bool fifo_active (const device_t *const dev);
+static void set_pointer (device_t *const dev, const uint8_t command);
+static void next_pointer (device_t *const dev);
+static uint8_t read_reg (device_t *const dev);
+static void write_reg ( device_t *const dev, const uint8_t value
+                      , const int64_t now );
+
+i2c_sim_t *
+i2c_sim_new (const i2c_sim_config_t *const config, error_t *const err)
+{
+  if (config->hz == 0) {
+    error_insert (err, "i2c_sim_new: bus clock of 0 Hz");
+    return NULL;
+  }
+
+  i2c_sim_t *sim = calloc (1, sizeof (i2c_sim_t));
+  if (! sim) {
+    error_errno (err);
+    error_prefix (err, "i2c_sim_new: calloc failed");
+    return NULL;
+  }
+
+  sim->config = *config;
+
+  const uint16_t addrs[N_CHIPS] = { [CHIP_BMP085] = BMP085_ADDR
+                                  , [CHIP_L3GD20] = L3GD20_ADDR
+                                  , [CHIP_ACC]    = ACC_ADDR
+                                  , [CHIP_MAG]    = MAG_ADDR };
+  int64_t now = time_monotonic ();
+  for (int chip = 0; chip < N_CHIPS; ++chip) {
+    sim->devices[chip].chip = chip;
+    sim->devices[chip].addr = addrs[chip];
+    sim->devices[chip].t0 = now;
+  }
+
+  /* Power-on defaults: everything powered down */
+  device_t *gyro = &sim->devices[CHIP_L3GD20]
+         , *acc  = &sim->devices[CHIP_ACC]
+         , *mag  = &sim->devices[CHIP_MAG]
+         , *baro = &sim->devices[CHIP_BMP085];
+
+  gyro->regs[L3GD20_WHO_AM_I] = 0xd4;
+  gyro->regs[ST_CTRL_REG1] = 0x07;
+  acc->regs[ST_CTRL_REG1] = 0x07;
+
+  mag->regs[MAG_CRA_REG] = 0x10;
+  mag->regs[MAG_MR_REG] = 0x03;
+  memcpy (&mag->regs[MAG_IRA_REG], "H43", 3);
+
+  /* The datasheet example calibration, big-endian like the EEPROM */
+  const bmp085_calib_t example = BMP085_CALIB_EXAMPLE;
+  const uint16_t calib[11] = { example.ac1, example.ac2, example.ac3
+                             , example.ac4, example.ac5, example.ac6
+                             , example.b1, example.b2, example.mb
+                             , example.mc, example.md };
+  for (int i = 0; i < 11; ++i) {
+    baro->regs[BMP085_CALIB_REG + 2*i]     = calib[i] >> 8;
+    baro->regs[BMP085_CALIB_REG + 2*i + 1] = calib[i] & 0xff;
+  }
+  baro->regs[BMP085_CHIP_ID_REG] = 0x55;
+
+  return sim;
+}
+
+void
+i2c_sim_free (i2c_sim_t *const sim)
+{
+  sim->transfers = POISON;
+  free (sim);
+}
+
+i2c_bus_t *
+i2c_sim_bus_new (i2c_sim_t *const sim, error_t *const err)
+{
+  i2c_bus_t *bus = i2c_bus_new_transport (&i2c_sim_transport, sim, err);
+  if (! bus)
+    error_prefix (err, "i2c_sim_bus_new");
+
+  return bus;
+}
+
+unsigned long
+i2c_sim_transfers (const i2c_sim_t *const sim)
+{
+  return sim->transfers;
+}
+
+int64_t
+i2c_sim_busy (const i2c_sim_t *const sim)
+{
+  return sim->busy;
+}
+
+static bool
+sim_select (void *const ctx, const uint16_t addr, error_t *const err)
+{
+  if (! find (ctx, addr)) {
+    error_strerror (err, ENXIO);
+    error_prefix_printf (err, "i2c_sim: nothing at 0x%02x", addr);
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+sim_read_block ( void *const ctx, const uint16_t addr, const uint8_t command
+               , uint8_t *const data, const uint16_t len, error_t *const err )
+{
+  uint8_t cmd = command;
+  struct i2c_msg msgs[2] =
+    { { .addr = addr, .flags = 0,        .len = 1,   .buf = &cmd }
+    , { .addr = addr, .flags = I2C_M_RD, .len = len, .buf = data }
+    };
+
+  return transfer (ctx, msgs, 2, err);
+}
+
+static bool
+sim_write_u8 ( void *const ctx, const uint16_t addr, const uint8_t command
+             , const uint8_t data, error_t *const err )
+{
+  uint8_t buf[2] = { command, data };
+  struct i2c_msg msg = { .addr = addr, .flags = 0, .len = 2, .buf = buf };
+
+  return transfer (ctx, &msg, 1, err);
+}
+
+static bool
+sim_transfer (void *const ctx, i2c_batch_t *const batch, error_t *const err)
+{
+  if (batch->n_msgs == 0)
+    return true;
+
+  return transfer (ctx, batch->msgs, batch->n_msgs, err);
+}
+
+const i2c_transport_t i2c_sim_transport =
+  { .name = "sim", .select = sim_select, .read_block = sim_read_block
+  , .write_u8 = sim_write_u8, .transfer = sim_transfer, .free = NULL };
+
+/* Carry out the messages back to back, like one I2C_RDWR. */
+static bool
+transfer ( i2c_sim_t *const sim, struct i2c_msg *const msgs
+         , const unsigned n_msgs, error_t *const err )
+{
+  int64_t now = time_monotonic ();
+  uint64_t bits = 1;  /* Stop */
+
+  for (unsigned i = 0; i < n_msgs; ++i) {
+    struct i2c_msg *msg = &msgs[i];
+    device_t *dev = find (sim, msg->addr);
+    if (! dev) {
+      error_strerror (err, ENXIO);
+      error_prefix_printf (err, "i2c_sim: no ACK from 0x%02x", msg->addr);
+      return false;
+    }
+
+    advance (dev, now);
+
+    if (msg->flags & I2C_M_RD) {
+      for (uint16_t j = 0; j < msg->len; ++j) {
+        msg->buf[j] = read_reg (dev);
+        next_pointer (dev);
+      }
+    } else if (msg->len > 0) {
+      set_pointer (dev, msg->buf[0]);
+      for (uint16_t j = 1; j < msg->len; ++j) {
+        write_reg (dev, msg->buf[j], now);
+        next_pointer (dev);
+      }
+    }
+
+    /* (Repeated) start, then the address and the payload with their ACKs */
+    bits += 1 + 9 * (1 + msg->len);
+  }
+
+  int64_t cost = bits * NS_PER_S / sim->config.hz + sim->config.overhead;
+  sim->busy += cost;
+  ++sim->transfers;
+
+  if (sim->config.delay)
+    time_sleep_until (now + cost);
+
+  return true;
+}
+
+static device_t *
+find (i2c_sim_t *const sim, const uint16_t addr)
+{
+  for (int chip = 0; chip < N_CHIPS; ++chip)
+    if (sim->devices[chip].addr == addr)
+      return &sim->devices[chip];
+
+  return NULL;
+}
+
+/* Bring the chip up to now: finish its conversion, take its samples. */
+static void
+advance (device_t *const dev, const int64_t now)
+{
+  if (dev->chip == CHIP_BMP085) {
+    if (dev->converting && now >= dev->conversion_end) {
+      memcpy (&dev->regs[BMP085_DATA], dev->conversion, 3);
+      dev->converting = false;
+    }
+    return;
+  }
+
+  int64_t p = period (dev);
+  if (p == 0)
+    return;
+
+  uint64_t due = (now - dev->t0) / p;
+  if (due > dev->produced + MAX_CATCH_UP)
+    dev->produced = due - MAX_CATCH_UP;
+
+  for (; dev->produced < due; ++dev->produced) {
+    int16_t v[3];
+    sample (dev, dev->produced, v);
+
+    if (! fifo_active (dev)) {
+      dev->overrun = dev->unread;
+      dev->unread = true;
+      memcpy (dev->out, v, sizeof (v));
+      continue;
+    }
+
+    if (dev->fifo_count == FIFO_SIZE) {
+      if (fifo_mode (dev) == FIFO_FIFO)
+        continue;
+
+      /* Stream mode: the oldest sample makes room. */
+      dev->fifo_head = (dev->fifo_head + 1) % FIFO_SIZE;
+      --dev->fifo_count;
+    }
+
+    unsigned tail = (dev->fifo_head + dev->fifo_count) % FIFO_SIZE;
+    memcpy (dev->fifo[tail], v, sizeof (v));
+    ++dev->fifo_count;
+  }
+}
+
+/* ns between samples at the configured output data rate, 0 when off */
+static int64_t
+period (const device_t *const dev)
+{
+  static const int gyro_rates[4] = { 95, 190, 380, 760 };  /* Hz */
+  static const int acc_rates[10] =
+    { 0, 1, 10, 25, 50, 100, 200, 400, 1620, 1344 };
+  static const int mag_rates[8] =  /* mHz */
+    { 750, 1500, 3000, 7500, 15000, 30000, 75000, 220000 };
+
+  uint8_t reg;
+
+  switch (dev->chip) {
+  case CHIP_L3GD20:
+    reg = dev->regs[ST_CTRL_REG1];
+    if (! (reg & L3GD20_CTRL_REG1_PD))
+      return 0;
+    return NS_PER_S / gyro_rates[reg >> 6];
+  case CHIP_ACC:
+    reg = dev->regs[ST_CTRL_REG1] >> 4;
+    if (reg >= 10 || acc_rates[reg] == 0)
+      return 0;
+    return NS_PER_S / acc_rates[reg];
+  case CHIP_MAG:
+    if (dev->regs[MAG_MR_REG] & 0x03)  /* Not continuous */
+      return 0;
+    reg = (dev->regs[MAG_CRA_REG] >> 2) & 0x07;
+    return NS_PER_S * 1000LL / mag_rates[reg];
+  default:
+    return 0;
+  }
+}
+
+/* Sample k of a level, slowly turning aircraft with a bit of noise, in the
+ * units the drivers configure.
+ */
+static void
+sample (const device_t *const dev, const uint64_t k, int16_t *const v)
+{
+  static const int16_t base[N_CHIPS][3] =
+    { [CHIP_L3GD20] = { 14, -7, 143 }   /* 70 m°/s: about 1, 0.5, 10 °/s */
+    , [CHIP_ACC]    = { 0, 0, 83 }      /* 12 mg: 1 g down */
+    , [CHIP_MAG]    = { 46, 0, -82 } }; /* 0.2 and -0.4 gauss */
+
+  for (int axis = 0; axis < 3; ++axis) {
+    int noise = (int)((k * 37 + axis * 11) % 9) - 4;
+    v[axis] = base[dev->chip][axis] + noise;
+  }
+
+  /* 12-bit values come left-justified. */
+  if (dev->chip == CHIP_ACC)
+    for (int axis = 0; axis < 3; ++axis)
+      v[axis] *= 16;
+}
+
+static fifo_mode_t
+fifo_mode (const device_t *const dev)
+{
+  uint8_t reg = dev->regs[ST_FIFO_CTRL_REG];
+  unsigned fm = dev->chip == CHIP_L3GD20 ? reg >> 5 : reg >> 6;
+
+  return fm == 0 ? FIFO_BYPASS : fm == 1 ? FIFO_FIFO : FIFO_STREAM;
+}
+
+static bool
+fifo_active (const device_t *const dev)
+{
+  return (dev->chip == CHIP_L3GD20 || dev->chip == CHIP_ACC) &&
+         (dev->regs[ST_CTRL_REG5] & ST_CTRL_REG5_FIFO_EN) &&
+         fifo_mode (dev) != FIFO_BYPASS;
+}
+
+static void
+set_pointer (device_t *const dev, const uint8_t command)
+{
+  if (dev->chip == CHIP_L3GD20 || dev->chip == CHIP_ACC) {
+    dev->pointer = command & ~AUTO_INCREMENT;
+    dev->increment = command & AUTO_INCREMENT;
+  } else {
+    dev->pointer = command;
+    dev->increment = true;
+  }
+}
+
+static void
+next_pointer (device_t *const dev)
+{
+  if (! dev->increment)
+    return;
+
+  if (dev->chip == CHIP_MAG && dev->pointer == MAG_OUT_Y_L)
+    dev->pointer = MAG_OUT_X_H;
+  else if (dev->pointer == ST_OUT_Z_H && fifo_active (dev))
+    dev->pointer = ST_OUT_X_L;
+  else
+    ++dev->pointer;
+}
+
+static uint8_t
+read_reg (device_t *const dev)
+{
+  uint8_t reg = dev->pointer;
+
+  if (dev->chip == CHIP_MAG) {
+    if (reg == MAG_SR_REG)
+      return dev->unread ? MAG_SR_DRDY : 0;
+
+    if (reg >= MAG_OUT_X_H && reg <= MAG_OUT_Y_L) {
+      /* X, Z, Y; high byte first */
+      static const int axes[3] = { 0, 2, 1 };
+      int i = reg - MAG_OUT_X_H;
+      uint16_t value = dev->out[axes[i / 2]];
+
+      dev->unread = false;
+      return i % 2 ? value & 0xff : value >> 8;
+    }
+
+    return dev->regs[reg];
+  }
+
+  if (dev->chip == CHIP_BMP085)
+    return dev->regs[reg];
+
+  bool fifo = fifo_active (dev);
+
+  if (reg == ST_STATUS_REG) {
+    if (fifo)
+      return (dev->fifo_count > 0 ? ST_STATUS_REG_ZYXDA : 0) |
+             (dev->fifo_count == FIFO_SIZE ? ST_STATUS_REG_ZYXOR : 0);
+
+    return (dev->unread ? ST_STATUS_REG_ZYXDA : 0) |
+           (dev->overrun ? ST_STATUS_REG_ZYXOR : 0);
+  }
+
+  if (reg == ST_FIFO_SRC_REG) {
+    unsigned watermark = dev->regs[ST_FIFO_CTRL_REG] & 0x1f;
+    return (dev->fifo_count >= watermark ? ST_FIFO_SRC_WTM : 0) |
+           (dev->fifo_count == FIFO_SIZE ? ST_FIFO_SRC_OVRN : 0) |
+           (dev->fifo_count == 0 ? ST_FIFO_SRC_EMPTY : 0) |
+           (dev->fifo_count & 0x1f);
+  }
+
+  if (reg >= ST_OUT_X_L && reg <= ST_OUT_Z_H) {
+    int i = reg - ST_OUT_X_L;
+    const int16_t *v = fifo && dev->fifo_count ? dev->fifo[dev->fifo_head]
+                                               : dev->out;
+    uint16_t value = v[i / 2];
+    bool high = i % 2;
+    if (dev->regs[ST_CTRL_REG4] & ST_CTRL_REG4_BLE)
+      high = ! high;
+
+    if (! fifo) {
+      dev->unread = dev->overrun = false;
+    } else if (reg == ST_OUT_Z_H && dev->fifo_count) {
+      /* The last byte of a sample pops it. */
+      memcpy (dev->out, v, sizeof (dev->out));
+      dev->fifo_head = (dev->fifo_head + 1) % FIFO_SIZE;
+      --dev->fifo_count;
+    }
+
+    return high ? value >> 8 : value & 0xff;
+  }
+
+  return dev->regs[reg];
+}
+
+static void
+write_reg (device_t *const dev, const uint8_t value, const int64_t now)
+{
+  uint8_t reg = dev->pointer
+        , old = dev->regs[reg];
+  dev->regs[reg] = value;
+
+  switch (dev->chip) {
+  case CHIP_BMP085:
+    if (reg != BMP085_CTRL_REG)
+      break;
+
+    if (value == BMP085_CTRL_TEMP) {
+      /* The datasheet example */
+      dev->conversion[0] = BMP085_UT_EXAMPLE >> 8;
+      dev->conversion[1] = BMP085_UT_EXAMPLE & 0xff;
+      dev->conversion[2] = 0;
+      dev->conversion_end = now + BMP085_TEMP_TIME;
+      dev->converting = true;
+    } else if ((value & 0x3f) == BMP085_CTRL_PRES) {
+      /* The example's UP, of 16 + BMP085_OSS_EXAMPLE bits, left-justified
+       * in 24; oss extra bits below those read as 0
+       */
+      uint32_t up = (uint32_t)BMP085_UP_EXAMPLE << (8 - BMP085_OSS_EXAMPLE);
+      dev->conversion[0] = up >> 16;
+      dev->conversion[1] = (up >> 8) & 0xff;
+      dev->conversion[2] = up & 0xff;
+      dev->conversion_end = now + bmp085_pres_times[value >> 6];
+      dev->converting = true;
+    }
+    break;
+
+  case CHIP_L3GD20:
+  case CHIP_ACC:
+    if (reg == ST_CTRL_REG1) {
+      dev->t0 = now;
+      dev->produced = 0;
+    } else if ((reg == ST_FIFO_CTRL_REG && fifo_mode (dev) == FIFO_BYPASS) ||
+               (reg == ST_CTRL_REG5 &&
+                ((old ^ value) & ST_CTRL_REG5_FIFO_EN))) {
+      dev->fifo_head = dev->fifo_count = 0;
+    }
+    break;
+
+  case CHIP_MAG:
+    if (reg == MAG_CRA_REG || reg == MAG_MR_REG) {
+      dev->t0 = now;
+      dev->produced = 0;
+    }
+    break;
+
+  default:
+    break;
+  }
+}
@@ -0,0 +1,52 @@
+/* In-process simulation of the BMP085, L3GD20 and LSM303DLHC on one bus
+ *
+ * Register maps as the datasheets have them, as far as the drivers go:
+ * auto-increment (on the sub-address MSB for the ST chips, always for the
+ * others, with the magnetometer wrapping from OUT_Y_L to OUT_X_H and the FIFO
+ * outputs from OUT_Z_H to OUT_X_L), STATUS/SR data-ready and overrun bits
+ * following the configured output data rates, the FIFOs in bypass, FIFO and
+ * stream mode, and BMP085 conversions that take their datasheet time. There
+ * are no interrupt lines, so the BMP085 has to be used without its EOC GPIO.
+ *
+ * Every transfer costs its wire time at the configured clock plus a fixed
+ * overhead, which is either waited out or only added up.
+ */
+
+#ifndef INCLUDE_I2C_SIM_H
+#define INCLUDE_I2C_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "error-utilities.h"
+#include "i2c-bus.h"
+
+typedef struct i2c_sim i2c_sim_t;
+
+typedef struct {
+  unsigned long hz;  /* Bus clock: 100000 or 400000 */
+  int64_t overhead;  /* ns per transfer on top of the wire time */
+  bool delay;        /* Take that long; otherwise only count it */
+} i2c_sim_config_t;
+
+extern const i2c_transport_t i2c_sim_transport;
+
+i2c_sim_t *
+i2c_sim_new (const i2c_sim_config_t *const config, error_t *const err);
+
+void
+i2c_sim_free (i2c_sim_t *const sim);
+
+/* A bus on the simulation. The simulation has to outlive it. */
+i2c_bus_t *
+i2c_sim_bus_new (i2c_sim_t *const sim, error_t *const err);
+
+/* Transfers so far: read_block, write_u8 and transfer calls. */
+unsigned long
+i2c_sim_transfers (const i2c_sim_t *const sim);
+
+/* ns the modelled bus has been busy so far, overhead included. */
+int64_t
+i2c_sim_busy (const i2c_sim_t *const sim);
+
+#endif /* INCLUDE_I2C_SIM_H */
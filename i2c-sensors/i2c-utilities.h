@@ -37,57 +37,84 @@ i2c_read_u8 ( const int fd, const uint8_t command, uint8_t *const data
   return true;
 }
 
+/* Read len consecutive registers starting at command as one combined
+ * transaction: write the register address, repeated start, read len bytes.
+ * The chip has to auto-increment its register pointer for this to work; the
+ * ST chips only do that when the MSB of the sub-address is set.
+ *
+ * I2C_RDWR carries the slave address in the message, so this does not depend
+ * on a preceding i2c_slave.
+ */
 static inline bool
-i2c_read_u16 ( const int fd, const uint8_t command, uint16_t *const data
-             , error_t *const err )
+i2c_read_block ( const int fd, const uint16_t addr, const uint8_t command
+               , uint8_t *const data, const uint16_t len, error_t *const err )
 {
-  int32_t b0, b1;
-  if (((b0 = i2c_smbus_read_byte_data (fd, command+0)) < 0) ||
-      ((b1 = i2c_smbus_read_byte_data (fd, command+1)) < 0)) {
+  uint8_t cmd = command;
+  struct i2c_msg msgs[2] =
+    { { .addr = addr, .flags = 0,        .len = 1,   .buf = &cmd }
+    , { .addr = addr, .flags = I2C_M_RD, .len = len, .buf = data }
+    };
+  struct i2c_rdwr_ioctl_data rdwr = { .msgs = msgs, .nmsgs = 2 };
+
+  if (ioctl (fd, I2C_RDWR, &rdwr) < 0) {
     error_errno (err);
-    error_prefix (err, "i2c_read_u16: i2c_smbus_read_byte_data failed");
+    error_prefix_printf ( err, "i2c_read_block: ioctl I2C_RDWR %d 0x%02x failed"
+                        , addr, command );
     return false;
   }
 
-  *data = (b0<<8) | b1;
   return true;
 }
 
 static inline bool
-i2c_read_u24 ( const int fd, const uint8_t command, uint32_t *const data
-             , error_t *const err )
+i2c_read_u16 ( const int fd, const uint16_t addr, const uint8_t command
+             , uint16_t *const data, error_t *const err )
 {
-  int32_t b0, b1, b2;
-  if (((b0 = i2c_smbus_read_byte_data (fd, command+0)) < 0) ||
-      ((b1 = i2c_smbus_read_byte_data (fd, command+1)) < 0) ||
-      ((b2 = i2c_smbus_read_byte_data (fd, command+2)) < 0)) {
-    error_errno (err);
-    error_prefix (err, "i2c_read_u24: i2c_smbus_read_byte_data failed");
+  uint8_t b[2];
+  if (! i2c_read_block (fd, addr, command, b, 2, err)) {
+    error_prefix (err, "i2c_read_u16");
     return false;
   }
 
-  *data = (b0<<16) | (b1<<8) | b2;
+  *data = (b[0]<<8) | b[1];
   return true;
 }
 
 static inline bool
-i2c_read_u32 ( const int fd, const uint8_t command, uint32_t *const data
-             , error_t *const err )
+i2c_read_u24 ( const int fd, const uint16_t addr, const uint8_t command
+             , uint32_t *const data, error_t *const err )
 {
-  int32_t b0, b1, b2, b3;
-  if (((b0 = i2c_smbus_read_byte_data (fd, command+0)) < 0) ||
-      ((b1 = i2c_smbus_read_byte_data (fd, command+1)) < 0) ||
-      ((b2 = i2c_smbus_read_byte_data (fd, command+2)) < 0) ||
-      ((b3 = i2c_smbus_read_byte_data (fd, command+3)) < 0)) {
-    error_errno (err);
-    error_prefix (err, "i2c_read_u32: i2c_smbus_read_byte_data failed");
+  uint8_t b[3];
+  if (! i2c_read_block (fd, addr, command, b, 3, err)) {
+    error_prefix (err, "i2c_read_u24");
+    return false;
+  }
+
+  *data = (b[0]<<16) | (b[1]<<8) | b[2];
+  return true;
+}
+
+static inline bool
+i2c_read_u32 ( const int fd, const uint16_t addr, const uint8_t command
+             , uint32_t *const data, error_t *const err )
+{
+  uint8_t b[4];
+  if (! i2c_read_block (fd, addr, command, b, 4, err)) {
+    error_prefix (err, "i2c_read_u32");
     return false;
   }
 
-  *data = (b0<<24) | (b1<<16) | (b2<<8) | b3;
+  *data = ((uint32_t)b[0]<<24) | (b[1]<<16) | (b[2]<<8) | b[3];
   return true;
 }
 
+/* Big-endian 16-bit value from a block read buffer. */
+static inline uint16_t
+i2c_be16 (const uint8_t *const b)
+{
+  return (b[0]<<8) | b[1];
+}
+
 static inline bool
 i2c_write_u8 ( const int fd, const uint8_t command, const uint8_t data
              , error_t *const err )
@@ -101,4 +128,99 @@ i2c_write_u8 ( const int fd, const uint8_t command, const uint8_t data
   return true;
 }
 
+/* A list of messages submitted to the adapter with a single I2C_RDWR ioctl.
+ * Reads land in the batch's own buffer; i2c_batch_read hands out where, and
+ * the data is valid after i2c_batch_submit succeeds.
+ */
+#define I2C_BATCH_MSGS   42  /* I2C_RDWR_IOCTL_MAX_MSGS */
+#define I2C_BATCH_BUFFER 256
+
+typedef struct i2c_batch {
+  struct i2c_msg msgs[I2C_BATCH_MSGS];
+  uint16_t n_msgs;
+  uint8_t buffer[I2C_BATCH_BUFFER];
+  uint16_t buffer_used;
+} i2c_batch_t;
+
+static inline void
+i2c_batch_clear (i2c_batch_t *const batch)
+{
+  batch->n_msgs = 0;
+  batch->buffer_used = 0;
+}
+
+static inline bool
+i2c_batch_reserve ( i2c_batch_t *const batch, const uint16_t n_msgs
+                  , const uint16_t n_bytes, error_t *const err )
+{
+  if (batch->n_msgs + n_msgs > I2C_BATCH_MSGS ||
+      batch->buffer_used + n_bytes > I2C_BATCH_BUFFER) {
+    error_insert (err, "i2c_batch_reserve: batch full");
+    return false;
+  }
+
+  return true;
+}
+
+/* Queue a register address write followed by a read of len bytes. */
+static inline bool
+i2c_batch_read ( i2c_batch_t *const batch, const uint16_t addr
+               , const uint8_t command, const uint16_t len
+               , uint8_t **const data, error_t *const err )
+{
+  if (! i2c_batch_reserve (batch, 2, 1 + len, err))
+    return false;
+
+  uint8_t *cmd = &batch->buffer[batch->buffer_used];
+  *cmd = command;
+  *data = cmd + 1;
+  batch->buffer_used += 1 + len;
+
+  batch->msgs[batch->n_msgs++] =
+    (struct i2c_msg){ .addr = addr, .flags = 0, .len = 1, .buf = cmd };
+  batch->msgs[batch->n_msgs++] =
+    (struct i2c_msg){ .addr = addr, .flags = I2C_M_RD, .len = len
+                    , .buf = *data };
+
+  return true;
+}
+
+static inline bool
+i2c_batch_write_u8 ( i2c_batch_t *const batch, const uint16_t addr
+                   , const uint8_t command, const uint8_t data
+                   , error_t *const err )
+{
+  if (! i2c_batch_reserve (batch, 1, 2, err))
+    return false;
+
+  uint8_t *buf = &batch->buffer[batch->buffer_used];
+  buf[0] = command;
+  buf[1] = data;
+  batch->buffer_used += 2;
+
+  batch->msgs[batch->n_msgs++] =
+    (struct i2c_msg){ .addr = addr, .flags = 0, .len = 2, .buf = buf };
+
+  return true;
+}
+
+static inline bool
+i2c_batch_submit (const int fd, i2c_batch_t *const batch, error_t *const err)
+{
+  if (batch->n_msgs == 0)
+    return true;
+
+  struct i2c_rdwr_ioctl_data rdwr = { .msgs = batch->msgs
+                                    , .nmsgs = batch->n_msgs };
+  if (ioctl (fd, I2C_RDWR, &rdwr) < 0) {
+    error_errno (err);
+    error_prefix_printf ( err
+                        , "i2c_batch_submit: ioctl I2C_RDWR (%u msgs) failed"
+                        , batch->n_msgs );
+    return false;
+  }
+
+  return true;
+}
+
 #endif /* INCLUDE_I2C_UTILITIES_H */
@@ -2,13 +2,18 @@
 
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 #include "l3gd20.h"
 
 #include "common.h"
+#include "convert.h"
 #include "error-utilities.h"
+#include "gyro-bias.h"
+#include "i2c-bus.h"
 #include "i2c-utilities.h"
+#include "time-utilities.h"
 
 #define ADDR 0x6b
 
@@ -27,6 +32,10 @@
 #define OUT_Y_H 0x2b
 #define OUT_Z_L 0x2c
 #define OUT_Z_H 0x2d
+#define FIFO_SRC_REG 0x2f
+
+/* Sub-address MSB: auto-increment the register address on multi-byte reads. */
+#define AUTO_INCREMENT (1<<7)
 
 #define CTRL_REG1_DR1 (1<<7)
 #define CTRL_REG1_DR0 (1<<6)
@@ -85,12 +94,35 @@
 #define STATUS_REG_YDA   (1<<1)
 #define STATUS_REG_XDA   (1<<0)
 
+#define FIFO_SRC_REG_WTM   (1<<7)
+#define FIFO_SRC_REG_OVRN  (1<<6)
+#define FIFO_SRC_REG_EMPTY (1<<5)
+#define FIFO_SRC_REG_FSS   0x1f
+
 struct l3gd20 {
-  int fd;
+  i2c_bus_t *bus;
+  sample_scale_t scale;
+  gyro_bias_t *bias;         /* NULL unless attached */
+  int temp;                  /* OUT_TEMP as last read */
+  unsigned long since_temp;  /* Samples converted since then */
+  uint8_t *batch_data;  /* OUT_TEMP..OUT_Z_H in a pending batch */
 };
 
+static bool fifo_read ( l3gd20_t *const l3gd20, uint8_t *const data
+                      , const size_t max, size_t *const count
+                      , bool *const overrun, error_t *const err );
+static bool read_temp (l3gd20_t *const l3gd20, error_t *const err);
+static void set_temp (l3gd20_t *const l3gd20, const int temp);
+static inline bool temp_due (const l3gd20_t *const l3gd20);
+static bool update_reg3 ( l3gd20_t *const l3gd20, const uint8_t bits
+                        , const bool set, bool *const was
+                        , error_t *const err );
+static void decode (const uint8_t *const data, sample_raw_t *const sample);
+static void convert ( l3gd20_t *const l3gd20, const sample_raw_t *const sample
+                    , l3gd20_result_t *const res );
+
 l3gd20_t *
-l3gd20_new (const int i2c_fd, error_t *const err)
+l3gd20_new (i2c_bus_t *const bus, error_t *const err)
 {
   l3gd20_t *l3gd20 = malloc (sizeof (l3gd20_t));
   if (! l3gd20) {
@@ -99,20 +131,22 @@ l3gd20_new (const int i2c_fd, error_t *const err)
     goto malloc_failed;
   }
 
-  l3gd20->fd = i2c_fd;
-
-  if (! i2c_slave (i2c_fd, ADDR, err))
-    goto i2c_slave_failed;
+  l3gd20->bus = bus;
+  l3gd20->scale = (sample_scale_t){ { L3GD20_SCALE, L3GD20_SCALE, L3GD20_SCALE }
+                                  , { 0, 0, 0 } };
+  l3gd20->bias = NULL;
+  l3gd20->temp = 0;
+  l3gd20->since_temp = 0;
 
   uint8_t reg1 = CTRL_REG1_DR1 | CTRL_REG1_DR0 | CTRL_REG1_BW1 | CTRL_REG1_BW0
                | CTRL_REG1_PD  | CTRL_REG1_Zen | CTRL_REG1_Xen | CTRL_REG1_Yen
         , reg4 = CTRL_REG4_BDU | CTRL_REG4_BLE | CTRL_REG4_FS1 | CTRL_REG4_FS0;
-  if (! (i2c_write_u8 (i2c_fd, CTRL_REG1, reg1, err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG2, 0,    err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG3, 0,    err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG4, reg4, err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG5, 0,    err) &&
-         i2c_write_u8 (i2c_fd, FIFO_CTRL_REG, 0, err))) {
+  if (! (i2c_bus_write_u8 (bus, ADDR, CTRL_REG1, reg1, err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG2, 0,    err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG3, 0,    err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG4, reg4, err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG5, 0,    err) &&
+         i2c_bus_write_u8 (bus, ADDR, FIFO_CTRL_REG, 0, err))) {
     error_prefix (err, "initialization");
     goto init_failed;
   }
@@ -120,7 +154,6 @@ l3gd20_new (const int i2c_fd, error_t *const err)
   return l3gd20;
 
 init_failed:
-i2c_slave_failed:
   free (l3gd20);
 
 malloc_failed:
@@ -131,7 +164,7 @@ malloc_failed:
 void
 l3gd20_free (l3gd20_t *const l3gd20)
 {
-  l3gd20->fd = POISON;
+  l3gd20->bus = (i2c_bus_t *)POISON;
   free (l3gd20);
 }
 
@@ -139,39 +172,323 @@ bool
 l3gd20_run ( l3gd20_t *const l3gd20, l3gd20_result_t *const res
            , error_t *const err )
 {
-  uint8_t  status;
-  uint16_t x, y, z;
+  sample_raw_t sample;
+  bool fresh;
 
   res->have_result = false;
 
-  if (! i2c_slave (l3gd20->fd, ADDR, err))
-    goto error;
+  if (! (l3gd20_run_raw (l3gd20, &sample, &fresh, err) &&
+         (! (fresh && temp_due (l3gd20)) || read_temp (l3gd20, err)))) {
+    error_prefix (err, "l3gd20_run");
+    return false;
+  }
+
+  if (fresh)
+    convert (l3gd20, &sample, res);
 
-  if (! i2c_read_u8 (l3gd20->fd, STATUS_REG, &status, err))
+  return true;
+}
+
+bool
+l3gd20_run_raw ( l3gd20_t *const l3gd20, sample_raw_t *const sample
+               , bool *const fresh, error_t *const err )
+{
+  uint8_t status;
+  uint8_t data[6];
+
+  *fresh = false;
+
+  if (! i2c_bus_read_u8 (l3gd20->bus, ADDR, STATUS_REG, &status, err))
     goto error;
 
   /* No new data available? */
   if (! (status & STATUS_REG_ZYXDA))
     return true;
 
-  /* New data available. */
-  if (! (i2c_read_u16 (l3gd20->fd, OUT_X_L, &x, err) &&
-         i2c_read_u16 (l3gd20->fd, OUT_Y_L, &y, err) &&
-         i2c_read_u16 (l3gd20->fd, OUT_Z_L, &z, err)))
+  /* New data available. With BLE set, OUT_X_L holds the high byte. */
+  if (! i2c_bus_read_block ( l3gd20->bus, ADDR, OUT_X_L|AUTO_INCREMENT, data, 6
+                           , err ))
+    goto error;
+
+  decode (data, sample);
+  sample->time = time_monotonic ();
+  *fresh = true;
+
+  return true;
+
+error:
+  error_prefix (err, "l3gd20_run_raw");
+  return false;
+}
+
+const sample_scale_t *
+l3gd20_scale (const l3gd20_t *const l3gd20)
+{
+  return &l3gd20->scale;
+}
+
+void
+l3gd20_gyro_bias (l3gd20_t *const l3gd20, gyro_bias_t *const gb)
+{
+  l3gd20->bias = gb;
+
+  /* Read OUT_TEMP with the next sample. */
+  l3gd20->since_temp = L3GD20_RATE;
+
+  for (int i = 0; i < 3; ++i)
+    l3gd20->scale.bias[i] = 0;
+}
+
+bool
+l3gd20_set_drdy ( l3gd20_t *const l3gd20, const bool enable
+                , bool *const previous, error_t *const err )
+{
+  if (! update_reg3 (l3gd20, CTRL_REG3_I2_DRDY, enable, previous, err)) {
+    error_prefix (err, "l3gd20_set_drdy");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+l3gd20_fifo_start ( l3gd20_t *const l3gd20, const unsigned watermark
+                  , error_t *const err )
+{
+  if (watermark >= L3GD20_FIFO_SIZE) {
+    error_printf (err, "Invalid watermark: %u", watermark);
+    goto error;
+  }
+
+  /* Go through bypass mode to reset the FIFO. */
+  uint8_t reg5 = CTRL_REG5_FIFO_EN
+        , fifo_ctrl = FIFO_CTRL_REG_FM1 | watermark;
+  if (! (i2c_bus_write_u8 (l3gd20->bus, ADDR, FIFO_CTRL_REG, 0, err) &&
+         i2c_bus_write_u8 (l3gd20->bus, ADDR, CTRL_REG5, reg5, err) &&
+         i2c_bus_write_u8 (l3gd20->bus, ADDR, FIFO_CTRL_REG, fifo_ctrl, err)))
+    goto error;
+
+  return true;
+
+error:
+  error_prefix (err, "l3gd20_fifo_start");
+  return false;
+}
+
+bool
+l3gd20_fifo_stop (l3gd20_t *const l3gd20, error_t *const err)
+{
+  if (! (i2c_bus_write_u8 (l3gd20->bus, ADDR, FIFO_CTRL_REG, 0, err) &&
+         i2c_bus_write_u8 (l3gd20->bus, ADDR, CTRL_REG5, 0, err))) {
+    error_prefix (err, "l3gd20_fifo_stop");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+l3gd20_fifo_drain ( l3gd20_t *const l3gd20, l3gd20_result_t *const res
+                  , const size_t max, size_t *const count
+                  , bool *const overrun, error_t *const err )
+{
+  uint8_t data[L3GD20_FIFO_SIZE * 6];
+
+  if (! (fifo_read (l3gd20, data, max, count, overrun, err) &&
+         (! (*count && temp_due (l3gd20)) || read_temp (l3gd20, err)))) {
+    error_prefix (err, "l3gd20_fifo_drain");
+    return false;
+  }
+
+  int64_t time = time_monotonic ();
+  size_t n = *count;
+
+  for (size_t i = 0; i < n; ++i) {
+    sample_raw_t sample;
+    decode (&data[i * 6], &sample);
+    sample.time = time - (int64_t)(n - 1 - i) * (NS_PER_S / L3GD20_RATE);
+    convert (l3gd20, &sample, &res[i]);
+  }
+
+  return true;
+}
+
+bool
+l3gd20_fifo_drain_block ( l3gd20_t *const l3gd20, sample_block_t *const block
+                        , error_t *const err )
+{
+  uint8_t data[L3GD20_FIFO_SIZE * 6] __attribute__ ((aligned (16)));
+
+  block->period = NS_PER_S / L3GD20_RATE;
+
+  if (! (fifo_read ( l3gd20, data, SAMPLE_BLOCK_SIZE, &block->count
+                    , &block->overrun, err ) &&
+         (! (block->count && temp_due (l3gd20)) ||
+          read_temp (l3gd20, err)))) {
+    error_prefix (err, "l3gd20_fifo_drain_block");
+    return false;
+  }
+
+  block->time = time_monotonic ();
+  convert_xyz ( data, block->count, &l3gd20->scale
+              , block->x, block->y, block->z );
+  if (l3gd20->bias)
+    l3gd20->since_temp += block->count;
+
+  return true;
+}
+
+bool
+l3gd20_batch_prepare ( l3gd20_t *const l3gd20, i2c_batch_t *const batch
+                     , error_t *const err )
+{
+  /* With BDU set the data block read right after STATUS_REG belongs to the
+   * sample STATUS_REG reported on. OUT_TEMP comes just before.
+   */
+  if (! i2c_batch_read ( batch, ADDR, OUT_TEMP|AUTO_INCREMENT, 8
+                       , &l3gd20->batch_data, err )) {
+    error_prefix (err, "l3gd20_batch_prepare");
+    return false;
+  }
+
+  return true;
+}
+
+void
+l3gd20_batch_finish (l3gd20_t *const l3gd20, l3gd20_result_t *const res)
+{
+  res->have_result = false;
+
+  if (! (l3gd20->batch_data[1] & STATUS_REG_ZYXDA))
+    return;
+
+  if (temp_due (l3gd20))
+    set_temp (l3gd20, (int8_t)l3gd20->batch_data[0]);
+
+  sample_raw_t sample;
+  decode (&l3gd20->batch_data[2], &sample);
+  sample.time = time_monotonic ();
+  convert (l3gd20, &sample, res);
+}
+
+/* Pop up to max samples with one burst. */
+static bool
+fifo_read ( l3gd20_t *const l3gd20, uint8_t *const data, const size_t max
+          , size_t *const count, bool *const overrun, error_t *const err )
+{
+  uint8_t src;
+
+  *count = 0;
+  *overrun = false;
+
+  if (! i2c_bus_read_u8 (l3gd20->bus, ADDR, FIFO_SRC_REG, &src, err))
     goto error;
 
-  /* 70: FS1|FS0
-   * pi/180000: milli°/s to radian/s
+  /* FSS counts up to 31; a full FIFO reports OVRN instead. */
+  size_t n = (src & FIFO_SRC_REG_OVRN)  ? L3GD20_FIFO_SIZE
+           : (src & FIFO_SRC_REG_EMPTY) ? 0
+           : (src & FIFO_SRC_REG_FSS);
+  if (n > max)
+    n = max;
+
+  *overrun = src & FIFO_SRC_REG_OVRN;
+
+  if (n == 0)
+    return true;
+
+  /* In FIFO mode the register address wraps from OUT_Z_H back to OUT_X_L,
+   * so one burst pops n samples.
    */
-  double scale = 70.0 * M_PI/180000.0;
-  res->have_result = true;
-  res->x = scale * (int16_t)x;
-  res->y = scale * (int16_t)y;
-  res->z = scale * (int16_t)z;
+  if (! i2c_bus_read_block ( l3gd20->bus, ADDR, OUT_X_L|AUTO_INCREMENT, data
+                           , n * 6, err ))
+    goto error;
 
+  *count = n;
   return true;
 
 error:
-  error_prefix (err, "l3gd20_run");
+  error_prefix (err, "fifo_read");
   return false;
 }
+
+static bool
+read_temp (l3gd20_t *const l3gd20, error_t *const err)
+{
+  uint8_t temp;
+  if (! i2c_bus_read_u8 (l3gd20->bus, ADDR, OUT_TEMP, &temp, err)) {
+    error_prefix (err, "read_temp");
+    return false;
+  }
+
+  set_temp (l3gd20, (int8_t)temp);
+  return true;
+}
+
+/* The bias only moves with the temperature, or as fast as it is learnt, so
+ * the table is looked up here rather than for every sample.
+ */
+static void
+set_temp (l3gd20_t *const l3gd20, const int temp)
+{
+  double bias[3];
+  gyro_bias_get (l3gd20->bias, temp, bias);
+  for (int i = 0; i < 3; ++i)
+    l3gd20->scale.bias[i] = -bias[i];
+
+  l3gd20->temp = temp;
+  l3gd20->since_temp = 0;
+}
+
+static inline bool
+temp_due (const l3gd20_t *const l3gd20)
+{
+  return l3gd20->bias && l3gd20->since_temp >= L3GD20_RATE;
+}
+
+static void
+decode (const uint8_t *const data, sample_raw_t *const sample)
+{
+  sample->xyz[0] = i2c_be16 (&data[0]);
+  sample->xyz[1] = i2c_be16 (&data[2]);
+  sample->xyz[2] = i2c_be16 (&data[4]);
+}
+
+static void
+convert ( l3gd20_t *const l3gd20, const sample_raw_t *const sample
+        , l3gd20_result_t *const res )
+{
+  res->have_result = true;
+  res->time = sample->time;
+  res->x = sample_units (&l3gd20->scale, sample->xyz, 0);
+  res->y = sample_units (&l3gd20->scale, sample->xyz, 1);
+  res->z = sample_units (&l3gd20->scale, sample->xyz, 2);
+  for (int i = 0; i < 3; ++i)
+    res->raw[i] = sample->xyz[i];
+
+  if (l3gd20->bias) {
+    double w[3];
+    for (int i = 0; i < 3; ++i)
+      w[i] = sample->xyz[i] * l3gd20->scale.scale[i];
+    gyro_bias_gyro (l3gd20->bias, l3gd20->temp, w);
+    ++l3gd20->since_temp;
+  }
+}
+
+/* Set or clear bits of CTRL_REG3, leaving the rest as they are; was, unless
+ * NULL, gets whether they were all set before.
+ */
+static bool
+update_reg3 ( l3gd20_t *const l3gd20, const uint8_t bits, const bool set
+            , bool *const was, error_t *const err )
+{
+  uint8_t reg3;
+  if (! i2c_bus_read_u8 (l3gd20->bus, ADDR, CTRL_REG3, &reg3, err))
+    return false;
+
+  if (was)
+    *was = (reg3 & bits) == bits;
+
+  uint8_t value = set ? reg3 | bits : reg3 & ~bits;
+  return value == reg3 ||
+         i2c_bus_write_u8 (l3gd20->bus, ADDR, CTRL_REG3, value, err);
+}
@@ -4,18 +4,35 @@
 #define INCLUDE_L3GD20_H
 
 #include <stdbool.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "error-utilities.h"
+#include "gyro-bias.h"
+#include "i2c-bus.h"
+#include "i2c-utilities.h"
+#include "sample.h"
+
+#define L3GD20_FIFO_SIZE 32
+
+/* Output data rate as configured by l3gd20_new (CTRL_REG1_DR1|DR0) */
+#define L3GD20_RATE 760  /* Hz */
+
+/* radian/s per LSB: 70 m°/s at FS1|FS0 */
+#define L3GD20_SCALE (70.0 * M_PI/180000.0)
 
 typedef struct l3gd20 l3gd20_t;
 
 typedef struct {
   bool have_result;
+  int64_t time;    /* CLOCK_MONOTONIC ns when the sample was read out */
   double x, y, z;  /* radian/s */
+  int16_t raw[3];  /* x, y, z as read */
 } l3gd20_result_t;
 
 l3gd20_t *
-l3gd20_new (const int i2c_fd, error_t *const err);
+l3gd20_new (i2c_bus_t *const bus, error_t *const err);
 
 void
 l3gd20_free (l3gd20_t *const l3gd20);
@@ -24,4 +41,71 @@ bool
 l3gd20_run ( l3gd20_t *const l3gd20, l3gd20_result_t *const res
            , error_t *const err );
 
+/* l3gd20_run without the conversion: fresh tells whether sample got a new
+ * one, and l3gd20_scale what it is worth in radian/s.
+ */
+bool
+l3gd20_run_raw ( l3gd20_t *const l3gd20, sample_raw_t *const sample
+               , bool *const fresh, error_t *const err );
+
+const sample_scale_t *
+l3gd20_scale (const l3gd20_t *const l3gd20);
+
+/* Feed every converted sample to gb, reading OUT_TEMP along about once a
+ * second (with every batch, where it is one more byte), and keep the scale's
+ * bias at minus what gb has for the temperature. The block drain gets the
+ * bias through the scale but feeds nothing. NULL detaches and zeroes the
+ * bias. gb is the driver's to change until it is detached.
+ */
+void
+l3gd20_gyro_bias (l3gd20_t *const l3gd20, gyro_bias_t *const gb);
+
+/* Route data-ready to the INT2/DRDY pin (CTRL_REG3_I2_DRDY). The line stays
+ * high until the sample has been read. The rest of CTRL_REG3 stays as it
+ * is; previous, unless NULL, gets whether data-ready was routed before.
+ */
+bool
+l3gd20_set_drdy ( l3gd20_t *const l3gd20, const bool enable
+                , bool *const previous, error_t *const err );
+
+/* Put the FIFO in stream mode. It keeps the newest L3GD20_FIFO_SIZE samples
+ * at the output data rate; the watermark (0..31) is the fill level at which
+ * the WTM flag and the I2_WTM interrupt go up. l3gd20_run and the batch
+ * functions are meant for bypass mode, which l3gd20_fifo_stop returns to.
+ */
+bool
+l3gd20_fifo_start ( l3gd20_t *const l3gd20, const unsigned watermark
+                  , error_t *const err );
+
+bool
+l3gd20_fifo_stop (l3gd20_t *const l3gd20, error_t *const err);
+
+/* Pop up to max samples, oldest first, into res[0..*count-1] with a single
+ * burst read. overrun is set if the FIFO had filled up and older samples have
+ * been overwritten since the last drain. The newest sample gets the time of
+ * the read and the ones before it are spaced at the output data rate.
+ */
+bool
+l3gd20_fifo_drain ( l3gd20_t *const l3gd20, l3gd20_result_t *const res
+                  , const size_t max, size_t *const count
+                  , bool *const overrun, error_t *const err );
+
+/* l3gd20_fifo_drain straight into float arrays, converted a block at a time
+ * with convert_xyz. The bias follows the temperature the same way, but the
+ * samples are not given to gyro_bias_gyro to learn from.
+ */
+bool
+l3gd20_fifo_drain_block ( l3gd20_t *const l3gd20, sample_block_t *const block
+                        , error_t *const err );
+
+/* Queue the status and data reads for one sample into batch. After the batch
+ * has been submitted, l3gd20_batch_finish decodes them into res.
+ */
+bool
+l3gd20_batch_prepare ( l3gd20_t *const l3gd20, i2c_batch_t *const batch
+                     , error_t *const err );
+
+void
+l3gd20_batch_finish (l3gd20_t *const l3gd20, l3gd20_result_t *const res);
+
 #endif /* INCLUDE_L3GD20_H */
@@ -1,13 +1,18 @@
 /* LSM303DLHC accelerometer */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 #include "lsm303dlhc-acc.h"
 
 #include "common.h"
+#include "convert.h"
+#include "gyro-bias.h"
+#include "i2c-bus.h"
 #include "i2c-utilities.h"
+#include "time-utilities.h"
 
 #define ADDR 0x19
 
@@ -26,6 +31,10 @@
 #define OUT_Y_H 0x2b
 #define OUT_Z_L 0x2c
 #define OUT_Z_H 0x2d
+#define FIFO_SRC_REG 0x2f
+
+/* Sub-address MSB: auto-increment the register address on multi-byte reads. */
+#define AUTO_INCREMENT (1<<7)
 
 #define CTRL_REG1_ODR3 (1<<7)
 #define CTRL_REG1_ODR2 (1<<6)
@@ -92,12 +101,31 @@
 #define STATUS_REG_YDA   (1<<1)
 #define STATUS_REG_XDA   (1<<0)
 
+#define FIFO_SRC_REG_WTM       (1<<7)
+#define FIFO_SRC_REG_OVRN_FIFO (1<<6)
+#define FIFO_SRC_REG_EMPTY     (1<<5)
+#define FIFO_SRC_REG_FSS       0x1f
+
 struct lsm303dlhc_acc {
-  int fd;
+  i2c_bus_t *bus;
+  sample_scale_t scale;
+  gyro_bias_t *gyro_bias;  /* NULL unless attached */
+  uint8_t *batch_data;  /* STATUS_REG..OUT_Z_H in a pending batch */
 };
 
+static bool fifo_read ( lsm303dlhc_acc_t *const acc, uint8_t *const data
+                      , size_t *const count, bool *const overrun
+                      , error_t *const err );
+static void decode (const uint8_t *const data, sample_raw_t *const sample);
+static bool update_reg3 ( lsm303dlhc_acc_t *const acc, const uint8_t bits
+                        , const bool set, bool *const was
+                        , error_t *const err );
+static void convert ( const lsm303dlhc_acc_t *const acc
+                    , const sample_raw_t *const sample
+                    , lsm303dlhc_acc_result_t *const res );
+
 lsm303dlhc_acc_t *
-lsm303dlhc_acc_new (const int i2c_fd, error_t *const err)
+lsm303dlhc_acc_new (i2c_bus_t *const bus, error_t *const err)
 {
   lsm303dlhc_acc_t *acc = malloc (sizeof (lsm303dlhc_acc_t));
   if (! acc) {
@@ -106,22 +134,23 @@ lsm303dlhc_acc_new (const int i2c_fd, error_t *const err)
     goto malloc_failed;
   }
 
-  acc->fd = i2c_fd;
-
-  if (! i2c_slave (i2c_fd, ADDR, err))
-    goto i2c_slave_failed;
+  acc->bus = bus;
+  acc->scale = (sample_scale_t){ { LSM303DLHC_ACC_SCALE, LSM303DLHC_ACC_SCALE
+                                 , LSM303DLHC_ACC_SCALE }
+                               , { 0, 0, 0 } };
+  acc->gyro_bias = NULL;
 
   uint8_t reg1 = CTRL_REG1_ODR3 | CTRL_REG1_ODR0
                | CTRL_REG1_Zen | CTRL_REG1_Yen | CTRL_REG1_Xen
         , reg4 = CTRL_REG4_BDU | CTRL_REG4_BLE | CTRL_REG4_FS1 | CTRL_REG4_FS0
                | CTRL_REG4_HR;
-  if (! (i2c_write_u8 (i2c_fd, CTRL_REG1, reg1, err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG2, 0,    err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG3, 0,    err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG4, reg4, err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG5, 0,    err) &&
-         i2c_write_u8 (i2c_fd, CTRL_REG6, 0,    err) &&
-         i2c_write_u8 (i2c_fd, FIFO_CTRL_REG, 0, err))) {
+  if (! (i2c_bus_write_u8 (bus, ADDR, CTRL_REG1, reg1, err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG2, 0,    err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG3, 0,    err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG4, reg4, err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG5, 0,    err) &&
+         i2c_bus_write_u8 (bus, ADDR, CTRL_REG6, 0,    err) &&
+         i2c_bus_write_u8 (bus, ADDR, FIFO_CTRL_REG, 0, err))) {
     error_prefix (err, "initialization");
     goto init_failed;
   }
@@ -129,7 +158,6 @@ lsm303dlhc_acc_new (const int i2c_fd, error_t *const err)
   return acc;
 
 init_failed:
-i2c_slave_failed:
   free (acc);
 
 malloc_failed:
@@ -140,7 +168,7 @@ malloc_failed:
 void
 lsm303dlhc_acc_free (lsm303dlhc_acc_t *const acc)
 {
-  acc->fd = POISON;
+  acc->bus = (i2c_bus_t *)POISON;
   free (acc);
 }
 
@@ -148,40 +176,274 @@ bool
 lsm303dlhc_acc_run ( lsm303dlhc_acc_t *const acc
                    , lsm303dlhc_acc_result_t *const res, error_t *const err )
 {
-  uint8_t  status;
-  uint16_t x, y, z;
+  sample_raw_t sample;
+  bool fresh;
 
   res->have_result = false;
 
-  if (! i2c_slave (acc->fd, ADDR, err))
-    goto error;
+  if (! lsm303dlhc_acc_run_raw (acc, &sample, &fresh, err)) {
+    error_prefix (err, "lsm303dlhc_acc_run");
+    return false;
+  }
 
-  if (! i2c_read_u8 (acc->fd, STATUS_REG, &status, err))
+  if (fresh)
+    convert (acc, &sample, res);
+
+  return true;
+}
+
+bool
+lsm303dlhc_acc_run_raw ( lsm303dlhc_acc_t *const acc
+                       , sample_raw_t *const sample, bool *const fresh
+                       , error_t *const err )
+{
+  uint8_t status;
+  uint8_t data[6];
+
+  *fresh = false;
+
+  if (! i2c_bus_read_u8 (acc->bus, ADDR, STATUS_REG, &status, err))
     goto error;
 
   /* No new data available? */
   if (! (status & STATUS_REG_ZYXDA))
     return true;
 
-  /* New data available. */
-  if (! (i2c_read_u16 (acc->fd, OUT_X_L, &x, err) &&
-         i2c_read_u16 (acc->fd, OUT_Y_L, &y, err) &&
-         i2c_read_u16 (acc->fd, OUT_Z_L, &z, err)))
+  /* New data available. With BLE set, OUT_X_L holds the high byte. */
+  if (! i2c_bus_read_block ( acc->bus, ADDR, OUT_X_L|AUTO_INCREMENT, data, 6
+                           , err ))
+    goto error;
+
+  decode (data, sample);
+  sample->time = time_monotonic ();
+  *fresh = true;
+
+  return true;
+
+error:
+  error_prefix (err, "lsm303dlhc_acc_run_raw");
+  return false;
+}
+
+const sample_scale_t *
+lsm303dlhc_acc_scale (const lsm303dlhc_acc_t *const acc)
+{
+  return &acc->scale;
+}
+
+void
+lsm303dlhc_acc_gyro_bias ( lsm303dlhc_acc_t *const acc
+                         , gyro_bias_t *const gb )
+{
+  acc->gyro_bias = gb;
+}
+
+bool
+lsm303dlhc_acc_set_drdy ( lsm303dlhc_acc_t *const acc, const bool enable
+                        , bool *const previous, error_t *const err )
+{
+  if (! update_reg3 (acc, CTRL_REG3_I1_DRDY1, enable, previous, err)) {
+    error_prefix (err, "lsm303dlhc_acc_set_drdy");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+lsm303dlhc_acc_fifo_start ( lsm303dlhc_acc_t *const acc
+                          , const unsigned threshold, error_t *const err )
+{
+  if (threshold >= LSM303DLHC_ACC_FIFO_SIZE) {
+    error_printf (err, "Invalid threshold: %u", threshold);
     goto error;
+  }
+
+  /* Go through bypass mode to reset the FIFO. */
+  uint8_t reg5 = CTRL_REG5_FIFO_EN
+        , fifo_ctrl = FIFO_CTRL_REG_FM1 | threshold;
+  if (! (i2c_bus_write_u8 (acc->bus, ADDR, FIFO_CTRL_REG, 0, err) &&
+         i2c_bus_write_u8 (acc->bus, ADDR, CTRL_REG5, reg5, err) &&
+         i2c_bus_write_u8 (acc->bus, ADDR, FIFO_CTRL_REG, fifo_ctrl, err) &&
+         update_reg3 (acc, CTRL_REG3_I1_WTM, true, NULL, err)))
+    goto error;
+
+  return true;
+
+error:
+  error_prefix (err, "lsm303dlhc_acc_fifo_start");
+  return false;
+}
+
+bool
+lsm303dlhc_acc_fifo_stop (lsm303dlhc_acc_t *const acc, error_t *const err)
+{
+  if (! (update_reg3 (acc, CTRL_REG3_I1_WTM, false, NULL, err) &&
+         i2c_bus_write_u8 (acc->bus, ADDR, FIFO_CTRL_REG, 0, err) &&
+         i2c_bus_write_u8 (acc->bus, ADDR, CTRL_REG5, 0, err))) {
+    error_prefix (err, "lsm303dlhc_acc_fifo_stop");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+lsm303dlhc_acc_fifo_drain ( lsm303dlhc_acc_t *const acc
+                          , lsm303dlhc_acc_batch_t *const batch
+                          , error_t *const err )
+{
+  uint8_t data[LSM303DLHC_ACC_FIFO_SIZE * 6];
 
-  /* 12: FS1|FS0
-   * 1<<4: The chip pads values with four zero LSBs
-   * 9.80665/1000: mg to m/s²
+  batch->period = NS_PER_S / LSM303DLHC_ACC_RATE;
+
+  if (! fifo_read (acc, data, &batch->count, &batch->overrun, err)) {
+    error_prefix (err, "lsm303dlhc_acc_fifo_drain");
+    return false;
+  }
+
+  batch->time = time_monotonic ();
+  size_t n = batch->count;
+
+  for (size_t i = 0; i < n; ++i) {
+    sample_raw_t sample;
+    decode (&data[i * 6], &sample);
+    sample.time = batch->time - (int64_t)(n - 1 - i) * batch->period;
+    convert (acc, &sample, &batch->samples[i]);
+  }
+
+  return true;
+}
+
+bool
+lsm303dlhc_acc_fifo_drain_block ( lsm303dlhc_acc_t *const acc
+                                , sample_block_t *const block
+                                , error_t *const err )
+{
+  uint8_t data[LSM303DLHC_ACC_FIFO_SIZE * 6] __attribute__ ((aligned (16)));
+
+  block->period = NS_PER_S / LSM303DLHC_ACC_RATE;
+
+  if (! fifo_read (acc, data, &block->count, &block->overrun, err)) {
+    error_prefix (err, "lsm303dlhc_acc_fifo_drain_block");
+    return false;
+  }
+
+  block->time = time_monotonic ();
+  convert_xyz (data, block->count, &acc->scale, block->x, block->y, block->z);
+
+  return true;
+}
+
+bool
+lsm303dlhc_acc_batch_prepare ( lsm303dlhc_acc_t *const acc
+                             , i2c_batch_t *const batch, error_t *const err )
+{
+  /* With BDU set the data block read right after STATUS_REG belongs to the
+   * sample STATUS_REG reported on.
    */
-  double scale = 9.80665 * 12.0 / ((double)(1<<4) * 1000.0);
-  res->have_result = true;
-  res->x = scale * (int16_t)x;
-  res->y = scale * (int16_t)y;
-  res->z = scale * (int16_t)z;
+  if (! i2c_batch_read ( batch, ADDR, STATUS_REG|AUTO_INCREMENT, 7
+                       , &acc->batch_data, err )) {
+    error_prefix (err, "lsm303dlhc_acc_batch_prepare");
+    return false;
+  }
 
   return true;
+}
+
+void
+lsm303dlhc_acc_batch_finish ( lsm303dlhc_acc_t *const acc
+                            , lsm303dlhc_acc_result_t *const res )
+{
+  res->have_result = false;
+
+  if (! (acc->batch_data[0] & STATUS_REG_ZYXDA))
+    return;
+
+  sample_raw_t sample;
+  decode (&acc->batch_data[1], &sample);
+  sample.time = time_monotonic ();
+  convert (acc, &sample, res);
+}
+
+/* Pop everything the FIFO holds with one burst. */
+static bool
+fifo_read ( lsm303dlhc_acc_t *const acc, uint8_t *const data
+          , size_t *const count, bool *const overrun, error_t *const err )
+{
+  uint8_t src;
+
+  *count = 0;
+  *overrun = false;
+
+  if (! i2c_bus_read_u8 (acc->bus, ADDR, FIFO_SRC_REG, &src, err))
+    goto error;
+
+  /* FSS counts up to 31; a full FIFO reports OVRN_FIFO instead. */
+  size_t n = (src & FIFO_SRC_REG_OVRN_FIFO) ? LSM303DLHC_ACC_FIFO_SIZE
+           : (src & FIFO_SRC_REG_EMPTY)     ? 0
+           : (src & FIFO_SRC_REG_FSS);
+
+  *overrun = src & FIFO_SRC_REG_OVRN_FIFO;
+
+  if (n == 0)
+    return true;
+
+  /* The register address wraps from OUT_Z_H to OUT_X_L in FIFO mode. */
+  if (! i2c_bus_read_block ( acc->bus, ADDR, OUT_X_L|AUTO_INCREMENT, data
+                           , n * 6, err ))
+    goto error;
+
+  *count = n;
+  return true;
 
 error:
-  error_prefix (err, "lsm303dlhc_acc_run");
+  error_prefix (err, "fifo_read");
   return false;
 }
+
+static void
+decode (const uint8_t *const data, sample_raw_t *const sample)
+{
+  sample->xyz[0] = i2c_be16 (&data[0]);
+  sample->xyz[1] = i2c_be16 (&data[2]);
+  sample->xyz[2] = i2c_be16 (&data[4]);
+}
+
+static void
+convert ( const lsm303dlhc_acc_t *const acc, const sample_raw_t *const sample
+        , lsm303dlhc_acc_result_t *const res )
+{
+  res->have_result = true;
+  res->time = sample->time;
+  res->x = sample_units (&acc->scale, sample->xyz, 0);
+  res->y = sample_units (&acc->scale, sample->xyz, 1);
+  res->z = sample_units (&acc->scale, sample->xyz, 2);
+  for (int i = 0; i < 3; ++i)
+    res->raw[i] = sample->xyz[i];
+
+  if (acc->gyro_bias) {
+    const double a[3] = { res->x, res->y, res->z };
+    gyro_bias_acc (acc->gyro_bias, a);
+  }
+}
+
+/* Set or clear bits of CTRL_REG3, leaving the rest as they are: data-ready
+ * and the FIFO watermark share INT1. was, unless NULL, gets whether they
+ * were all set before.
+ */
+static bool
+update_reg3 ( lsm303dlhc_acc_t *const acc, const uint8_t bits, const bool set
+            , bool *const was, error_t *const err )
+{
+  uint8_t reg3;
+  if (! i2c_bus_read_u8 (acc->bus, ADDR, CTRL_REG3, &reg3, err))
+    return false;
+
+  if (was)
+    *was = (reg3 & bits) == bits;
+
+  uint8_t value = set ? reg3 | bits : reg3 & ~bits;
+  return value == reg3 ||
+         i2c_bus_write_u8 (acc->bus, ADDR, CTRL_REG3, value, err);
+}
@@ -4,18 +4,47 @@
 #define INCLUDE_LSM303DLHC_ACC_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "error-utilities.h"
+#include "gyro-bias.h"
+#include "i2c-bus.h"
+#include "i2c-utilities.h"
+#include "sample.h"
 
 typedef struct lsm303dlhc_acc lsm303dlhc_acc_t;
 
 typedef struct {
   bool have_result;
+  int64_t time;    /* CLOCK_MONOTONIC ns when the sample was read out */
   double x, y, z;  /* m/s² */
+  int16_t raw[3];  /* x, y, z as read */
 } lsm303dlhc_acc_result_t;
 
+#define LSM303DLHC_ACC_FIFO_SIZE 32
+
+/* Output data rate as configured by lsm303dlhc_acc_new (CTRL_REG1_ODR3|ODR0) */
+#define LSM303DLHC_ACC_RATE 1344  /* Hz */
+
+/* m/s² per LSB: 12 mg per count at FS1|FS0, with the chip padding values
+ * with four zero LSBs
+ */
+#define LSM303DLHC_ACC_SCALE (9.80665 * 12.0 / (16.0 * 1000.0))
+
+/* Samples drained from the FIFO, oldest first. Sample i was taken at about
+ * time - (count-1-i)*period, which is what its own time says.
+ */
+typedef struct {
+  size_t count;
+  bool overrun;    /* Samples were lost before the oldest one here */
+  int64_t time;    /* CLOCK_MONOTONIC ns when the FIFO was read out */
+  int64_t period;  /* ns between samples at the output data rate */
+  lsm303dlhc_acc_result_t samples[LSM303DLHC_ACC_FIFO_SIZE];
+} lsm303dlhc_acc_batch_t;
+
 lsm303dlhc_acc_t *
-lsm303dlhc_acc_new (const int i2c_fd, error_t *const err);
+lsm303dlhc_acc_new (i2c_bus_t *const bus, error_t *const err);
 
 void
 lsm303dlhc_acc_free (lsm303dlhc_acc_t *const acc);
@@ -24,4 +53,61 @@ bool
 lsm303dlhc_acc_run ( lsm303dlhc_acc_t *const acc
                    , lsm303dlhc_acc_result_t *const res, error_t *const err );
 
+/* Unconverted, as with l3gd20_run_raw; the scale gives m/s². */
+bool
+lsm303dlhc_acc_run_raw ( lsm303dlhc_acc_t *const acc
+                       , sample_raw_t *const sample, bool *const fresh
+                       , error_t *const err );
+
+const sample_scale_t *
+lsm303dlhc_acc_scale (const lsm303dlhc_acc_t *const acc);
+
+/* Feed every converted sample to gb, to tell when the craft is still; the
+ * block drain feeds nothing. NULL detaches.
+ */
+void
+lsm303dlhc_acc_gyro_bias ( lsm303dlhc_acc_t *const acc
+                         , gyro_bias_t *const gb );
+
+/* Route data-ready to INT1 (CTRL_REG3_I1_DRDY1), leaving the watermark
+ * interrupt of the FIFO as it is; previous, unless NULL, gets whether
+ * data-ready was routed before.
+ */
+bool
+lsm303dlhc_acc_set_drdy ( lsm303dlhc_acc_t *const acc, const bool enable
+                        , bool *const previous, error_t *const err );
+
+/* Stream mode: the FIFO keeps the newest LSM303DLHC_ACC_FIFO_SIZE samples and
+ * INT1 goes up (CTRL_REG3_I1_WTM) once more than threshold (0..31) of them
+ * are waiting. lsm303dlhc_acc_run and the batch functions are meant for bypass
+ * mode, which lsm303dlhc_acc_fifo_stop returns to.
+ */
+bool
+lsm303dlhc_acc_fifo_start ( lsm303dlhc_acc_t *const acc
+                          , const unsigned threshold, error_t *const err );
+
+bool
+lsm303dlhc_acc_fifo_stop (lsm303dlhc_acc_t *const acc, error_t *const err);
+
+/* Read out everything the FIFO holds with one burst. */
+bool
+lsm303dlhc_acc_fifo_drain ( lsm303dlhc_acc_t *const acc
+                          , lsm303dlhc_acc_batch_t *const batch
+                          , error_t *const err );
+
+/* lsm303dlhc_acc_fifo_drain into float arrays, as l3gd20_fifo_drain_block. */
+bool
+lsm303dlhc_acc_fifo_drain_block ( lsm303dlhc_acc_t *const acc
+                                , sample_block_t *const block
+                                , error_t *const err );
+
+/* Batched acquisition, as with l3gd20_batch_prepare/l3gd20_batch_finish. */
+bool
+lsm303dlhc_acc_batch_prepare ( lsm303dlhc_acc_t *const acc
+                             , i2c_batch_t *const batch, error_t *const err );
+
+void
+lsm303dlhc_acc_batch_finish ( lsm303dlhc_acc_t *const acc
+                            , lsm303dlhc_acc_result_t *const res );
+
 #endif /* INCLUDE_LSM303DLHC_ACC_H */
@@ -10,7 +10,10 @@
 #include "lsm303dlhc-mag.h"
 
 #include "common.h"
+#include "i2c-bus.h"
 #include "i2c-utilities.h"
+#include "mag-calibration.h"
+#include "time-utilities.h"
 
 #define ADDR 0x1e
 
@@ -43,11 +46,20 @@
 #define SR_REG_DRDY (1<<0)
 
 struct lsm303dlhc_mag {
-  int fd;
+  i2c_bus_t *bus;
+  sample_scale_t scale;
+  mag_calibration_t *calibration;  /* NULL unless attached */
+  uint8_t *batch_status;  /* SR_REG in a pending batch */
+  uint8_t *batch_data;    /* OUT_X_H..OUT_Y_L in a pending batch */
 };
 
+static void decode (const uint8_t *const data, sample_raw_t *const sample);
+static void convert ( const lsm303dlhc_mag_t *const mag
+                    , const sample_raw_t *const sample
+                    , lsm303dlhc_mag_result_t *const res );
+
 lsm303dlhc_mag_t *
-lsm303dlhc_mag_new (const int i2c_fd, error_t *const err)
+lsm303dlhc_mag_new (i2c_bus_t *const bus, error_t *const err)
 {
   lsm303dlhc_mag_t *mag = malloc (sizeof (lsm303dlhc_mag_t));
   if (! mag) {
@@ -56,16 +68,18 @@ lsm303dlhc_mag_new (const int i2c_fd, error_t *const err)
     goto malloc_failed;
   }
 
-  mag->fd = i2c_fd;
-
-  if (! i2c_slave (i2c_fd, ADDR, err))
-    goto i2c_slave_failed;
+  mag->bus = bus;
+  mag->scale = (sample_scale_t){ { LSM303DLHC_MAG_SCALE_XY
+                                 , LSM303DLHC_MAG_SCALE_XY
+                                 , LSM303DLHC_MAG_SCALE_Z }
+                               , { 0, 0, 0 } };
+  mag->calibration = NULL;
 
   uint8_t cra = CRA_REG_DO2 | CRA_REG_DO1 | CRA_REG_DO0
         , crb = CRB_REG_GN2 | CRB_REG_GN1 | CRB_REG_GN0;
-  if (! (i2c_write_u8 (i2c_fd, CRA_REG, cra, err) &&
-         i2c_write_u8 (i2c_fd, CRB_REG, crb, err) &&
-         i2c_write_u8 (i2c_fd, MR_REG,  0,   err))) {
+  if (! (i2c_bus_write_u8 (bus, ADDR, CRA_REG, cra, err) &&
+         i2c_bus_write_u8 (bus, ADDR, CRB_REG, crb, err) &&
+         i2c_bus_write_u8 (bus, ADDR, MR_REG,  0,   err))) {
     error_prefix (err, "initialization");
     goto init_failed;
   }
@@ -73,7 +87,6 @@ lsm303dlhc_mag_new (const int i2c_fd, error_t *const err)
   return mag;
 
 init_failed:
-i2c_slave_failed:
   free (mag);
 
 malloc_failed:
@@ -84,7 +97,7 @@ malloc_failed:
 void
 lsm303dlhc_mag_free (lsm303dlhc_mag_t *const mag)
 {
-  mag->fd = POISON;
+  mag->bus = (i2c_bus_t *)POISON;
   free (mag);
 }
 
@@ -92,40 +105,127 @@ bool
 lsm303dlhc_mag_run ( lsm303dlhc_mag_t *const mag
                    , lsm303dlhc_mag_result_t *const res, error_t *const err)
 {
-  uint8_t  status;
-  uint16_t x, y, z;
+  sample_raw_t sample;
+  bool fresh;
 
   res->have_result = false;
 
-  if (! i2c_slave (mag->fd, ADDR, err))
-    goto error;
+  if (! lsm303dlhc_mag_run_raw (mag, &sample, &fresh, err)) {
+    error_prefix (err, "lsm303dlhc_mag_run");
+    return false;
+  }
+
+  if (fresh)
+    convert (mag, &sample, res);
+
+  return true;
+}
+
+bool
+lsm303dlhc_mag_run_raw ( lsm303dlhc_mag_t *const mag
+                       , sample_raw_t *const sample, bool *const fresh
+                       , error_t *const err )
+{
+  uint8_t status;
+  uint8_t data[6];
+
+  *fresh = false;
 
-  if (! i2c_read_u8 (mag->fd, SR_REG, &status, err))
+  if (! i2c_bus_read_u8 (mag->bus, ADDR, SR_REG, &status, err))
     goto error;
 
   /* No new data available? */
   if (! (status & SR_REG_DRDY))
     return true;
 
-  /* New data available. */
-  if (! (i2c_read_u16 (mag->fd, OUT_X_H, &x, err) &&
-         i2c_read_u16 (mag->fd, OUT_Z_H, &z, err) &&
-         i2c_read_u16 (mag->fd, OUT_Y_H, &y, err)))
+  /* New data available. The register pointer auto-increments on its own
+   * through the X, Z, Y block.
+   */
+  if (! i2c_bus_read_block (mag->bus, ADDR, OUT_X_H, data, 6, err))
     goto error;
 
-  /* 1/230, 1/205: GN2|GN1|GN0
-   * 1/10000: gauss to T
-   */
-  double scalexy = 1.0/(230.0 * 10000.0)
-       , scalez  = 1.0/(205.0 * 10000.0);
-  res->have_result = true;
-  res->x = scalexy * (int16_t)x;
-  res->y = scalexy * (int16_t)y;
-  res->z = scalez  * (int16_t)z;
+  decode (data, sample);
+  sample->time = time_monotonic ();
+  *fresh = true;
 
   return true;
 
 error:
-  error_prefix (err, "lsm303dlhc_mag_run");
+  error_prefix (err, "lsm303dlhc_mag_run_raw");
   return false;
 }
+
+const sample_scale_t *
+lsm303dlhc_mag_scale (const lsm303dlhc_mag_t *const mag)
+{
+  return &mag->scale;
+}
+
+void
+lsm303dlhc_mag_calibration ( lsm303dlhc_mag_t *const mag
+                           , mag_calibration_t *const cal )
+{
+  mag->calibration = cal;
+}
+
+bool
+lsm303dlhc_mag_batch_prepare ( lsm303dlhc_mag_t *const mag
+                             , i2c_batch_t *const batch, error_t *const err )
+{
+  /* The register pointer wraps from OUT_Y_L back to OUT_X_H, so SR_REG needs
+   * a read of its own.
+   */
+  if (! (i2c_batch_read (batch, ADDR, SR_REG, 1, &mag->batch_status, err) &&
+         i2c_batch_read (batch, ADDR, OUT_X_H, 6, &mag->batch_data, err))) {
+    error_prefix (err, "lsm303dlhc_mag_batch_prepare");
+    return false;
+  }
+
+  return true;
+}
+
+void
+lsm303dlhc_mag_batch_finish ( lsm303dlhc_mag_t *const mag
+                            , lsm303dlhc_mag_result_t *const res )
+{
+  res->have_result = false;
+
+  if (! (*mag->batch_status & SR_REG_DRDY))
+    return;
+
+  sample_raw_t sample;
+  decode (mag->batch_data, &sample);
+  sample.time = time_monotonic ();
+  convert (mag, &sample, res);
+}
+
+static void
+decode (const uint8_t *const data, sample_raw_t *const sample)
+{
+  /* The registers come in X, Z, Y order. */
+  sample->xyz[0] = i2c_be16 (&data[0]);
+  sample->xyz[1] = i2c_be16 (&data[4]);
+  sample->xyz[2] = i2c_be16 (&data[2]);
+}
+
+static void
+convert ( const lsm303dlhc_mag_t *const mag, const sample_raw_t *const sample
+        , lsm303dlhc_mag_result_t *const res )
+{
+  res->have_result = true;
+  res->time = sample->time;
+  res->x = sample_units (&mag->scale, sample->xyz, 0);
+  res->y = sample_units (&mag->scale, sample->xyz, 1);
+  res->z = sample_units (&mag->scale, sample->xyz, 2);
+  for (int i = 0; i < 3; ++i)
+    res->raw[i] = sample->xyz[i];
+
+  if (mag->calibration) {
+    double xyz[3] = { res->x, res->y, res->z };
+    mag_calibration_update (mag->calibration, xyz);
+    mag_calibration_apply (mag->calibration, xyz, xyz);
+    res->x = xyz[0];
+    res->y = xyz[1];
+    res->z = xyz[2];
+  }
+}
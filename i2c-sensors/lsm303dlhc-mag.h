@@ -4,18 +4,32 @@
 #define INCLUDE_LSM303DLHC_MAG_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "error-utilities.h"
+#include "i2c-bus.h"
+#include "i2c-utilities.h"
+#include "mag-calibration.h"
+#include "sample.h"
 
 typedef struct lsm303dlhc_mag lsm303dlhc_mag_t;
 
+/* Output data rate as configured by lsm303dlhc_mag_new (CRA_REG_DO2|DO1|DO0) */
+#define LSM303DLHC_MAG_RATE 220  /* Hz */
+
+/* T per LSB: 1/230 and 1/205 gauss at GN2|GN1|GN0 */
+#define LSM303DLHC_MAG_SCALE_XY (1.0/(230.0 * 10000.0))
+#define LSM303DLHC_MAG_SCALE_Z  (1.0/(205.0 * 10000.0))
+
 typedef struct {
   bool have_result;
+  int64_t time;    /* CLOCK_MONOTONIC ns when the sample was read out */
   double x, y, z;  /* T */
+  int16_t raw[3];  /* x, y, z as read */
 } lsm303dlhc_mag_result_t;
 
 lsm303dlhc_mag_t *
-lsm303dlhc_mag_new (const int i2c_fd, error_t *const err);
+lsm303dlhc_mag_new (i2c_bus_t *const bus, error_t *const err);
 
 void
 lsm303dlhc_mag_free (lsm303dlhc_mag_t *const mag);
@@ -24,4 +38,32 @@ bool
 lsm303dlhc_mag_run ( lsm303dlhc_mag_t *const mag
                    , lsm303dlhc_mag_result_t *const res, error_t *const err);
 
+/* Unconverted, as with l3gd20_run_raw, in x, y, z order; the scale gives T. */
+bool
+lsm303dlhc_mag_run_raw ( lsm303dlhc_mag_t *const mag
+                       , sample_raw_t *const sample, bool *const fresh
+                       , error_t *const err );
+
+const sample_scale_t *
+lsm303dlhc_mag_scale (const lsm303dlhc_mag_t *const mag);
+
+/* Feed every converted sample to cal and correct x, y and z by it, or stop
+ * with NULL. The raw samples stay as they are. cal is the driver's to
+ * change until it is detached.
+ */
+void
+lsm303dlhc_mag_calibration ( lsm303dlhc_mag_t *const mag
+                           , mag_calibration_t *const cal );
+
+/* Queues SR_REG and the X/Z/Y block; lsm303dlhc_mag_batch_finish decodes
+ * them once the batch has been submitted.
+ */
+bool
+lsm303dlhc_mag_batch_prepare ( lsm303dlhc_mag_t *const mag
+                             , i2c_batch_t *const batch, error_t *const err );
+
+void
+lsm303dlhc_mag_batch_finish ( lsm303dlhc_mag_t *const mag
+                            , lsm303dlhc_mag_result_t *const res );
+
 #endif /* INCLUDE_LSM303DLHC_MAG_H */
@@ -0,0 +1,272 @@
+/* Magnetometer hard- and soft-iron calibration
+ *
+ * The quadric x'Ax + 2w'x + k = 0 is x² + y² + z² regressed on
+ * x² + y² - 2z², x² - 2y² + z², 2xy, 2xz, 2yz, 2x, 2y, 2z and 1, which ties
+ * the trace of A to 3 (after Y. Petrov's ellipsoid fit). A fit to "= 1"
+ * would be cheaper by nothing and falls apart once the hard iron puts the
+ * origin near or outside the ellipsoid, which on a small craft it can.
+ *
+ * The ellipsoid is centred on -A⁻¹w, with A's eigenvectors for axes and
+ * their lengths going as one over the square roots of the eigenvalues. The
+ * symmetric square root of A, scaled to a determinant of 1, maps it onto a
+ * sphere without turning it, and keeps the field about as large.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mag-calibration.h"
+
+#include "error-utilities.h"
+#include "file-utilities.h"
+
+/* Variance of every parameter before the first sample; anything firmer
+ * drags the centre of a large offset toward the origin.
+ */
+#define PRIOR 1e4
+
+/* Enough for the 3×3 Jacobi method to go to double precision */
+#define SWEEPS 8
+
+#define MAGIC "magcal1"
+
+/* What mag_calibration_save writes, in the machine's own byte order */
+typedef struct {
+  char magic[8];
+  double theta[9];
+  double P[9][9];
+  uint64_t samples;
+} saved_t;
+
+static bool solve (mag_calibration_t *const cal);
+static void eigen (double a[3][3], double v[3][3]);
+
+void
+mag_calibration_init (mag_calibration_t *const cal)
+{
+  memset (cal, 0, sizeof (mag_calibration_t));
+
+  /* x² + y² + z² = 1 */
+  cal->theta[8] = 1.0;
+  for (int i = 0; i < 9; ++i)
+    cal->P[i][i] = PRIOR;
+
+  for (int i = 0; i < 3; ++i)
+    cal->matrix[i][i] = 1.0;
+}
+
+bool
+mag_calibration_update (mag_calibration_t *const cal, const double *const in)
+{
+  double u[3], moved = 0;
+  for (int i = 0; i < 3; ++i) {
+    u[i] = in[i] / MAG_CALIBRATION_UNIT;
+    moved += (u[i] - cal->last[i]) * (u[i] - cal->last[i]);
+  }
+
+  if (moved < MAG_CALIBRATION_SPACING * MAG_CALIBRATION_SPACING)
+    return false;
+
+  memcpy (cal->last, u, sizeof (cal->last));
+
+  const double x = u[0], y = u[1], z = u[2];
+  const double phi[9] = { x*x + y*y - 2*z*z, x*x - 2*y*y + z*z
+                        , 2*x*y, 2*x*z, 2*y*z, 2*x, 2*y, 2*z, 1 };
+
+  double p_phi[9], phi_p_phi = 0, residual = x*x + y*y + z*z, trace = 0;
+  for (int i = 0; i < 9; ++i) {
+    p_phi[i] = 0;
+    for (int j = 0; j < 9; ++j)
+      p_phi[i] += cal->P[i][j] * phi[j];
+    phi_p_phi += phi[i] * p_phi[i];
+    residual -= phi[i] * cal->theta[i];
+    trace += cal->P[i][i];
+  }
+
+  /* Forget only while the covariance is no larger than it started, or it
+   * would grow without bound along whatever the samples do not excite.
+   */
+  const double forget = trace < 9 * PRIOR ? MAG_CALIBRATION_FORGET : 1.0
+             , denom = forget + phi_p_phi;
+
+  for (int i = 0; i < 9; ++i) {
+    cal->theta[i] += p_phi[i] / denom * residual;
+
+    /* Row by row from the diagonal, so that P stays exactly symmetric */
+    for (int j = i; j < 9; ++j)
+      cal->P[i][j] = cal->P[j][i] =
+        (cal->P[i][j] - p_phi[i] * p_phi[j] / denom) / forget;
+  }
+
+  ++cal->samples;
+  if (cal->samples < MAG_CALIBRATION_MIN_SAMPLES ||
+      cal->samples % MAG_CALIBRATION_SOLVE_EVERY != 0)
+    return false;
+
+  return solve (cal);
+}
+
+void
+mag_calibration_apply ( const mag_calibration_t *const cal
+                      , const double *const in, double *const out )
+{
+  if (! cal->valid) {
+    memmove (out, in, 3 * sizeof (double));
+    return;
+  }
+
+  double d[3];
+  for (int i = 0; i < 3; ++i)
+    d[i] = in[i] - cal->offset[i];
+
+  for (int i = 0; i < 3; ++i)
+    out[i] = cal->matrix[i][0] * d[0] + cal->matrix[i][1] * d[1] +
+             cal->matrix[i][2] * d[2];
+}
+
+bool
+mag_calibration_load ( mag_calibration_t *const cal, const char *const path
+                     , error_t *const err )
+{
+  saved_t saved;
+
+  size_t n;
+  if (! file_load (path, &saved, sizeof (saved), &n, err))
+    goto error;
+
+  if (n != sizeof (saved) || memcmp (saved.magic, MAGIC, sizeof (MAGIC))) {
+    error_printf (err, "%s: not a magnetometer calibration", path);
+    goto error;
+  }
+
+  mag_calibration_t loaded;
+  mag_calibration_init (&loaded);
+  memcpy (loaded.theta, saved.theta, sizeof (loaded.theta));
+  memcpy (loaded.P, saved.P, sizeof (loaded.P));
+  loaded.samples = saved.samples;
+  solve (&loaded);
+
+  *cal = loaded;
+  return true;
+
+error:
+  error_prefix (err, "mag_calibration_load");
+  return false;
+}
+
+bool
+mag_calibration_save ( const mag_calibration_t *const cal
+                     , const char *const path, error_t *const err )
+{
+  saved_t saved;
+  memset (&saved, 0, sizeof (saved));
+  memcpy (saved.magic, MAGIC, sizeof (MAGIC));
+  memcpy (saved.theta, cal->theta, sizeof (saved.theta));
+  memcpy (saved.P, cal->P, sizeof (saved.P));
+  saved.samples = cal->samples;
+
+  if (! file_save_atomic (path, &saved, sizeof (saved), err)) {
+    error_prefix (err, "mag_calibration_save");
+    return false;
+  }
+
+  return true;
+}
+
+/* offset and matrix from theta, unless it is no believable ellipsoid; then
+ * the last solution stays.
+ */
+static bool
+solve (mag_calibration_t *const cal)
+{
+  const double *const t = cal->theta;
+  double a[3][3] = { { 1 - t[0] - t[1], -t[2], -t[3] }
+                   , { -t[2], 1 - t[0] + 2*t[1], -t[4] }
+                   , { -t[3], -t[4], 1 + 2*t[0] - t[1] } }
+       , v[3][3];
+
+  eigen (a, v);
+
+  double lo = a[0][0], hi = a[0][0];
+  for (int i = 1; i < 3; ++i) {
+    lo = fmin (lo, a[i][i]);
+    hi = fmax (hi, a[i][i]);
+  }
+
+  if (! (lo > 0 &&
+         hi <= lo * MAG_CALIBRATION_MAX_RATIO * MAG_CALIBRATION_MAX_RATIO))
+    return false;
+
+  /* Centre -A⁻¹w, w = -(theta[5], theta[6], theta[7]), and the square root
+   * of A over the sixth root of its determinant, both through the
+   * eigenvectors
+   */
+  const double g = pow (a[0][0] * a[1][1] * a[2][2], 1.0 / 6.0);
+  double center[3] = { 0, 0, 0 };
+  for (int k = 0; k < 3; ++k) {
+    double w = 0;
+    for (int j = 0; j < 3; ++j)
+      w += v[j][k] * t[5 + j];
+    w /= a[k][k];
+    for (int i = 0; i < 3; ++i)
+      center[i] += v[i][k] * w;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    cal->offset[i] = center[i] * MAG_CALIBRATION_UNIT;
+    for (int j = 0; j < 3; ++j) {
+      cal->matrix[i][j] = 0;
+      for (int k = 0; k < 3; ++k)
+        cal->matrix[i][j] += v[i][k] * sqrt (a[k][k]) / g * v[j][k];
+    }
+  }
+
+  cal->valid = true;
+  return true;
+}
+
+/* The cyclic Jacobi method: a ends up diagonal with the eigenvalues, and
+ * the columns of v hold the eigenvectors.
+ */
+static void
+eigen (double a[3][3], double v[3][3])
+{
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      v[i][j] = i == j;
+
+  for (int sweep = 0; sweep < SWEEPS; ++sweep) {
+    if (a[0][1] == 0 && a[0][2] == 0 && a[1][2] == 0)
+      break;
+
+    for (int p = 0; p < 2; ++p) {
+      for (int q = p + 1; q < 3; ++q) {
+        if (a[p][q] == 0)
+          continue;
+
+        double theta = (a[q][q] - a[p][p]) / (2 * a[p][q])
+             , t = (theta >= 0 ? 1 : -1) /
+                   (fabs (theta) + sqrt (theta * theta + 1))
+             , c = 1 / sqrt (t * t + 1), s = t * c;
+
+        for (int k = 0; k < 3; ++k) {
+          double kp = a[k][p], kq = a[k][q];
+          a[k][p] = c * kp - s * kq;
+          a[k][q] = s * kp + c * kq;
+        }
+        for (int k = 0; k < 3; ++k) {
+          double pk = a[p][k], qk = a[q][k];
+          a[p][k] = c * pk - s * qk;
+          a[q][k] = s * pk + c * qk;
+        }
+        for (int k = 0; k < 3; ++k) {
+          double kp = v[k][p], kq = v[k][q];
+          v[k][p] = c * kp - s * kq;
+          v[k][q] = s * kp + c * kq;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,80 @@
+/* Magnetometer hard- and soft-iron calibration, learnt as samples come
+ *
+ * The field the magnetometer sees as the craft turns traces out an
+ * ellipsoid instead of a sphere around the origin: iron on board adds an
+ * offset (hard iron) and stretches it (soft iron). Recursive least squares
+ * fits a general quadric to it, one sample at a time in constant memory,
+ * forgetting slowly so that a change on board is followed. Only samples
+ * that have moved away from the last one taken count, so that holding still
+ * neither costs time nor forgets what turning taught. Every so often the
+ * fit is turned into an offset and a symmetric matrix that map the
+ * ellipsoid back onto a sphere.
+ */
+
+#ifndef INCLUDE_MAG_CALIBRATION_H
+#define INCLUDE_MAG_CALIBRATION_H
+
+#include <stdbool.h>
+
+#include "error-utilities.h"
+
+/* The fit works in units of about the earth's field. */
+#define MAG_CALIBRATION_UNIT 50e-6  /* T */
+
+/* What a sample has to have moved from the last one taken, in units */
+#define MAG_CALIBRATION_SPACING 0.1
+
+/* Forgetting factor per sample taken: about the last thousand count. */
+#define MAG_CALIBRATION_FORGET 0.999
+
+/* Samples taken between solutions */
+#define MAG_CALIBRATION_SOLVE_EVERY 50
+
+/* Samples taken before there is a solution at all */
+#define MAG_CALIBRATION_MIN_SAMPLES 200
+
+/* Largest ratio between the axes of the ellipsoid that is believed; a fit
+ * beyond it comes from turning about too few axes.
+ */
+#define MAG_CALIBRATION_MAX_RATIO 2.0
+
+typedef struct {
+  double theta[9];          /* The quadric, as in mag-calibration.c */
+  double P[9][9];           /* Covariance of theta, up to a factor */
+  double last[3];           /* The last sample taken, in units */
+  unsigned long samples;    /* Samples taken */
+  bool valid;               /* offset and matrix hold a solution */
+  double offset[3];         /* T */
+  double matrix[3][3];      /* Symmetric, with a determinant of 1 */
+} mag_calibration_t;
+
+/* A sphere around the origin, held loosely; no solution. */
+void
+mag_calibration_init (mag_calibration_t *const cal);
+
+/* Take a sample (x, y, z in T, uncorrected) into the fit. Returns whether
+ * offset and matrix changed.
+ */
+bool
+mag_calibration_update (mag_calibration_t *const cal, const double *const in);
+
+/* out = matrix (in - offset), or in as it is without a solution. in and out
+ * may be the same.
+ */
+void
+mag_calibration_apply ( const mag_calibration_t *const cal
+                      , const double *const in, double *const out );
+
+/* The fit as mag_calibration_save left it, solved again. cal is left alone
+ * on failure.
+ */
+bool
+mag_calibration_load ( mag_calibration_t *const cal, const char *const path
+                     , error_t *const err );
+
+/* Replaces path as a whole, through a temporary file next to it. */
+bool
+mag_calibration_save ( const mag_calibration_t *const cal
+                     , const char *const path, error_t *const err );
+
+#endif /* INCLUDE_MAG_CALIBRATION_H */
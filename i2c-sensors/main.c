@@ -1,9 +1,21 @@
 #include <error.h>
 #include <math.h>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
+#include "acquisition.h"
+#include "ahrs.h"
+#include "decimate.h"
 #include "error-utilities.h"
+#include "flight-log.h"
+#include "gyro-bias.h"
 #include "i2c-sensors.h"
+#include "mag-calibration.h"
+#include "pps.h"
+#include "time-utilities.h"
+#include "vertical.h"
 
 /* Air pressure at sea level in Pa.
  * http://weather.noaa.gov/pub/data/observations/metar/decoded/EFTP.TXT
@@ -11,8 +23,59 @@
  */
 #define P_SEA 100500
 
+#define BMP085_EOC_GPIO 38
+/* Not wired yet; polled at their output data rate instead. */
+#define L3GD20_DRDY_GPIO (-1)
+#define LSM303DLHC_ACC_DRDY_GPIO (-1)
+
+/* Set up by misc/init-gps-ntp; optional */
+#define PPS_DEV "/dev/pps0"
+
+/* Where the magnetometer calibration and the gyro bias table are kept
+ * between runs
+ */
+#define MAG_CALIBRATION_PATH "/var/lib/drone/mag-calibration"
+#define GYRO_BIAS_PATH "/var/lib/drone/gyro-bias"
+
+#define ACQUISITION_PRIORITY 50
+#define ACQUISITION_CPU (-1)
+#define ACQUISITION_CAPACITY 1024
+
+/* The gyro and the accelerometer brought down to the 200 Hz of a control
+ * loop
+ */
+#define GYRO_DECIMATION { DECIMATE_FIR, 5, 19, 64, 0.8 }
+#define ACC_DECIMATION  { DECIMATE_FIR, 25, 168, 64, 0.8 }
+
+/* How long to sleep when the ring is empty. */
+#define DRAIN_INTERVAL 10000000  /* ns */
+
+/* Lines printed when not logging */
+#define N_PRINT 1000
+
+static volatile sig_atomic_t stop = 0;
+
 static void
-print_res (const i2c_sensors_result_t *const res);
+on_signal (int signum);
+
+static void
+estimate ( ahrs_t *const ahrs, vertical_t *const vertical
+         , const i2c_sensors_result_t *const res );
+
+static void
+print_res ( const acquisition_record_t *const rec, const pps_t *const pps
+          , const vertical_t *const vertical );
+
+static bool
+newest_time (const i2c_sensors_result_t *const res, int64_t *const time);
+
+static void
+print_delay ( const char *const name, const decimate_t *const dec
+            , const int64_t period );
+
+static unsigned long
+decimate ( decimate_t *const dec, const decimate_source_t source
+         , const acquisition_record_t *const records, const size_t count );
 
 static inline double
 magnitude (const double x, const double y, const double z);
@@ -22,40 +85,240 @@ main (int argc, char **argv)
 {
   ERROR_DECLARE (err);
 
-  i2c_sensors_t *sensors = i2c_sensors_new ("/dev/i2c-1", 38, &err);
+  /* With a path, record a flight log until interrupted; otherwise print.
+   * With -r, print a recorded log at the pace it was recorded.
+   */
+  const char *log_path = NULL, *replay_path = NULL;
+  if (argc == 3 && ! strcmp (argv[1], "-r")) {
+    replay_path = argv[2];
+  } else if (argc <= 2) {
+    log_path = argv[1];
+  } else {
+    fprintf (stderr, "Usage: %s [LOG | -r LOG]\n", argv[0]);
+    return 2;
+  }
+
+  struct sigaction sa = { .sa_handler = on_signal };
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  i2c_sensors_t *sensors =
+    replay_path
+      ? i2c_sensors_new_replay (replay_path, I2C_SENSORS_REPLAY_REALTIME, &err)
+      : i2c_sensors_new ("/dev/i2c-1", BMP085_EOC_GPIO, &err);
   if (! sensors)
     goto error;
 
+  if (! i2c_sensors_events_start ( sensors, L3GD20_DRDY_GPIO
+                                 , LSM303DLHC_ACC_DRDY_GPIO, &err ))
+    goto error;
+
   i2c_sensors_dump (sensors, stderr);
 
-  printf ("   °C    kPa    m | °/s  (x)  (y)  (z) | "
-          " m/s²    (x)    (y)    (z) |   µT   (x)   (y)   (z)\n");
+  ERROR_DECLARE (pps_err);
+  pps_t *pps = replay_path ? NULL : pps_new (PPS_DEV, &pps_err);
+  if (! (pps || replay_path))
+    fprintf ( stderr, "%s: %s; no GPS time\n", argv[0]
+            , error_message (&pps_err) );
 
-  i2c_sensors_result_t res;
-  for (int n = 0; n < 1000; ++n) {
-    if (! i2c_sensors_run (sensors, &res, &err))
+  /* A replay calibrates from scratch, and keeps nothing of it. */
+  mag_calibration_t mag_cal;
+  mag_calibration_init (&mag_cal);
+  ERROR_DECLARE (mag_cal_err);
+  if (! replay_path &&
+      ! mag_calibration_load (&mag_cal, MAG_CALIBRATION_PATH, &mag_cal_err))
+    fprintf ( stderr, "%s: %s; calibrating from scratch\n", argv[0]
+            , error_message (&mag_cal_err) );
+  i2c_sensors_mag_calibration (sensors, &mag_cal);
+
+  gyro_bias_t gyro_bias;
+  gyro_bias_init (&gyro_bias, L3GD20_RATE, LSM303DLHC_ACC_RATE);
+  ERROR_DECLARE (gyro_bias_err);
+  if (! replay_path &&
+      ! gyro_bias_load (&gyro_bias, GYRO_BIAS_PATH, &gyro_bias_err))
+    fprintf ( stderr, "%s: %s; learning the gyro bias from scratch\n"
+            , argv[0], error_message (&gyro_bias_err) );
+  i2c_sensors_gyro_bias (sensors, &gyro_bias);
+
+  flight_log_t *log = NULL;
+  if (log_path) {
+    int16_t oss;
+    const bmp085_calib_t *calib = i2c_sensors_bmp085_calib (sensors, &oss);
+    if (! (log = flight_log_new (log_path, calib, oss, &err)))
       goto error;
-    print_res (&res);
+  } else {
+    printf ("            time |    °C    kPa    m  m/s | "
+            "°/s  (x)  (y)  (z) |  m/s²    (x)    (y)    (z) | "
+            "  µT   (x)   (y)   (z)\n");
+  }
+
+  /* Altitude and climb rate for the printout */
+  ahrs_t ahrs;
+  vertical_t vertical;
+  ahrs_init (&ahrs, AHRS_KP, AHRS_KI);
+  vertical_init (&vertical, P_SEA);
+
+  /* What a control loop would take, and how late it gets it */
+  const decimate_config_t gyro_decimation = GYRO_DECIMATION
+                        , acc_decimation = ACC_DECIMATION;
+  decimate_t *gyro_dec, *acc_dec;
+  if (! ((gyro_dec = decimate_new (&gyro_decimation, &err)) &&
+         (acc_dec = decimate_new (&acc_decimation, &err))))
+    goto error;
+  print_delay ("gyro", gyro_dec, NS_PER_S / L3GD20_RATE);
+  print_delay ("acc", acc_dec, NS_PER_S / LSM303DLHC_ACC_RATE);
+  unsigned long gyro_decimated = 0, acc_decimated = 0;
+
+  acquisition_config_t config =
+    { .priority = ACQUISITION_PRIORITY, .cpu = ACQUISITION_CPU
+    , .lock_memory = true, .capacity = ACQUISITION_CAPACITY };
+  /* A replay has no bus timing to keep clear of stdout; it is read here. */
+  acquisition_t *acq = NULL;
+  if (! replay_path) {
+    /* SCHED_FIFO takes CAP_SYS_NICE, and mlockall CAP_IPC_LOCK or a large
+     * enough RLIMIT_MEMLOCK. An ordinary user in the i2c group gets neither,
+     * and acquires at the default priority, unlocked.
+     */
+    if (! (acq = acquisition_new (sensors, &config, &err)) &&
+        err.code == ERROR_ERRNO &&
+        (err.errnum == EPERM || err.errnum == EAGAIN ||
+         err.errnum == ENOMEM)) {
+      fprintf ( stderr, "%s: %s; acquiring without real-time priority\n"
+              , argv[0], error_message (&err) );
+      error_clear (&err);
+      config.priority = 0;
+      config.lock_memory = false;
+      acq = acquisition_new (sensors, &config, &err);
+    }
+    if (! acq)
+      goto error;
+  }
+
+  acquisition_record_t records[64];
+  for (int n = 0; log ? ! stop : n < N_PRINT && ! stop; ) {
+    bool fresh;
+    if (pps && ! pps_update (pps, 0, &fresh, &err))
+      goto error;
+
+    size_t count;
+    if (! acq) {
+      if (i2c_sensors_replay_end (sensors))
+        break;
+      if (! i2c_sensors_run (sensors, &records[0].res, &err))
+        goto error;
+      /* When the log has it, not when it is played back */
+      count = newest_time (&records[0].res, &records[0].time) ? 1 : 0;
+    } else if (! (count = acquisition_read (acq, records, 64))) {
+      if (! acquisition_running (acq, &err))
+        goto error;
+      const struct timespec interval = { 0, DRAIN_INTERVAL };
+      nanosleep (&interval, NULL);
+      continue;
+    }
+
+    gyro_decimated += decimate (gyro_dec, DECIMATE_GYRO, records, count);
+    acc_decimated += decimate (acc_dec, DECIMATE_ACC, records, count);
+
+    for (size_t i = 0; i < count; ++i) {
+      if (log) {
+        if (! flight_log_write (log, &records[i].res, &err))
+          goto error;
+      } else {
+        estimate (&ahrs, &vertical, &records[i].res);
+        if (n++ < N_PRINT)
+          print_res (&records[i], pps, &vertical);
+      }
+    }
+  }
+
+  unsigned long overflows = 0;
+  if (acq) {
+    overflows = acquisition_overflows (acq);
+    acquisition_free (acq);
   }
 
+  i2c_sensors_mag_calibration (sensors, NULL);
+  ERROR_DECLARE (save_err);
+  if (! replay_path &&
+      ! mag_calibration_save (&mag_cal, MAG_CALIBRATION_PATH, &save_err))
+    fprintf (stderr, "%s: %s\n", argv[0], error_message (&save_err));
+
+  i2c_sensors_gyro_bias (sensors, NULL);
+  ERROR_DECLARE (gyro_bias_save_err);
+  if (! replay_path &&
+      ! gyro_bias_save (&gyro_bias, GYRO_BIAS_PATH, &gyro_bias_save_err))
+    fprintf ( stderr, "%s: %s\n", argv[0]
+            , error_message (&gyro_bias_save_err) );
+
+  i2c_sensors_dump (sensors, stderr);
+
+  i2c_sensors_stats_t stats;
+  i2c_sensors_stats (sensors, &stats);
+  fprintf ( stderr, "bus load %.1f%%, %.1f%% left; late polls: "
+                    "baro %lu gyro %lu acc %lu mag %lu\n"
+          , stats.bus_load*100.0, stats.bus_budget*100.0
+          , stats.baro.late, stats.gyro.late, stats.acc.late, stats.mag.late );
+  fprintf (stderr, "ring overflows: %lu\n", overflows);
+  fprintf ( stderr, "decimated: gyro %lu acc %lu samples\n", gyro_decimated
+          , acc_decimated );
+
+  decimate_free (acc_dec);
+  decimate_free (gyro_dec);
+
+  if (log && ! flight_log_close (log, &err))
+    goto error;
+
+  if (pps)
+    pps_free (pps);
   i2c_sensors_free (sensors);
 
   return 0;
 
 error:
-  fprintf (stderr, "%s: %s\n", argv[0], err.message);
+  fprintf (stderr, "%s: %s\n", argv[0], error_message (&err));
   return 1;
 }
 
 static void
-print_res (const i2c_sensors_result_t *const res)
+on_signal (int signum)
+{
+  stop = 1;
+}
+
+static void
+estimate ( ahrs_t *const ahrs, vertical_t *const vertical
+         , const i2c_sensors_result_t *const res )
+{
+  if (res->mag.have_result)
+    ahrs_mag (ahrs, &res->mag);
+  if (res->acc.have_result) {
+    ahrs_acc (ahrs, &res->acc);
+    vertical_acc (vertical, ahrs, &res->acc);
+  }
+  if (res->gyro.have_result)
+    ahrs_gyro (ahrs, &res->gyro);
+  if (res->baro.have_result)
+    vertical_baro (vertical, &res->baro);
+}
+
+static void
+print_res ( const acquisition_record_t *const rec, const pps_t *const pps
+          , const vertical_t *const vertical )
 {
+  const i2c_sensors_result_t *res = &rec->res;
+
+  /* UTC once the PPS has locked, seconds since boot until then */
+  if (pps && pps_locked (pps))
+    printf ("%16.6f | ", pps_utc (pps, rec->time) / (double)NS_PER_S);
+  else
+    printf ("%16.6f | ", rec->time / (double)NS_PER_S);
+
   if (res->baro.have_result) {
-    double alt = 44330.0 * (1.0 - pow (res->baro.pressure/P_SEA, 1.0/5.255));
-    printf ( "% 5.1f %6.2f % 4.0f | "
-           , res->baro.temperature, res->baro.pressure/1000.0, alt);
+    printf ( "% 5.1f %6.2f % 4.0f % 4.1f | "
+           , res->baro.temperature, res->baro.pressure/1000.0, vertical->h
+           , vertical->v );
   } else {
-    printf ("%5s %6s %4s | ", "", "", "");
+    printf ("%5s %6s %4s %4s | ", "", "", "", "");
   }
 
   if (res->gyro.have_result) {
@@ -86,6 +349,53 @@ print_res (const i2c_sensors_result_t *const res)
   fflush (stdout);
 }
 
+/* The time of the newest result in res; false without any */
+static bool
+newest_time (const i2c_sensors_result_t *const res, int64_t *const time)
+{
+  const struct { bool have; int64_t time; } results[] =
+    { { res->baro.have_result, res->baro.time }
+    , { res->gyro.have_result, res->gyro.time }
+    , { res->acc.have_result,  res->acc.time }
+    , { res->mag.have_result,  res->mag.time } };
+
+  bool any = false;
+  for (size_t i = 0; i < sizeof results / sizeof *results; ++i)
+    if (results[i].have && (! any || results[i].time > *time)) {
+      *time = results[i].time;
+      any = true;
+    }
+
+  return any;
+}
+
+static void
+print_delay ( const char *const name, const decimate_t *const dec
+            , const int64_t period )
+{
+  int64_t group_delay, latency;
+  decimate_delay (dec, period, &group_delay, &latency);
+  fprintf ( stderr, "%s decimated: %.1f ms behind, up to %.1f ms more\n"
+          , name, group_delay / 1e6, latency / 1e6 );
+}
+
+/* The source results of records through dec; returns how many samples came
+ * out.
+ */
+static unsigned long
+decimate ( decimate_t *const dec, const decimate_source_t source
+         , const acquisition_record_t *const records, const size_t count )
+{
+  unsigned long n = 0;
+  for (size_t i = 0; i < count; ) {
+    sample_block_t out;
+    i += decimate_records (dec, source, &records[i], count - i, &out);
+    n += out.count;
+  }
+
+  return n;
+}
+
 static inline double
 magnitude (const double x, const double y, const double z)
 {
@@ -0,0 +1,190 @@
+/* PPS mapping from CLOCK_MONOTONIC to UTC and GPS time */
+
+#include <fcntl.h>
+#include <linux/pps.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "pps.h"
+
+#include "common.h"
+#include "error-utilities.h"
+#include "time-utilities.h"
+
+/* How far CLOCK_MONOTONIC may run off from the pulses, beyond which two of
+ * them are taken not to belong together.
+ */
+#define MAX_DRIFT 1000  /* ppm */
+
+struct pps {
+  int fd;
+  bool have_pulse;
+  unsigned sequence;  /* assert_sequence of the last pulse taken */
+  int64_t monotonic;  /* CLOCK_MONOTONIC ns at the last pulse */
+  int64_t utc;        /* UTC ns at the last pulse; a whole second */
+  double rate;        /* UTC ns per CLOCK_MONOTONIC ns */
+  bool locked;
+};
+
+static int64_t realtime_offset (void);
+
+pps_t *
+pps_new (const char *const dev, error_t *const err)
+{
+  pps_t *pps = malloc (sizeof (pps_t));
+  if (! pps) {
+    error_errno (err);
+    error_prefix (err, "malloc failed");
+    goto malloc_failed;
+  }
+
+  pps->have_pulse = pps->locked = false;
+  pps->rate = 1.0;
+
+  if ((pps->fd = open (dev, O_RDONLY)) < 0) {
+    error_errno (err);
+    error_prefix_printf (err, "open %s failed", dev);
+    goto open_failed;
+  }
+
+  int caps;
+  if (ioctl (pps->fd, PPS_GETCAP, &caps) < 0) {
+    error_errno (err);
+    error_prefix (err, "PPS_GETCAP failed");
+    goto ioctl_failed;
+  }
+
+  if (! (caps & PPS_CAPTUREASSERT)) {
+    error_printf (err, "%s cannot capture assert edges", dev);
+    goto ioctl_failed;
+  }
+
+  struct pps_kparams params;
+  if (ioctl (pps->fd, PPS_GETPARAMS, &params) < 0) {
+    error_errno (err);
+    error_prefix (err, "PPS_GETPARAMS failed");
+    goto ioctl_failed;
+  }
+
+  /* Setting the mode needs write access; leave it if it is already right. */
+  if (! (params.mode & PPS_CAPTUREASSERT)) {
+    params.mode |= PPS_CAPTUREASSERT | PPS_TSFMT_TSPEC;
+    if (ioctl (pps->fd, PPS_SETPARAMS, &params) < 0) {
+      error_errno (err);
+      error_prefix (err, "PPS_SETPARAMS failed");
+      goto ioctl_failed;
+    }
+  }
+
+  return pps;
+
+ioctl_failed:
+  close (pps->fd);
+
+open_failed:
+  free (pps);
+
+malloc_failed:
+  error_prefix (err, "pps_new");
+  return NULL;
+}
+
+void
+pps_free (pps_t *const pps)
+{
+  close (pps->fd);
+  pps->fd = POISON;
+
+  free (pps);
+}
+
+bool
+pps_update ( pps_t *const pps, const int timeout_ms, bool *const fresh
+           , error_t *const err )
+{
+  struct pps_fdata fdata = { .timeout = { .flags = PPS_TIME_INVALID } };
+
+  *fresh = false;
+
+  /* A zero timeout returns the newest pulse right away. */
+  if (timeout_ms >= 0)
+    fdata.timeout = (struct pps_ktime){ timeout_ms / 1000
+                                      , timeout_ms % 1000 * 1000000, 0 };
+
+  if (ioctl (pps->fd, PPS_FETCH, &fdata) < 0) {
+    if (errno == ETIMEDOUT || errno == EINTR)
+      return true;
+
+    error_errno (err);
+    error_prefix (err, "pps_update: PPS_FETCH failed");
+    return false;
+  }
+
+  if (fdata.info.assert_sequence == 0 ||
+      (pps->have_pulse && fdata.info.assert_sequence == pps->sequence))
+    return true;
+
+  /* The kernel stamps the edge with CLOCK_REALTIME. */
+  int64_t realtime = (int64_t)fdata.info.assert_tu.sec * NS_PER_S +
+                     fdata.info.assert_tu.nsec;
+  int64_t monotonic = realtime - realtime_offset ();
+  int64_t utc = (realtime + NS_PER_S/2) / NS_PER_S * NS_PER_S;
+
+  pps->locked = false;
+  pps->rate = 1.0;
+
+  if (pps->have_pulse) {
+    int64_t dm = monotonic - pps->monotonic
+          , du = utc - pps->utc;
+    int64_t off = dm > du ? dm - du : du - dm;
+
+    if (du > 0 && off < du / 1000000 * MAX_DRIFT) {
+      pps->rate = (double)du / dm;
+      pps->locked = true;
+    }
+  }
+
+  pps->have_pulse = true;
+  pps->sequence = fdata.info.assert_sequence;
+  pps->monotonic = monotonic;
+  pps->utc = utc;
+
+  *fresh = true;
+  return true;
+}
+
+bool
+pps_locked (const pps_t *const pps)
+{
+  return pps->locked;
+}
+
+int64_t
+pps_utc (const pps_t *const pps, const int64_t monotonic)
+{
+  return pps->utc + (int64_t)((monotonic - pps->monotonic) * pps->rate);
+}
+
+int64_t
+pps_gps (const pps_t *const pps, const int64_t monotonic)
+{
+  return pps_utc (pps, monotonic) +
+         (int64_t)(PPS_LEAP_SECONDS - PPS_GPS_EPOCH) * NS_PER_S;
+}
+
+/* CLOCK_REALTIME - CLOCK_MONOTONIC, read between two realtime samples to
+ * halve the error.
+ */
+static int64_t
+realtime_offset (void)
+{
+  struct timespec r0, m, r1;
+  clock_gettime (CLOCK_REALTIME, &r0);
+  clock_gettime (CLOCK_MONOTONIC, &m);
+  clock_gettime (CLOCK_REALTIME, &r1);
+
+  return time_ns (&r0) + (time_ns (&r1) - time_ns (&r0)) / 2 - time_ns (&m);
+}
@@ -0,0 +1,52 @@
+/* PPS mapping from CLOCK_MONOTONIC to UTC and GPS time */
+
+#ifndef INCLUDE_PPS_H
+#define INCLUDE_PPS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "error-utilities.h"
+
+/* 1980-01-06T00:00:00Z in Unix time */
+#define PPS_GPS_EPOCH 315964800  /* s */
+
+/* GPS - UTC since 2017-01-01 */
+#define PPS_LEAP_SECONDS 18  /* s */
+
+typedef struct pps pps_t;
+
+/* dev is a pps-gpio device such as /dev/pps0, capturing assert edges at the
+ * top of each UTC second. The system clock must be within half a second of
+ * UTC (NTP on the same PPS does that) to name the second a pulse belongs to.
+ */
+pps_t *
+pps_new (const char *const dev, error_t *const err);
+
+void
+pps_free (pps_t *const pps);
+
+/* Take the newest pulse, waiting up to timeout_ms (-1: forever, 0: just look)
+ * for one that has not been seen yet. fresh tells whether there was one.
+ */
+bool
+pps_update ( pps_t *const pps, const int timeout_ms, bool *const fresh
+           , error_t *const err );
+
+/* Two pulses a whole number of seconds apart have been seen, and the rate of
+ * CLOCK_MONOTONIC against them is known.
+ */
+bool
+pps_locked (const pps_t *const pps);
+
+/* UTC ns since the Unix epoch at CLOCK_MONOTONIC time ns. Only meaningful
+ * while locked.
+ */
+int64_t
+pps_utc (const pps_t *const pps, const int64_t monotonic);
+
+/* GPS ns since the GPS epoch. */
+int64_t
+pps_gps (const pps_t *const pps, const int64_t monotonic);
+
+#endif /* INCLUDE_PPS_H */
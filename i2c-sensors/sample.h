@@ -0,0 +1,56 @@
+/* Raw x, y, z samples and the scales that turn them into units
+ *
+ * The drivers hand out register values as read, next to a descriptor of what
+ * one LSB is worth, so that a consumer can stay in integers or float and
+ * convert when (or if) it needs to.
+ */
+
+#ifndef INCLUDE_SAMPLE_H
+#define INCLUDE_SAMPLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  int64_t time;    /* CLOCK_MONOTONIC ns */
+  int16_t xyz[3];  /* As read, in the chip's axes */
+} sample_raw_t;
+
+/* Samples drained from a FIFO in one burst, in units, oldest first. Sample i
+ * was taken at about time - (count-1-i)*period.
+ */
+#define SAMPLE_BLOCK_SIZE 32
+
+typedef struct {
+  size_t count;
+  bool overrun;    /* Samples were lost before the oldest one here */
+  int64_t time;    /* CLOCK_MONOTONIC ns when the FIFO was read out */
+  int64_t period;  /* ns between samples at the output data rate */
+  float x[SAMPLE_BLOCK_SIZE], y[SAMPLE_BLOCK_SIZE], z[SAMPLE_BLOCK_SIZE];
+} sample_block_t;
+
+/* units = xyz * scale + bias, per axis. In double, so that the double
+ * results come out as exact as the constants allow; the float paths round
+ * scale and bias to float first.
+ */
+typedef struct {
+  double scale[3];
+  double bias[3];
+} sample_scale_t;
+
+static inline float
+sample_unitsf ( const sample_scale_t *const scale, const int16_t *const xyz
+              , const int axis )
+{
+  return xyz[axis] * (float)scale->scale[axis] + (float)scale->bias[axis];
+}
+
+static inline double
+sample_units ( const sample_scale_t *const scale, const int16_t *const xyz
+             , const int axis )
+{
+  return xyz[axis] * scale->scale[axis] + scale->bias[axis];
+}
+
+#endif /* INCLUDE_SAMPLE_H */
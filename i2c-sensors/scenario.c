@@ -0,0 +1,45 @@
+/* What the benchmarks and the checks feed the computations */
+
+#include <math.h>
+
+#include "scenario.h"
+
+#define MAG_FIELD 48e-6  /* T */
+
+static const double soft_iron[3][3] = { { 1.15, 0.06, -0.04 }
+                                      , { 0.06, 0.92, 0.03 }
+                                      , { -0.04, 0.03, 1.03 } }
+                  , hard_iron[3] = { 30e-6, -45e-6, 40e-6 };
+
+const decimate_config_t scenario_decimate_acc =
+                          { DECIMATE_FIR, 25, 168, 64, 0.8 }
+                      , scenario_decimate_gyro =
+                          { DECIMATE_FIR, 5, 19, 64, 0.8 }
+                      , scenario_decimate_cic =
+                          { DECIMATE_CIC, 1, 4, 3, 0 };
+
+void
+scenario_mag_distort (const double *const u, double *const raw)
+{
+  for (int i = 0; i < 3; ++i)
+    raw[i] = hard_iron[i] + MAG_FIELD * ( soft_iron[i][0] * u[0]
+                                        + soft_iron[i][1] * u[1]
+                                        + soft_iron[i][2] * u[2] );
+}
+
+void
+scenario_mag_tumble (const double s, double *const u)
+{
+  const double az = 0.9 * s, el = 1.2 * sin (0.37 * s);
+  u[0] = cos (el) * cos (az);
+  u[1] = cos (el) * sin (az);
+  u[2] = sin (el);
+}
+
+void
+scenario_gyro_bias (const int temp, double *const bias)
+{
+  static const double at_zero[3] = { 2.0, -1.5, 3.0 }, slope[3] = { 1, -1, 1 };
+  for (int i = 0; i < 3; ++i)
+    bias[i] = (at_zero[i] + 0.04 * slope[i] * temp) * M_PI / 180.0;
+}
@@ -0,0 +1,36 @@
+/* What the benchmarks and the checks feed the computations
+ *
+ * bench times the computations on the same inputs that check holds them to
+ * the truth with, so that a fast path is only ever fast at getting it
+ * right.
+ */
+
+#ifndef INCLUDE_SCENARIO_H
+#define INCLUDE_SCENARIO_H
+
+#include "decimate.h"
+
+/* The accelerometer and the gyro brought down to 200 Hz, passing up to
+ * 80 Hz, and the gyro by a whole factor to 190 Hz
+ */
+extern const decimate_config_t scenario_decimate_acc, scenario_decimate_gyro
+                             , scenario_decimate_cic;
+
+/* What the magnetometer would see, with iron on board, of a 48 µT field
+ * along the unit vector u: stretched and sheared by up to 15 %, and offset
+ * by more than itself
+ */
+void
+scenario_mag_distort (const double *const u, double *const raw);
+
+/* The field's direction at s seconds into a slow tumble */
+void
+scenario_mag_tumble (const double s, double *const u);
+
+/* The gyro bias at an OUT_TEMP reading, in radian/s: 0.04 °/s per °C, as
+ * much as the datasheet allows, from a few °/s
+ */
+void
+scenario_gyro_bias (const int temp, double *const bias);
+
+#endif /* INCLUDE_SCENARIO_H */
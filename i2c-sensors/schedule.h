@@ -0,0 +1,82 @@
+/* Min-heap of deadlines */
+
+#ifndef INCLUDE_SCHEDULE_H
+#define INCLUDE_SCHEDULE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCHEDULE_MAX 8
+
+typedef struct {
+  int64_t due;  /* CLOCK_MONOTONIC ns */
+  int id;
+} schedule_entry_t;
+
+typedef struct {
+  schedule_entry_t entries[SCHEDULE_MAX];
+  size_t n;
+} schedule_t;
+
+static inline void
+schedule_clear (schedule_t *const sched)
+{
+  sched->n = 0;
+}
+
+static inline bool
+schedule_empty (const schedule_t *const sched)
+{
+  return sched->n == 0;
+}
+
+/* The entry due first. The schedule must not be empty. */
+static inline const schedule_entry_t *
+schedule_top (const schedule_t *const sched)
+{
+  return &sched->entries[0];
+}
+
+static inline bool
+schedule_push (schedule_t *const sched, const int id, const int64_t due)
+{
+  if (sched->n == SCHEDULE_MAX)
+    return false;
+
+  schedule_entry_t *e = sched->entries;
+  size_t i = sched->n++;
+
+  for (; i > 0 && e[(i-1)/2].due > due; i = (i-1)/2)
+    e[i] = e[(i-1)/2];
+  e[i] = (schedule_entry_t){ .due = due, .id = id };
+
+  return true;
+}
+
+static inline schedule_entry_t
+schedule_pop (schedule_t *const sched)
+{
+  schedule_entry_t *e = sched->entries;
+  schedule_entry_t top = e[0]
+                 , last = e[--sched->n];
+  size_t n = sched->n, i = 0;
+
+  for (;;) {
+    size_t child = 2*i + 1;
+    if (child >= n)
+      break;
+    if (child + 1 < n && e[child+1].due < e[child].due)
+      ++child;
+    if (last.due <= e[child].due)
+      break;
+
+    e[i] = e[child];
+    i = child;
+  }
+  e[i] = last;
+
+  return top;
+}
+
+#endif /* INCLUDE_SCHEDULE_H */
@@ -0,0 +1,28 @@
+#include "simd.h"
+
+bool
+simd_have_avx2 (void)
+{
+#ifdef SIMD_SSE2
+  /* A benign race: every thread comes up with the same answer. */
+  static int avx2 = -1;
+  if (avx2 < 0)
+    avx2 = __builtin_cpu_supports ("avx2");
+
+  return avx2;
+#else
+  return false;
+#endif
+}
+
+const char *
+simd_impl (void)
+{
+#if defined SIMD_NEON
+  return "neon";
+#elif defined SIMD_SSE2
+  return simd_have_avx2 () ? "avx2" : "sse2";
+#else
+  return "scalar";
+#endif
+}
@@ -0,0 +1,41 @@
+/* Vector instructions for the block paths
+ *
+ * SIMD_NEON or SIMD_SSE2 gets defined, with the intrinsics included, when
+ * the compiler targets them. The AVX2 paths are built next to the SSE2 ones
+ * with a target attribute and taken only where simd_have_avx2 says so.
+ */
+
+#ifndef INCLUDE_SIMD_H
+#define INCLUDE_SIMD_H
+
+#include <stdbool.h>
+
+#if defined __ARM_NEON || defined __ARM_NEON__
+#define SIMD_NEON
+#include <arm_neon.h>
+#elif defined __SSE2__
+#define SIMD_SSE2
+#include <immintrin.h>
+#endif
+
+/* Whether the CPU runs AVX2; false without SIMD_SSE2. */
+bool
+simd_have_avx2 (void);
+
+/* "neon", "avx2", "sse2" or "scalar": the paths the block functions take */
+const char *
+simd_impl (void);
+
+#ifdef SIMD_SSE2
+/* The last thing in an AVX2 path. The compiler leaves vzeroupper out
+ * without optimization, and SSE code after dirty upper halves runs several
+ * times slower.
+ */
+static inline void __attribute__ ((target ("avx2"), always_inline))
+simd_avx2_leave (void)
+{
+  _mm256_zeroupper ();
+}
+#endif
+
+#endif /* INCLUDE_SIMD_H */
@@ -0,0 +1,34 @@
+#ifndef INCLUDE_TIME_UTILITIES_H
+#define INCLUDE_TIME_UTILITIES_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#define NS_PER_S 1000000000
+
+static inline int64_t
+time_ns (const struct timespec *const ts)
+{
+  return (int64_t)ts->tv_sec * NS_PER_S + ts->tv_nsec;
+}
+
+/* CLOCK_MONOTONIC in nanoseconds. */
+static inline int64_t
+time_monotonic (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return time_ns (&ts);
+}
+
+/* Sleep until CLOCK_MONOTONIC reaches time (ns). */
+static inline void
+time_sleep_until (const int64_t time)
+{
+  struct timespec ts = { time / NS_PER_S, time % NS_PER_S };
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+#endif /* INCLUDE_TIME_UTILITIES_H */
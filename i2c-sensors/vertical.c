@@ -0,0 +1,128 @@
+/* Baro/inertial vertical channel */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vertical.h"
+
+#include "ahrs.h"
+#include "altitude.h"
+#include "bmp085.h"
+#include "lsm303dlhc-acc.h"
+#include "time-utilities.h"
+
+/* What the climb rate and bias start out as, give or take */
+#define INITIAL_V_SD    1.0f  /* m/s */
+#define INITIAL_BIAS_SD 0.3f  /* m/s² */
+
+void
+vertical_init (vertical_t *const vertical, const float p0)
+{
+  vertical->h = vertical->v = vertical->bias = 0.0f;
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      vertical->P[i][j] = 0.0f;
+  vertical->p0 = p0;
+  vertical->time = 0;
+  vertical->have_h = false;
+}
+
+void
+vertical_acc ( vertical_t *const vertical, const ahrs_t *const ahrs
+             , const lsm303dlhc_acc_result_t *const res )
+{
+  int64_t step = res->time - vertical->time;
+  bool first = vertical->time == 0;
+
+  vertical->time = res->time;
+  if (first || step <= 0)
+    return;
+
+  if (step > VERTICAL_MAX_STEP)
+    step = VERTICAL_MAX_STEP;
+
+  /* The earth z row of the body to earth rotation */
+  const float *q = ahrs->q;
+  float up = 2.0f * (q[1]*q[3] - q[0]*q[2]) * (float)res->x
+           + 2.0f * (q[2]*q[3] + q[0]*q[1]) * (float)res->y
+           + (1.0f - 2.0f * (q[1]*q[1] + q[2]*q[2])) * (float)res->z;
+
+  vertical_predict ( vertical, (float)step / NS_PER_S
+                   , up - VERTICAL_GRAVITY );
+}
+
+void
+vertical_baro (vertical_t *const vertical, const bmp085_result_t *const res)
+{
+  vertical_altitude ( vertical
+                    , altitude_from_pressure (res->pressure, vertical->p0) );
+}
+
+void
+vertical_predict ( vertical_t *const vertical, const float dt
+                 , const float acc_up )
+{
+  if (! vertical->have_h)
+    return;
+
+  float a = acc_up - vertical->bias, dt2 = 0.5f * dt * dt;
+  vertical->h += vertical->v * dt + a * dt2;
+  vertical->v += a * dt;
+
+  /* P = F P F' + Q, F = [1 dt -dt²/2; 0 1 -dt; 0 0 1] */
+  const float F[3][3] = { { 1.0f, dt, -dt2 }, { 0.0f, 1.0f, -dt }
+                        , { 0.0f, 0.0f, 1.0f } };
+  float FP[3][3];
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      FP[i][j] = F[i][0] * vertical->P[0][j] + F[i][1] * vertical->P[1][j]
+               + F[i][2] * vertical->P[2][j];
+  for (int i = 0; i < 3; ++i)
+    for (int j = i; j < 3; ++j)
+      vertical->P[i][j] = vertical->P[j][i] =
+        FP[i][0] * F[j][0] + FP[i][1] * F[j][1] + FP[i][2] * F[j][2];
+
+  /* White acceleration through G = [dt²/2 dt 0]', and a bias random walk */
+  const float qa = VERTICAL_ACC_NOISE * VERTICAL_ACC_NOISE
+            , qb = VERTICAL_BIAS_DRIFT * VERTICAL_BIAS_DRIFT * dt;
+  vertical->P[0][0] += qa * dt2 * dt2;
+  vertical->P[0][1] += qa * dt2 * dt;
+  vertical->P[1][0] = vertical->P[0][1];
+  vertical->P[1][1] += qa * dt * dt;
+  vertical->P[2][2] += qb;
+}
+
+void
+vertical_altitude (vertical_t *const vertical, const float h)
+{
+  const float r = VERTICAL_BARO_NOISE * VERTICAL_BARO_NOISE;
+
+  if (! vertical->have_h) {
+    vertical->h = h;
+    vertical->v = vertical->bias = 0.0f;
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 3; ++j)
+        vertical->P[i][j] = 0.0f;
+    vertical->P[0][0] = r;
+    vertical->P[1][1] = INITIAL_V_SD * INITIAL_V_SD;
+    vertical->P[2][2] = INITIAL_BIAS_SD * INITIAL_BIAS_SD;
+    vertical->have_h = true;
+    return;
+  }
+
+  /* H = [1 0 0] */
+  float y = h - vertical->h, s = vertical->P[0][0] + r;
+  float k[3] = { vertical->P[0][0] / s, vertical->P[1][0] / s
+               , vertical->P[2][0] / s };
+
+  vertical->h    += k[0] * y;
+  vertical->v    += k[1] * y;
+  vertical->bias += k[2] * y;
+
+  const float row[3] = { vertical->P[0][0], vertical->P[0][1]
+                       , vertical->P[0][2] };
+  for (int i = 0; i < 3; ++i)
+    for (int j = i; j < 3; ++j)
+      vertical->P[i][j] = vertical->P[j][i] =
+        vertical->P[i][j] - k[i] * row[j];
+}
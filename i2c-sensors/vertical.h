@@ -0,0 +1,65 @@
+/* Altitude and climb rate from the barometer and the accelerometer
+ *
+ * A Kalman filter over altitude, climb rate and the accelerometer's bias
+ * along the vertical. Every accelerometer sample, turned to the earth frame
+ * with the AHRS attitude and with gravity taken out, predicts; every
+ * pressure corrects, through altitude_from_pressure. So the estimate comes
+ * at the accelerometer rate, with the barometer's noise filtered out and
+ * its lag made up for.
+ */
+
+#ifndef INCLUDE_VERTICAL_H
+#define INCLUDE_VERTICAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ahrs.h"
+#include "bmp085.h"
+#include "lsm303dlhc-acc.h"
+
+#define VERTICAL_GRAVITY 9.80665f  /* m/s² */
+
+/* Standard deviations the filter is tuned for */
+#define VERTICAL_ACC_NOISE  0.5f   /* m/s², of the vertical acceleration */
+#define VERTICAL_BIAS_DRIFT 0.01f  /* m/s² in a second, of its bias */
+#define VERTICAL_BARO_NOISE 0.5f   /* m, of a barometric altitude */
+
+/* Longest step taken between accelerometer samples */
+#define VERTICAL_MAX_STEP 20000000  /* ns */
+
+typedef struct {
+  float h, v, bias;  /* m, m/s up, m/s² */
+  float P[3][3];     /* Their covariance */
+  float p0;          /* Pa at h = 0 */
+  int64_t time;      /* CLOCK_MONOTONIC ns of the last prediction, or 0 */
+  bool have_h;       /* A pressure has come in; h and v mean something */
+} vertical_t;
+
+/* Altitudes are to be above where the pressure is p0 Pa. */
+void
+vertical_init (vertical_t *const vertical, const float p0);
+
+/* Predict up to the time of res with the acceleration it measured, in the
+ * attitude ahrs has.
+ */
+void
+vertical_acc ( vertical_t *const vertical, const ahrs_t *const ahrs
+             , const lsm303dlhc_acc_result_t *const res );
+
+/* Correct with the pressure of res. */
+void
+vertical_baro (vertical_t *const vertical, const bmp085_result_t *const res);
+
+/* One step of dt s at the upward acceleration acc_up (m/s², without
+ * gravity).
+ */
+void
+vertical_predict ( vertical_t *const vertical, const float dt
+                 , const float acc_up );
+
+/* Correct with an altitude in m. The first one sets h outright. */
+void
+vertical_altitude (vertical_t *const vertical, const float h);
+
+#endif /* INCLUDE_VERTICAL_H */
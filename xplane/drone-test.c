@@ -10,6 +10,8 @@
 #include <XPLMProcessing.h>
 #include <XPLMUtilities.h>
 
+#include "altitude.h"
+
 static void
 xplm_vprintf (const char *const format, va_list ap)
 {
@@ -111,7 +113,7 @@ flight_loop_cb ( float elapsed_since_last_call
        , temp = XPLMGetDataf (temperature_r)
        ;
 
-  double pres_alt = 44330.0 * (1.0 - pow (pres/pres_sea, 1.0/5.255));
+  double pres_alt = altitude_from_pressure (pres, pres_sea);
 
   xplm_log ("BEGIN");
   xplm_log ("lat=%.6f lon=%.6f ele=%.1f", lat, lon, ele);